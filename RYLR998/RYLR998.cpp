@@ -16,26 +16,45 @@
  * limitations under the License.
  */
  
-#include "mbed.h"
+#include <stdio.h>
 #include "RYLR998.h"
+#include "RYLR998_Log.h"
+#include "RYLR998_Spool.h"
 
+#if RYLR998_PORT_MBED
 RYLR998::RYLR998(PinName tx, PinName rx, PinName reset, bool debug)
     : _fw_ver(-1, -1, -1),
       _rf_param(-1, -1, -1, -1),
       _reset(reset),
       _serial(tx, rx, RYLR998_DEFAULT_BAUD_RATE),
       _parser(&_serial)
+{
+    _init(debug);
+}
+#else
+RYLR998::RYLR998(const char *device, int reset, bool debug)
+    : _fw_ver(-1, -1, -1),
+      _rf_param(-1, -1, -1, -1),
+      _serial(device, RYLR998_DEFAULT_BAUD_RATE),
+      _reset(_serial, reset),
+      _parser(&_serial)
+{
+    _init(debug);
+}
+#endif
+
+void RYLR998::_init(bool debug)
 {
     _parser.debug_on(debug);
     _parser.set_delimiter("\r\n");
-    _parser.oob("+RCV", callback(this, &RYLR998::_oob_packet_hdlr));
-    _parser.oob("+ERR", callback(this, &RYLR998::_oob_error_hdlr));
+    _parser.oob("+RCV", rylr998_port::callback(this, &RYLR998::_oob_packet_hdlr));
+    _parser.oob("+ERR", rylr998_port::callback(this, &RYLR998::_oob_error_hdlr));
     set_timeout(RYLR998_CMD_TIMEOUT);
 
     if (_reset.is_connected())
     {
         _reset = 1;
-        ThisThread::sleep_for(200ms);
+        rylr998_port::sleep_for(std::chrono::milliseconds(200));
         flush();
     }
 
@@ -47,6 +66,43 @@ RYLR998::RYLR998(PinName tx, PinName rx, PinName reset, bool debug)
     _rx_boost = false;
     _r_rssi = 0;
     _r_snr = 0;
+    _r_time = 0;
+
+    _mode = 0;
+    _config = 0;
+    _last_error = 0;
+    _rand_state = 0;
+
+    _dedup = false;
+    _tx_seq = 0;
+    _log = nullptr;
+    _spool = nullptr;
+    _spool_ram = RYLR998_SPOOL_RAM_FRAMES;
+    _ram_older = 0;
+    _tx_spool = nullptr;
+
+    _fail_count = 0;
+    _err_pending = false;
+    _err_link = false;
+    _recovering = false;
+    _down = false;
+    _down_since = 0;
+    _last_attempt = 0;
+    _tx_head = 0;
+    _tx_count = 0;
+    memset(&_health, 0, sizeof(_health));
+
+    _pwr_rx_ms = 0;
+    _pwr_sleep_ms = 0;
+    _pwr_phase_start = 0;
+    _asleep = false;
+    _pwr_busy = false;
+    _pwr_head = 0;
+    _pwr_count = 0;
+    memset(&_pwr_stats, 0, sizeof(_pwr_stats));
+
+    for (int i = 0; i < RYLR998_LINK_PEERS; i++)
+        _peers[i].addr = -1;
 }
 
 void RYLR998::hw_reset(void)
@@ -54,7 +110,7 @@ void RYLR998::hw_reset(void)
     if (_reset.is_connected())
     {
         _reset = 0;
-        ThisThread::sleep_for(100ms);
+        rylr998_port::sleep_for(std::chrono::milliseconds(100));
         _reset = 1;
     }
 }
@@ -92,12 +148,15 @@ struct RYLR998::fw_version RYLR998::get_fw_version()
     bool done;
     int major, minor, patch;
 
+    if (!_ready())
+        return _fw_ver;
+
     _smutex.lock();
     done = _parser.send("AT+VER?")
            && _parser.recv("+VER=RYLR998_REYAX_V%d.%d.%d\n", &major, &minor, &patch);
     _smutex.unlock();
 
-    if (done)
+    if (_check(done))
     {
         _fw_ver.major = major;
         _fw_ver.minor = minor;
@@ -111,12 +170,15 @@ char * RYLR998::get_uid(void)
 {
     bool done;
 
+    if (!_ready())
+        return NULL;
+
     _smutex.lock();
     done = _parser.send("AT+UID?")
            && _parser.recv("+UID=%24s\n", _uid);
     _smutex.unlock();
 
-    return (done)? _uid : NULL;
+    return (_check(done))? _uid : NULL;
 }
 
 struct RYLR998::rf_param RYLR998::get_rf_parameter(void)
@@ -124,252 +186,639 @@ struct RYLR998::rf_param RYLR998::get_rf_parameter(void)
     bool done;
     int sf, bw, cr, pp;
 
+    if (!_ready())
+        return _rf_param;
+
     _smutex.lock();
     done = _parser.send("AT+PARAMETER?")
            && _parser.recv("+PARAMETER=%d,%d,%d,%d\n", &sf, &bw, &cr, &pp);
     _smutex.unlock();
 
-    if (done)
+    if (_check(done))
     {
         _rf_param.sf = sf;
         _rf_param.bw = bw;
         _rf_param.cr = cr;
         _rf_param.pp = pp;
+        _config |= RYLR998_CFG_RF;
     }
 
     return _rf_param;
 }
 
-void RYLR998::set_rf_parameter(int sf, int bw, int cr, int pp)
+bool RYLR998::set_rf_parameter(int sf, int bw, int cr, int pp)
 {
     if (sf < 7 || sf > 11 ||
         bw < 0 || bw > 9 ||
         cr < 1 || cr > 4 ||
         pp < 4 || pp > 24)
-        return;
+        return false;
+
+    if (!_ready())
+        return false;
 
     _smutex.lock();
     bool done = _parser.send("AT+PARAMETER=%d,%d,%d,%d", sf, bw, cr, pp)
            && _parser.recv("+OK");
     _smutex.unlock();
 
-    if (done)
+    if (_check(done))
     {
         _rf_param.sf = sf;
         _rf_param.bw = bw;
         _rf_param.cr = cr;
         _rf_param.pp = pp;
-    }    
+        _config |= RYLR998_CFG_RF;
+    }
+
+    return done;
 }
 
-void RYLR998::set_mode(int mode)
+bool RYLR998::set_mode(int mode)
 {
     if (mode < 0 || mode > 2)
-        return;
+        return false;
+
+    if (!_ready())
+        return false;
 
     _smutex.lock();
     bool done = _parser.send("AT+MODE=%d", mode)
                 && _parser.recv("+OK");
     _smutex.unlock();
+
+    if (_check(done))
+    {
+        _mode = mode;
+        _config |= RYLR998_CFG_MODE;
+    }
+
+    return done;
 }
 
-void RYLR998::set_baudrate(int rate)
+bool RYLR998::set_baudrate(int rate)
 {
     int r;
+
+    if (!_ready())
+        return false;
+
     _smutex.lock();
     bool done = _parser.send("AT+IPR=%d", rate)
                 && _parser.recv("+IPR=%d\n", &r);
     _smutex.unlock();
+
+    return _check(done);
 }
 
 int RYLR998::get_baudrate(void)
 {
     int r;
 
+    if (!_ready())
+        return -1;
+
     _smutex.lock();
     bool done = _parser.send("AT+IPR?")
                 && _parser.recv("+IPR=%d\n", &r);
     _smutex.unlock();
 
-    return r;
+    return (_check(done)) ? r : -1;
 }
 
-void RYLR998::set_band(int freq)
+bool RYLR998::set_band(int freq)
 {
+    if (!_ready())
+        return false;
+
     _smutex.lock();
     bool done = _parser.send("AT+BAND=%d", freq)
                 && _parser.recv("+OK");
     _smutex.unlock();
+
+    if (_check(done))
+    {
+        _band = freq;
+        _config |= RYLR998_CFG_BAND;
+    }
+
+    return done;
 }
 
 int RYLR998::get_band(void)
 {
     int band;
 
+    if (!_ready())
+        return _band;
+
     _smutex.lock();
     bool done = _parser.send("AT+BAND?")
                 && _parser.recv("+BAND=%d\n", &band);
     _smutex.unlock();
 
-    if (done)
+    if (_check(done))
+    {
         _band = band;
+        _config |= RYLR998_CFG_BAND;
+    }
 
     return _band;
 }
 
-void RYLR998::set_address(int addr)
+bool RYLR998::set_address(int addr)
 {
     if (addr < 0 || addr > 65535)
-        return;
+        return false;
+
+    if (!_ready())
+        return false;
 
     _smutex.lock();
     bool done = _parser.send("AT+ADDRESS=%d", addr)
                 && _parser.recv("+OK");
     _smutex.unlock();
 
-    if (done)
+    if (_check(done))
+    {
         _addr = addr;
+        _config |= RYLR998_CFG_ADDR;
+    }
+
+    return done;
 }
 
 int RYLR998::get_address(void)
 {
     int addr;
 
+    if (!_ready())
+        return _addr;
+
     _smutex.lock();
     bool done = _parser.send("AT+ADDRESS?")
                 && _parser.recv("+ADDRESS=%d\n", &addr);
     _smutex.unlock();
 
-    if (done)
+    if (_check(done))
+    {
         _addr = addr;
+        _config |= RYLR998_CFG_ADDR;
+    }
 
     return _addr;
 }
 
-void RYLR998::set_network_id(int id)
+bool RYLR998::set_network_id(int id)
 {
     if (id < 1 || id > 255)
-        return;
+        return false;
+
+    if (!_ready())
+        return false;
 
     _smutex.lock();
     bool done = _parser.send("AT+NETWORKID=%d", id)
                 && _parser.recv("+OK");
     _smutex.unlock();
 
-    if (done)
+    if (_check(done))
+    {
         _network_id = id;
+        _config |= RYLR998_CFG_NETID;
+    }
+
+    return done;
 }
 
 int RYLR998::get_network_id(void)
 {
     int id;
 
+    if (!_ready())
+        return _network_id;
+
     _smutex.lock();
     bool done = _parser.send("AT+NETWORKID?")
                 && _parser.recv("+NETWORKID=%d\n", &id);
     _smutex.unlock();
 
-    if (done)
+    if (_check(done))
+    {
         _network_id = id;
+        _config |= RYLR998_CFG_NETID;
+    }
 
     return _network_id;
 }
 
-void RYLR998::set_rf_output_power(int power)
+bool RYLR998::set_rf_output_power(int power)
 {
     if (power < 0 || power > 22)
-        return;
+        return false;
+
+    if (!_ready())
+        return false;
 
     _smutex.lock();
     bool done = _parser.send("AT+CRFOP=%d", power)
                 && _parser.recv("+OK");
     _smutex.unlock();
 
-    if (done)
+    if (_check(done))
+    {
         _rf_output_power = power;
+        _config |= RYLR998_CFG_POWER;
+    }
+
+    return done;
 }
 
 int RYLR998::get_rf_output_power(void)
 {
     int power;
 
+    if (!_ready())
+        return _rf_output_power;
+
     _smutex.lock();
     bool done = _parser.send("AT+CRFOP?")
                 && _parser.recv("+CRFOP=%d\n", &power);
     _smutex.unlock();
 
-    if (done)
+    if (_check(done))
+    {
         _rf_output_power = power;
+        _config |= RYLR998_CFG_POWER;
+    }
 
     return _rf_output_power;
 }
 
-void RYLR998::set_rx_boost(bool mode)
+bool RYLR998::set_rx_boost(bool mode)
 {
+    if (!_ready())
+        return false;
+
     _smutex.lock();
     bool done = _parser.send("AT+RXBOOST=%d", (mode) ? 1 : 0)
                 && _parser.recv("+OK");
     _smutex.unlock();
 
-    if (done)
+    if (_check(done))
+    {
         _rx_boost = ((mode) != 0);
+        _config |= RYLR998_CFG_RXBOOST;
+    }
+
+    return done;
 }
 
 bool RYLR998::get_rx_boost(void)
 {
     int mode;
 
+    if (!_ready())
+        return _rx_boost;
+
     _smutex.lock();
     bool done = _parser.send("AT+RXBOOST?")
                 && _parser.recv("+RXBOOST=%d\n", &mode);
     _smutex.unlock();
 
-    if (done)
+    if (_check(done))
+    {
         _rx_boost = ((mode) != 0);
+        _config |= RYLR998_CFG_RXBOOST;
+    }
 
     return _rx_boost;
 }
 
-void RYLR998::send(int addr, char *data)
+bool RYLR998::send(int addr, char *data)
 {
     if (addr < 0 || addr > 65535 || data == NULL)
-        return;
+        return false;
 
-    int len = strlen(data);
-    if (len > 240)
-        return;
+    return send(addr, data, strlen(data));
+}
+
+bool RYLR998::send(int addr, const char *data, int len)
+{
+    if (addr < 0 || addr > 65535 || data == NULL)
+        return false;
+
+    if (len < 0 || len > RYLR998_MAX_PAYLOAD)
+        return false;
+
+    char frame[RYLR998_MAX_PAYLOAD];
 
     _smutex.lock();
-    bool done = _parser.send("AT+SEND=%d,%d,%s", addr, len, data)
-                && _parser.recv("+OK");
+    int flen = _link_encode(addr, data, len, frame);
+    bool ask = _link_caps_due(addr);
+    _smutex.unlock();
+
+    if (flen < 0)
+        return false;
+
+    if (flen > 0)
+    {
+        data = frame;
+        len = flen;
+    }
+
+    // A sleeping module sends its queue at the next RX window. A full
+    // queue wakes it now, the queued frames go out first.
+    if (_asleep && !_pwr_busy)
+    {
+        _smutex.lock();
+        bool queued = _pwr_count < RYLR998_POWER_TX_QUEUE;
+        if (queued)
+        {
+            _Tx_Frame &f = _pwr_queue[(_pwr_head + _pwr_count) % RYLR998_POWER_TX_QUEUE];
+            f.addr = addr;
+            f.len = len;
+            std::memcpy(f.data, data, len);
+            _pwr_count++;
+            _pwr_stats.tx_deferred++;
+        }
+        else
+        {
+            _pwr_stats.early_wakes++;
+        }
+        _smutex.unlock();
+
+        if (queued)
+            return true;
+    }
+
+    // Frames that can not go out now are kept for replay after recovery
+    if (!_ready())
+    {
+        _tx_enqueue(addr, data, len);
+        return false;
+    }
+
+    // A lost capability request is asked again ahead of the data
+    if (ask)
+        _link_send_caps(addr, true);
+
+    // Only a frame lost to a timeout or to lost framing is worth a replay,
+    // one the module rejected would be rejected again
+    bool done = _send_frame(addr, data, len);
+    if (!done && (!_err_pending || _err_link))
+        _tx_enqueue(addr, data, len);
+    else if (!done)
+        _health.tx_rejected++;
+
+    return _check(done);
+}
+
+uint32_t RYLR998::get_random(void)
+{
+    if (_rand_state == 0)
+    {
+        // FNV-1a over what tells the nodes apart, then the clock, which
+        // differs by some microseconds from boot to boot after the UART
+        // exchanges above
+        uint32_t h = 2166136261u;
+        const char *uid = get_uid();
+        for (int i = 0; uid != NULL && uid[i] != '\0'; i++)
+            h = (h ^ (uint8_t)uid[i]) * 16777619u;
+        h = (h ^ (uint32_t)get_address()) * 16777619u;
+        h ^= rylr998_port::now_us();
+        _rand_state = (h != 0) ? h : 1;
+    }
+
+    // xorshift32
+    _smutex.lock();
+    uint32_t x = _rand_state;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    _rand_state = x;
+    _smutex.unlock();
+
+    return x;
+}
+
+void RYLR998::set_dedup(bool enable, uint32_t window_ms)
+{
+    // A node restarted within the window must not reuse the IDs its peers
+    // still remember, so the sequence starts at a random point
+    uint16_t seq = (enable && !_dedup) ? get_random() & 0xFFFF : _tx_seq;
+
+    _smutex.lock();
+    _tx_seq = seq;
+    _dedup = enable;
+    _dup_cache.set_window(window_ms);
+    _smutex.unlock();
+}
+
+struct RYLR998::dedup_stats RYLR998::get_dedup_stats(void)
+{
+    struct dedup_stats stats;
+
+    _smutex.lock();
+    stats.hits = _dup_cache.hits();
+    stats.misses = _dup_cache.misses();
+    stats.evictions = _dup_cache.evictions();
+    _smutex.unlock();
+
+    return stats;
+}
+
+bool RYLR998::set_compression(int addr, bool enable)
+{
+    if (addr < 1 || addr > 65535)
+        return false;
+
+    _smutex.lock();
+    _Link_Peer *peer = _link_peer(addr, enable);
+    bool ask = false;
+    if (peer != NULL)
+    {
+        peer->compress = enable;
+        ask = enable && !peer->caps_known;
+        if (ask)
+        {
+            peer->caps_asked = _now_ms();
+            peer->caps_backoff = RYLR998_LINK_CAPS_RETRY_MS;
+        }
+    }
+    _smutex.unlock();
+
+    if (ask)
+        _link_send_caps(addr, true);
+
+    return (peer != NULL) || !enable;
+}
+
+void RYLR998::set_compression_dictionary(const char *dict, int len)
+{
+    _smutex.lock();
+    _compressor.set_dictionary((const uint8_t *)dict, len);
     _smutex.unlock();
 }
 
+int RYLR998::get_time_on_air_us(int len)
+{
+    static const int bw_hz[] = { 7800, 10400, 15600, 20800, 31250, 41700, 62500, 125000, 250000, 500000 };
+
+    if (_rf_param.sf < 0)
+        get_rf_parameter();
+
+    int sf = _rf_param.sf;
+    int bw = _rf_param.bw;
+    if (sf < 5 || sf > 12 || bw < 0 || bw > 9 || _rf_param.cr < 1 || _rf_param.pp < 0)
+        return 0;
+
+    // Semtech LoRa time on air, explicit header and CRC on
+    int64_t t_sym = ((int64_t)1 << sf) * 1000000 / bw_hz[bw];
+    int de = (t_sym > 16000) ? 1 : 0;
+    int num = 8 * len - 4 * sf + 28 + 16;
+    int den = 4 * (sf - 2 * de);
+    int n = (num > 0) ? (num + den - 1) / den : 0;
+    int64_t symbols4 = 4 * _rf_param.pp + 17 + 4 * (8 + n * (_rf_param.cr + 4));
+
+    return (int)(symbols4 * t_sym / 4);
+}
+
 int RYLR998::get_size(void)
 {
     _smutex.lock();
     _process_oob(RYLR998_RECV_TIMEOUT, true);
+    if (_spool != nullptr)
+        _spool->service();
+    if (_tx_spool != nullptr)
+        _tx_spool->service();
     _smutex.unlock();
 
-    return (_packet_buffer.peek_size());
+    _link_service();
+    _power_service();
+
+    return pull_size();
 }
 
-int RYLR998::recv(int& addr, char *buf, int size)
+int RYLR998::poll(void)
 {
-    int len = 0;
+    int count;
 
     _smutex.lock();
+#if RYLR998_PORT_POSIX
+    // Parse complete lines only. The first bytes of a line wake the caller
+    // up, and waiting here for the rest would hold up its other modules;
+    // it is parsed on the readiness that brings its end.
+    set_timeout(RYLR998_POLL_TIMEOUT);
+    while (_line_ready() && _parser.process_oob()) {
+    }
+    set_timeout();
+#else
+    _process_oob(RYLR998_POLL_TIMEOUT, true);
+#endif
+    if (_spool != nullptr)
+        _spool->service();
+    if (_tx_spool != nullptr)
+        _tx_spool->service();
+    count = _packet_buffer.size() + ((_spool != nullptr) ? _spool->size() : 0);
+    _smutex.unlock();
+
+    _link_service();
+    _power_service();
+
+    return count;
+}
+
+#if RYLR998_PORT_POSIX
+bool RYLR998::_line_ready(void)
+{
+    const uint8_t *p;
+    int n = _serial.peek(&p);
+    int from = 0;
+
+    if (n == 0)
+        return false;
+    if (n >= RYLR998_POSIX_RX_BUFFER)
+        return true;    // no room to wait for more
+
+    // The data of a +RCV line may hold the delimiter, skip it by its length
+    if (n >= 5 && memcmp(p, "+RCV=", 5) == 0)
+    {
+        int commas = 0, len = 0, i;
+
+        for (i = 5; i < n && commas < 2; i++)
+        {
+            if (p[i] == ',')
+                commas++;
+            else if (commas == 1 && p[i] >= '0' && p[i] <= '9')
+                len = len * 10 + (p[i] - '0');
+        }
+        if (commas < 2)
+            return false;
+
+        from = (len <= RYLR998_MAX_PAYLOAD) ? i + len : i;
+    }
+
+    for (int i = from; i + 1 < n; i++)
+    {
+        if (p[i] == '\r' && p[i + 1] == '\n')
+            return true;
+    }
+
+    return false;
+}
+#endif
+
+int RYLR998::recv(int& addr, char *buf, int size)
+{
+    _smutex.lock();
     _process_oob(RYLR998_RECV_TIMEOUT, true);
+    if (_spool != nullptr)
+        _spool->service();
+    if (_tx_spool != nullptr)
+        _tx_spool->service();
     _smutex.unlock();
 
-    if (_packet_buffer.size()) {
-        len = _packet_buffer.pull(addr, buf, size, _r_rssi, _r_snr);
+    _link_service();
+    _power_service();
+
+    return pull(addr, buf, size);
+}
+
+int RYLR998::pull(int& addr, char *buf, int size)
+{
+    int len = 0;
+
+    // RAM packets that arrived before the spooled ones, then the spool,
+    // then RAM packets that arrived after it
+    _smutex.lock();
+    if (_spool != nullptr && _ram_older == 0 && _spool->size() > 0) {
+        len = _spool->pull(addr, buf, size, _r_rssi, _r_snr, _r_time);
+    } else if (_packet_buffer.size()) {
+        len = _packet_buffer.pull(addr, buf, size, _r_rssi, _r_snr, _r_time);
+        if (_ram_older > 0)
+            _ram_older--;
     }
+    _smutex.unlock();
     buf[len] = '\0';
 
     return len;
 }
 
+int RYLR998::pull_size(void)
+{
+    int size;
+
+    _smutex.lock();
+    if (_spool != nullptr && _ram_older == 0 && _spool->size() > 0)
+        size = _spool->peek_size();
+    else
+        size = _packet_buffer.peek_size();
+    _smutex.unlock();
+
+    return size;
+}
+
 void RYLR998::flush()
 {
     _smutex.lock();
@@ -378,28 +827,797 @@ void RYLR998::flush()
 }
 void RYLR998::_oob_packet_hdlr(void)
 {
-    int addr, len, rssi, snr;
-    char buf[241];
+    int addr = 0, len = -1, rssi = 0, snr = 0;
+    char buf[RYLR998_MAX_PAYLOAD + 1];
+    char line[16];
+
+    // The arrival, not the end of the line, which comes later by the UART
+    // time of the payload and whatever was parsed first
+#if RYLR998_PORT_POSIX
+    uint32_t now = _parser.line_time();
+#else
+    uint32_t now = _now_ms();
+#endif
 
     _parser.scanf("=%d,%d,", &addr, &len);
+    if (len < 0 || len > RYLR998_MAX_PAYLOAD)
+    {
+        // Drop the rest of the line, or it is taken for the next response
+        _read_line(buf, sizeof(buf));
+        return;
+    }
     _parser.read(buf, len);
     buf[len] = '\0';
-    _parser.scanf(",%d,%d\n", &rssi, &snr);
+    _read_line(line, sizeof(line));
+    sscanf(line, ",%d,%d", &rssi, &snr);
+
+    if (len < RYLR998_LINK_HDR_SIZE || (uint8_t)buf[0] != RYLR998_LINK_MAGIC
+        || ((uint8_t)buf[1] & ~RYLR998_LINK_FLAGS) != 0)
+    {
+        _queue_packet(addr, buf, len, rssi, snr, now);
+        return;
+    }
+
+    uint8_t flags = buf[1];
+    char *payload = buf + RYLR998_LINK_HDR_SIZE;
+    int plen = len - RYLR998_LINK_HDR_SIZE;
+
+    if (flags & RYLR998_LINK_SEQ)
+    {
+        if (plen < RYLR998_LINK_SEQ_SIZE)
+            return;
+
+        uint16_t seq = (uint8_t)payload[0] | ((uint8_t)payload[1] << 8);
+        payload += RYLR998_LINK_SEQ_SIZE;
+        plen -= RYLR998_LINK_SEQ_SIZE;
+
+        // Drop copies before they are decompressed or queued
+        if (_dedup && _dup_cache.seen(addr, seq, now))
+        {
+            if (_log != nullptr)
+                _log->log("RYLR998: duplicate from %d seq %u\n", addr, seq);
+            return;
+        }
+    }
 
-    _packet_buffer.push(addr, buf, len, rssi, snr);
+    if (flags & RYLR998_LINK_CAPS)
+    {
+        // Capabilities are answered later, outside the OOB handler
+        _Link_Peer *peer = _link_peer(addr, true);
+        if (peer != NULL && plen >= 3)
+        {
+            peer->caps_known = true;
+            peer->caps = payload[0];
+            peer->dict_id = (uint8_t)payload[1] | ((uint8_t)payload[2] << 8);
+            if (peer->caps & RYLR998_CAP_REPLY)
+                peer->caps_pending = true;
+        }
+        return;
+    }
+
+    if (flags & RYLR998_LINK_COMPRESSED)
+    {
+        char out[RYLR998_MAX_PAYLOAD + 1];
+        int olen = _compressor.decompress((const uint8_t *)payload, plen,
+                                          (uint8_t *)out, RYLR998_MAX_PAYLOAD,
+                                          (flags & RYLR998_LINK_DICT) != 0);
+        if (olen < 0)
+        {
+            if (_log != nullptr)
+                _log->log("RYLR998: bad compressed frame from %d\n", addr);
+            return;
+        }
+        _queue_packet(addr, out, olen, rssi, snr, now);
+        return;
+    }
+
+    _queue_packet(addr, payload, plen, rssi, snr, now);
+}
+
+void RYLR998::set_spool(RYLR998_Spool *spool, int ram_frames)
+{
+    _smutex.lock();
+    _spool = spool;
+    _spool_ram = ram_frames;
+    // Packets recovered by the spool arrived before those now in RAM
+    _ram_older = (spool != nullptr && spool->size() > 0) ? 0 : _packet_buffer.size();
+    _smutex.unlock();
+}
+
+void RYLR998::set_tx_spool(RYLR998_Spool *spool)
+{
+    _smutex.lock();
+    _tx_spool = spool;
+    _smutex.unlock();
+}
+
+void RYLR998::_queue_packet(int addr, char *data, int len, int rssi, int snr, uint32_t time)
+{
+    if (_spool != nullptr)
+    {
+        // With the spool empty, all RAM packets come before it
+        if (_spool->size() == 0)
+            _ram_older = _packet_buffer.size();
+
+        // Keep arrival order: once packets are spooled, the rest follow
+        // them, and once one is kept in RAM after them, the rest follow it
+        bool spool = (_spool->size() > 0) ? _packet_buffer.size() == _ram_older
+                     : _packet_buffer.size() >= _spool_ram;
+        if (spool)
+        {
+            if (_spool->push(addr, data, len, rssi, snr, time))
+                return;
+
+            if (_log != nullptr)
+                _log->log("RYLR998: spool write failed, packet from %d kept in RAM\n", addr);
+        }
+
+        if (_spool->size() == 0)
+            _ram_older++;
+    }
+
+    _packet_buffer.push(addr, data, len, rssi, snr, time);
 }
 
 void RYLR998::_oob_error_hdlr(void)
 {
-    _parser.scanf("=%d\n", &_last_error);
+    int code = 0;
+    char line[16];
+
+    _read_line(line, sizeof(line));
+    sscanf(line, "=%d", &code);
+
+    // A frame lost on the air (12 CRC, 19 RX header) is reported whenever
+    // it happens, it is not the reply to the pending command
+    if (code == 12 || code == 19)
+    {
+        _health.rx_errors++;
+        if (_log != nullptr)
+            _log->log("RYLR998: RX error %d\n", code);
+        return;
+    }
+
+    _last_error = code;
+    _health.errors++;
+
+    // End the pending recv now instead of waiting for its timeout. Codes
+    // 1 and 2 mean the module lost the command framing, the rest are
+    // rejected commands from a module that is otherwise alive.
+    _err_pending = true;
+    _err_link = (_last_error == 1 || _last_error == 2);
+    _parser.abort();
+
+    if (_log != nullptr)
+        _log->log("RYLR998: +ERR=%d\n", _last_error);
+}
+
+int RYLR998::_read_line(char *line, int size)
+{
+    // scanf() returns at the first match, "=1" of "=12", so take the whole
+    // line before converting it
+    int n = 0;
+    int c;
+
+    while ((c = _parser.getc()) >= 0 && c != '\n')
+    {
+        if (n + 1 < size)
+            line[n++] = c;
+    }
+    line[n] = '\0';
+
+    return n;
+}
+
+bool RYLR998::_link_caps_due(int addr)
+{
+    _Link_Peer *peer = _link_peer(addr, false);
+    uint32_t now = _now_ms();
+
+    if (peer == NULL || !peer->compress || peer->caps_known
+        || now - peer->caps_asked < peer->caps_backoff)
+        return false;
+
+    peer->caps_asked = now;
+    peer->caps_backoff *= 2;
+    if (peer->caps_backoff > RYLR998_LINK_CAPS_RETRY_MAX_MS)
+        peer->caps_backoff = RYLR998_LINK_CAPS_RETRY_MAX_MS;
+
+    return true;
+}
+
+RYLR998::_Link_Peer *RYLR998::_link_peer(int addr, bool create)
+{
+    _Link_Peer *free = NULL;
+    uint32_t now = _now_ms();
+
+    for (int i = 0; i < RYLR998_LINK_PEERS; i++)
+    {
+        _Link_Peer *p = &_peers[i];
+        if (p->addr == addr)
+        {
+            p->used = now;
+            return p;
+        }
+
+        // A free entry, else the least recently used one that was only
+        // learned from received frames
+        if (p->compress)
+            continue;
+        if (free == NULL || (free->addr >= 0 && (p->addr < 0 || now - p->used > now - free->used)))
+            free = p;
+    }
+
+    if (!create || free == NULL)
+        return NULL;
+
+    free->addr = addr;
+    free->used = now;
+    free->compress = false;
+    free->caps_known = false;
+    free->caps_pending = false;
+    free->caps_asked = now;
+    free->caps_backoff = RYLR998_LINK_CAPS_RETRY_MS;
+    free->caps = 0;
+    free->dict_id = 0;
+
+    return free;
+}
+
+int RYLR998::_link_encode(int addr, const char *data, int len, char *frame)
+{
+    _Link_Peer *peer = _link_peer(addr, false);
+    int hdr = RYLR998_LINK_HDR_SIZE;
+
+    frame[0] = RYLR998_LINK_MAGIC;
+    frame[1] = 0;
+
+    if (_dedup)
+    {
+        frame[1] |= RYLR998_LINK_SEQ;
+        frame[2] = _tx_seq & 0xFF;
+        frame[3] = _tx_seq >> 8;
+        _tx_seq++;
+        hdr += RYLR998_LINK_SEQ_SIZE;
+    }
+
+    if (peer != NULL && peer->compress && peer->caps_known && (peer->caps & RYLR998_CAP_LZ))
+    {
+        bool dict = peer->dict_id != 0 && peer->dict_id == _compressor.dict_id();
+
+        // Only worth it if the header is paid back
+        int limit = (frame[1] != 0) ? len - 1 : len - hdr - 1;
+        if (limit > RYLR998_MAX_PAYLOAD - hdr)
+            limit = RYLR998_MAX_PAYLOAD - hdr;
+
+        int n = _compressor.compress((const uint8_t *)data, len,
+                                     (uint8_t *)frame + hdr, limit, dict);
+        if (n > 0)
+        {
+            frame[1] |= RYLR998_LINK_COMPRESSED | ((dict) ? RYLR998_LINK_DICT : 0);
+            return n + hdr;
+        }
+    }
+
+    bool escape = len > 0 && (uint8_t)data[0] == RYLR998_LINK_MAGIC;
+
+    if (frame[1] != 0 || escape)
+    {
+        // Too long for a header, only possible to send untagged
+        if (len + hdr > RYLR998_MAX_PAYLOAD)
+            return (escape) ? -1 : 0;
+
+        std::memcpy(frame + hdr, data, len);
+        return len + hdr;
+    }
+
+    return 0;
+}
+
+bool RYLR998::_link_send_caps(int addr, bool reply)
+{
+    char frame[RYLR998_LINK_HDR_SIZE + 3];
+    uint16_t dict_id = _compressor.dict_id();
+
+    frame[0] = RYLR998_LINK_MAGIC;
+    frame[1] = RYLR998_LINK_CAPS;
+    frame[2] = RYLR998_CAP_LZ | ((reply) ? RYLR998_CAP_REPLY : 0);
+    frame[3] = dict_id & 0xFF;
+    frame[4] = dict_id >> 8;
+
+    return _send_frame(addr, frame, sizeof(frame));
+}
+
+void RYLR998::_link_service()
+{
+    for (int i = 0; i < RYLR998_LINK_PEERS; i++)
+    {
+        _smutex.lock();
+        bool pending = _peers[i].addr >= 0 && _peers[i].caps_pending;
+        int addr = _peers[i].addr;
+        _peers[i].caps_pending = false;
+        _smutex.unlock();
+
+        if (pending)
+            _link_send_caps(addr, false);
+    }
+}
+
+bool RYLR998::_send_frame(int addr, const char *data, int len)
+{
+    // The module takes exactly len bytes, so binary data is sent as is
+    _smutex.lock();
+    _err_pending = false;
+    bool done = _parser.printf("AT+SEND=%d,%d,", addr, len) > 0
+                && _parser.write(data, len) == len
+                && _parser.send("")
+                && _parser.recv("+OK");
+    _smutex.unlock();
+
+    return done;
+}
+
+bool RYLR998::recover(void)
+{
+    _fail_count = 0;
+    if (!_down)
+        _down_since = _now_ms();
+
+    return _recover();
+}
+
+struct RYLR998::health_stats RYLR998::get_health(void)
+{
+    _smutex.lock();
+    struct health_stats s = _health;
+    s.down = _down;
+    s.tx_queued = _tx_count;
+    s.tx_spooled = (_tx_spool != nullptr) ? _tx_spool->size() : 0;
+    _smutex.unlock();
+
+    return s;
+}
+
+bool RYLR998::_ready(void)
+{
+    // Every command starts here. A +ERR taken in by an idle process_oob()
+    // is not the reply to this one and must not decide how it failed.
+    _smutex.lock();
+    _err_pending = false;
+    _smutex.unlock();
+
+    // Commands wake a sleeping module and open an RX window
+    if (_asleep && !_pwr_busy && !_recovering)
+        return _power_wake(_now_ms());
+
+    if (!_down || _recovering)
+        return true;
+
+    // Fail fast while the module is down, retry now and then
+    if (_now_ms() - _last_attempt < RYLR998_HEALTH_RETRY_MS)
+        return false;
+
+    return _recover();
+}
+
+bool RYLR998::_check(bool done)
+{
+    if (_recovering)
+        return done;
+
+    if (done)
+    {
+        _fail_count = 0;
+        _err_pending = false;
+        if (_tx_count > 0 || _pwr_count > 0 || (_tx_spool != nullptr && _tx_spool->size() > 0))
+            _replay();
+        return true;
+    }
+
+    if (_err_pending)
+    {
+        _err_pending = false;
+        if (!_err_link)
+        {
+            _fail_count = 0;
+            return false;
+        }
+    }
+
+    _health.failures++;
+    if (_fail_count++ == 0)
+        _down_since = _now_ms();
+
+    if (_fail_count >= RYLR998_HEALTH_FAIL_THRESHOLD)
+        _recover();
+
+    return false;
+}
+
+bool RYLR998::_probe(void)
+{
+    set_timeout(RYLR998_HEALTH_PROBE_TIMEOUT);
+    bool done = _parser.send("AT")
+                && _parser.recv("+OK");
+    set_timeout();
+
+    return done;
+}
+
+bool RYLR998::_recover(void)
+{
+    if (_recovering)
+        return false;
+
+    _recovering = true;
+    bool alive = false;
+
+    // Escalate from the cheapest step: drop stale input, soft reset,
+    // then pull the reset pin. Each step is confirmed by a short probe.
+    _smutex.lock();
+    for (int step = 0; step < 3 && !alive; step++)
+    {
+        if (step == 0)
+        {
+            _health.recover_attempts++;
+        }
+        else if (step == 1)
+        {
+            _health.resets++;
+            _parser.send("AT+RESET") && _parser.recv("+READY");
+        }
+        else
+        {
+            if (!_reset.is_connected())
+                break;
+            _health.hw_resets++;
+            hw_reset();
+            rylr998_port::sleep_for(RYLR998_HEALTH_BOOT_TIME);
+        }
+
+        _parser.flush();
+        _err_pending = false;
+        alive = _probe();
+    }
+
+    if (alive)
+        alive = _apply_config();
+    _smutex.unlock();
+
+    uint32_t now = _now_ms();
+    _last_attempt = now;
+    _fail_count = 0;
+
+    if (alive)
+    {
+        uint32_t ttr = now - _down_since;
+
+        _down = false;
+        _asleep = false;
+        _pwr_phase_start = now;
+        _health.recoveries++;
+        _health.last_recover_ms = ttr;
+        if (ttr > _health.max_recover_ms)
+            _health.max_recover_ms = ttr;
+    }
+    else
+    {
+        _down = true;
+    }
+    _recovering = false;
+
+    if (_log != nullptr)
+        _log->log("RYLR998: recovery %s\n", (alive) ? "done" : "failed");
+
+    if (alive && (_tx_count > 0 || _pwr_count > 0 || (_tx_spool != nullptr && _tx_spool->size() > 0)))
+        _replay();
+
+    return alive;
+}
+
+bool RYLR998::_apply_config(void)
+{
+    bool done = true;
+
+    // A reset module may have lost what was set before, put it back
+    if (done && (_config & RYLR998_CFG_ADDR))
+        done = _parser.send("AT+ADDRESS=%d", _addr)
+               && _parser.recv("+OK");
+    if (done && (_config & RYLR998_CFG_NETID))
+        done = _parser.send("AT+NETWORKID=%d", _network_id)
+               && _parser.recv("+OK");
+    if (done && (_config & RYLR998_CFG_BAND))
+        done = _parser.send("AT+BAND=%d", _band)
+               && _parser.recv("+OK");
+    if (done && (_config & RYLR998_CFG_RF))
+        done = _parser.send("AT+PARAMETER=%d,%d,%d,%d", _rf_param.sf, _rf_param.bw, _rf_param.cr, _rf_param.pp)
+               && _parser.recv("+OK");
+    if (done && (_config & RYLR998_CFG_POWER))
+        done = _parser.send("AT+CRFOP=%d", _rf_output_power)
+               && _parser.recv("+OK");
+    if (done && (_config & RYLR998_CFG_RXBOOST))
+        done = _parser.send("AT+RXBOOST=%d", (_rx_boost) ? 1 : 0)
+               && _parser.recv("+OK");
+    if (done && (_config & RYLR998_CFG_MODE))
+        done = _parser.send("AT+MODE=%d", _mode)
+               && _parser.recv("+OK");
+
+    return done;
+}
+
+void RYLR998::_tx_enqueue(int addr, const char *data, int len)
+{
+    _smutex.lock();
+    // The spool keeps the frames over a reset, and more of them
+    if (_tx_spool != nullptr)
+    {
+        if (!_tx_spool->push(addr, data, len, 0, 0, _now_ms()))
+        {
+            _health.tx_dropped++;
+            if (_log != nullptr)
+                _log->log("RYLR998: TX spool write failed, frame to %d dropped\n", addr);
+        }
+        _smutex.unlock();
+        return;
+    }
+
+    if (_tx_count == RYLR998_HEALTH_TX_QUEUE)
+    {
+        // Keep the newest frames
+        _tx_head = (_tx_head + 1) % RYLR998_HEALTH_TX_QUEUE;
+        _tx_count--;
+        _health.tx_dropped++;
+    }
+
+    _Tx_Frame &f = _tx_queue[(_tx_head + _tx_count) % RYLR998_HEALTH_TX_QUEUE];
+    f.addr = addr;
+    f.len = len;
+    std::memcpy(f.data, data, len);
+    _tx_count++;
+    _smutex.unlock();
+}
+
+void RYLR998::_replay(void)
+{
+    // Frames whose send failed come first, RAM then spool, then those
+    // deferred while asleep
+    if (_drain(_tx_queue, RYLR998_HEALTH_TX_QUEUE, _tx_head, _tx_count, &_health.tx_replayed)
+        && _drain_spool())
+        _drain(_pwr_queue, RYLR998_POWER_TX_QUEUE, _pwr_head, _pwr_count, NULL);
+}
+
+bool RYLR998::_drain_spool(void)
+{
+    char data[RYLR998_MAX_PAYLOAD];
+    int addr, rssi, snr;
+    uint32_t time;
+
+    while (true)
+    {
+        _smutex.lock();
+        bool done = false;
+        bool rejected = false;
+        int len = 0;
+        if (_tx_spool != nullptr && _tx_spool->size() > 0)
+            len = _tx_spool->peek(addr, data, sizeof(data), rssi, snr, time);
+
+        // The frame stays spooled until the module took or refused it. A
+        // spool that lost track of its frames is empty after peek().
+        if (_tx_spool != nullptr && _tx_spool->size() > 0)
+        {
+            done = _send_frame(addr, data, len);
+            rejected = !done && _err_pending && !_err_link;
+            if (done || rejected)
+            {
+                _tx_spool->pull(addr, data, sizeof(data), rssi, snr, time);
+                if (rejected)
+                    _health.tx_rejected++;
+                else
+                    _health.tx_replayed++;
+            }
+            _err_pending = false;
+        }
+        bool empty = _tx_spool == nullptr || _tx_spool->size() == 0;
+        _smutex.unlock();
+
+        if (empty)
+            return true;
+        if (!done && !rejected)
+            return false;
+    }
+}
+
+bool RYLR998::_drain(_Tx_Frame *queue, int size, int &head, int &count, uint32_t *sent)
+{
+    while (true)
+    {
+        _smutex.lock();
+        bool done = false;
+        bool rejected = false;
+        if (count > 0)
+        {
+            _Tx_Frame &f = queue[head];
+            done = _send_frame(f.addr, f.data, f.len);
+            rejected = !done && _err_pending && !_err_link;
+            if (done || rejected)
+            {
+                head = (head + 1) % size;
+                count--;
+                if (rejected)
+                    _health.tx_rejected++;
+                else if (sent != NULL)
+                    (*sent)++;
+            }
+            _err_pending = false;
+        }
+        bool empty = count == 0;
+        _smutex.unlock();
+
+        if (empty)
+            return true;
+
+        // A rejected frame is dropped so it does not hold the queue up.
+        // Stop at any other failure, the next command notices it.
+        if (!done && !rejected)
+            return false;
+    }
+}
+
+bool RYLR998::set_power_save(uint32_t rx_ms, uint32_t sleep_ms)
+{
+    _pwr_rx_ms = rx_ms;
+    _pwr_sleep_ms = (rx_ms > 0) ? sleep_ms : 0;
+    _pwr_phase_start = _now_ms();
+
+    if (_asleep && (rx_ms == 0 || sleep_ms == 0))
+        return _power_wake(_pwr_phase_start);
+
+    return true;
+}
+
+struct RYLR998::power_stats RYLR998::get_power_stats(void)
+{
+    struct power_stats s = _pwr_stats;
+    uint32_t phase = _now_ms() - _pwr_phase_start;
+
+    // Count the phase in progress
+    if (_pwr_sleep_ms > 0)
+    {
+        if (_asleep)
+            s.sleep_ms += phase;
+        else
+            s.rx_ms += phase;
+    }
+    s.asleep = _asleep;
+    s.tx_queued = _pwr_count;
+
+    return s;
+}
+
+void RYLR998::_power_service(void)
+{
+    if (_pwr_sleep_ms == 0 || _pwr_busy || _recovering || _down)
+        return;
+
+    uint32_t now = _now_ms();
+    uint32_t elapsed = now - _pwr_phase_start;
+
+    if (!_asleep)
+    {
+        // Stay up until the window ends and the queue is out
+        if (elapsed >= _pwr_rx_ms && _tx_count == 0 && _pwr_count == 0
+            && (_tx_spool == nullptr || _tx_spool->size() == 0))
+            _power_sleep();
+        return;
+    }
+
+    bool full = _pwr_count >= RYLR998_POWER_TX_QUEUE;
+    if (elapsed < _pwr_sleep_ms && !full)
+        return;
+
+    // A window is missed when the caller came back too late to open it on
+    // time. Latency is counted from when the window was due.
+    uint32_t due = _pwr_phase_start + _pwr_sleep_ms;
+    if (elapsed < _pwr_sleep_ms)
+        due = now;
+    else if (now - due > RYLR998_POWER_LATE_MS)
+        _pwr_stats.missed_windows++;
+
+    _power_wake(due);
+}
+
+int RYLR998::get_power_deadline(void)
+{
+    if (_pwr_sleep_ms == 0 || _down)
+        return -1;
+
+    uint32_t phase = (_asleep) ? _pwr_sleep_ms : _pwr_rx_ms;
+    uint32_t elapsed = _now_ms() - _pwr_phase_start;
+
+    // The window stays open until the queues are out, which takes a
+    // command rather than time
+    if (!_asleep && (_tx_count > 0 || _pwr_count > 0
+                     || (_tx_spool != nullptr && _tx_spool->size() > 0)))
+        return -1;
+
+    return (elapsed >= phase) ? 0 : (int)(phase - elapsed);
+}
+
+bool RYLR998::_power_sleep(void)
+{
+    _pwr_busy = true;
+    _smutex.lock();
+    // Take in what already arrived before the radio goes off
+    _process_oob(RYLR998_POLL_TIMEOUT, true);
+    _err_pending = false;
+    bool done = _parser.send("AT+MODE=1")
+                && _parser.recv("+OK");
+    _smutex.unlock();
+    _pwr_busy = false;
+
+    if (!_check(done))
+        return false;
+
+    uint32_t now = _now_ms();
+    _pwr_stats.rx_ms += now - _pwr_phase_start;
+    _pwr_phase_start = now;
+    _asleep = true;
+
+    return true;
+}
+
+bool RYLR998::_power_wake(uint32_t due)
+{
+    bool done = false;
+
+    _pwr_busy = true;
+    _smutex.lock();
+    _err_pending = false;
+    // The first command after sleep may only wake the UART up
+    set_timeout(RYLR998_POWER_WAKE_TIMEOUT);
+    for (int i = 0; i < RYLR998_POWER_WAKE_TRIES && !done; i++)
+        done = _parser.send("AT")
+               && _parser.recv("+OK");
+    set_timeout();
+    done = done
+           && _parser.send("AT+MODE=0")
+           && _parser.recv("+OK");
+    _smutex.unlock();
+    _pwr_busy = false;
+
+    uint32_t now = _now_ms();
+    _pwr_stats.sleep_ms += now - _pwr_phase_start;
+    _pwr_phase_start = now;
+    _asleep = false;
+
+    if (done)
+    {
+        uint32_t latency = now - due;
+
+        _pwr_stats.windows++;
+        _pwr_stats.wake_latency_last_ms = latency;
+        if (latency > _pwr_stats.wake_latency_max_ms)
+            _pwr_stats.wake_latency_max_ms = latency;
+    }
+    else
+    {
+        _pwr_stats.missed_windows++;
+    }
+
+    // Sends the frames queued during sleep, or recovers the module
+    return _check(done);
+}
+
+uint32_t RYLR998::_now_ms(void)
+{
+    return rylr998_port::now_ms();
 }
 
-void RYLR998::set_timeout(std::chrono::duration<uint32_t, milli> timeout)
+void RYLR998::set_timeout(std::chrono::duration<uint32_t, std::milli> timeout)
 {
     _parser.set_timeout(timeout.count());
 }
 
-void RYLR998::_process_oob(std::chrono::duration<uint32_t, milli> timeout, bool all)
+void RYLR998::_process_oob(std::chrono::duration<uint32_t, std::milli> timeout, bool all)
 {
     set_timeout(timeout);
     // Poll for inbound packets
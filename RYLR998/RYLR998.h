@@ -21,17 +21,15 @@
 
 #include <stdint.h>
 #include <inttypes.h>
+#include <cstring>
+#include <chrono>
 
-#include "drivers/BufferedSerial.h"
-#include "drivers/DigitalOut.h"
-#include "PinNames.h"
-#include "platform/ATCmdParser.h"
-#include "platform/mbed_chrono.h"
-#include "platform/mbed_error.h"
-#include "platform/mbed_mem_trace.h"
-#include "platform/Callback.h"
-#include "rtos/Mutex.h"
-#include "rtos/ThisThread.h"
+#include "RYLR998_Port.h"
+#include "RYLR998_Compress.h"
+#include "RYLR998_DupCache.h"
+
+class RYLR998_Log;
+class RYLR998_Spool;
 
 #ifdef MBED_CONF_RYLR998_SERIAL_BAUDRATE
 #define RYLR998_DEFAULT_BAUD_RATE   MBED_CONF_RYLR998_SERIAL_BAUDRATE 
@@ -49,6 +47,94 @@
 #define RYLR998_RECV_TIMEOUT    std::chrono::milliseconds(800)
 #endif
 
+#ifndef RYLR998_POLL_TIMEOUT
+#define RYLR998_POLL_TIMEOUT    std::chrono::milliseconds(20)   // rest of a frame already arriving
+#endif
+
+#ifndef RYLR998_MAX_PAYLOAD
+#define RYLR998_MAX_PAYLOAD     240
+#endif
+
+#ifndef RYLR998_LINK_PEERS
+#define RYLR998_LINK_PEERS      8
+#endif
+
+#ifndef RYLR998_LINK_CAPS_RETRY_MS
+#define RYLR998_LINK_CAPS_RETRY_MS  2000    // first wait for a capability answer, doubles
+#endif
+
+#ifndef RYLR998_LINK_CAPS_RETRY_MAX_MS
+#define RYLR998_LINK_CAPS_RETRY_MAX_MS  120000
+#endif
+
+#ifndef RYLR998_HEALTH_FAIL_THRESHOLD
+#define RYLR998_HEALTH_FAIL_THRESHOLD   1   // failed commands before recovery starts
+#endif
+
+#ifndef RYLR998_HEALTH_PROBE_TIMEOUT
+#define RYLR998_HEALTH_PROBE_TIMEOUT    std::chrono::milliseconds(100)
+#endif
+
+#ifndef RYLR998_HEALTH_BOOT_TIME
+#define RYLR998_HEALTH_BOOT_TIME        std::chrono::milliseconds(200)
+#endif
+
+#ifndef RYLR998_HEALTH_RETRY_MS
+#define RYLR998_HEALTH_RETRY_MS         5000    // between recoveries while down
+#endif
+
+#ifndef RYLR998_HEALTH_TX_QUEUE
+#define RYLR998_HEALTH_TX_QUEUE         4       // failed frames kept for replay
+#endif
+
+#ifndef RYLR998_POWER_TX_QUEUE
+#define RYLR998_POWER_TX_QUEUE          8       // sends deferred while asleep
+#endif
+
+#ifndef RYLR998_POWER_LATE_MS
+#define RYLR998_POWER_LATE_MS           50      // later than this, a window counts as missed
+#endif
+
+#ifndef RYLR998_POWER_WAKE_TRIES
+#define RYLR998_POWER_WAKE_TRIES        5
+#endif
+
+#ifndef RYLR998_POWER_WAKE_TIMEOUT
+#define RYLR998_POWER_WAKE_TIMEOUT      std::chrono::milliseconds(20)   // per wake probe
+#endif
+
+#ifndef RYLR998_SPOOL_RAM_FRAMES
+#define RYLR998_SPOOL_RAM_FRAMES        16      // packets kept in RAM before spooling
+#endif
+
+/* Cached settings restored after a recovery */
+#define RYLR998_CFG_RF          0x01
+#define RYLR998_CFG_BAND        0x02
+#define RYLR998_CFG_ADDR        0x04
+#define RYLR998_CFG_NETID       0x08
+#define RYLR998_CFG_POWER       0x10
+#define RYLR998_CFG_RXBOOST     0x20
+#define RYLR998_CFG_MODE        0x40
+
+/* Link header. Frames starting with the magic byte carry a flags byte
+ * before the payload. Application data that happens to start with the
+ * magic byte is sent behind an empty header. Every received frame is
+ * parsed, so any node decompresses and answers capability requests; a
+ * frame whose flags hold undefined bits is not ours and passes untouched.
+ */
+#define RYLR998_LINK_MAGIC      0xA7
+#define RYLR998_LINK_HDR_SIZE   2
+#define RYLR998_LINK_SEQ_SIZE   2
+#define RYLR998_LINK_COMPRESSED 0x01    // payload is LZ compressed
+#define RYLR998_LINK_DICT       0x02    // compressed with the preset dictionary
+#define RYLR998_LINK_SEQ        0x04    // a 16 bit sequence ID follows the flags
+#define RYLR998_LINK_CAPS       0x80    // payload is a capability announcement
+#define RYLR998_LINK_FLAGS      (RYLR998_LINK_COMPRESSED | RYLR998_LINK_DICT | RYLR998_LINK_SEQ | RYLR998_LINK_CAPS)
+
+/* Capability bits */
+#define RYLR998_CAP_LZ          0x01    // can decompress RYLR998_LINK_COMPRESSED
+#define RYLR998_CAP_REPLY       0x80    // sender asks for our capabilities
+
 /** _Packet_Node class.
     This is a node class for receved packets
  */
@@ -60,8 +146,9 @@ public:
     int size;
     int rssi;
     int snr;
+    uint32_t time;
 
-    _Packet_Node(int addr, char *data, int size, int rssi, int snr) : addr(addr), size(size), rssi(rssi), snr(snr), next(nullptr) {
+    _Packet_Node(int addr, char *data, int size, int rssi, int snr, uint32_t time) : addr(addr), size(size), rssi(rssi), snr(snr), time(time), next(nullptr) {
         this->data = new char[size];
         std::memcpy(this->data, data, size * sizeof(char));
     }
@@ -101,8 +188,8 @@ public:
         return (head == nullptr) ? 0 : head->size;
     }
 
-    void push(int addr, char *data, int size, int rssi, int snr) {        
-        _Packet_Node *node = new _Packet_Node(addr, data, size, rssi, snr);
+    void push(int addr, char *data, int size, int rssi, int snr, uint32_t time) {
+        _Packet_Node *node = new _Packet_Node(addr, data, size, rssi, snr, time);
         if (head == nullptr) {
             head = node;
             tail = node;
@@ -113,7 +200,7 @@ public:
         count++;
     }
 
-    int pull(int &addr, char *data, int size, int &rssi, int &snr) {
+    int pull(int &addr, char *data, int size, int &rssi, int &snr, uint32_t &time) {
 
         if (head == nullptr) return 0;
 
@@ -125,6 +212,7 @@ public:
         addr = head->addr;
         rssi = head->rssi;
         snr  = head->snr;
+        time = head->time;
 
         _Packet_Node *node = head;
         head = head->next;
@@ -144,7 +232,16 @@ public:
  */
 class RYLR998 {
 public:
+#if RYLR998_PORT_MBED
     RYLR998(PinName tx, PinName rx, PinName reset = NC, bool debug = false);
+#else
+    /**
+    * @param device the tty of the module, e.g. /dev/ttyUSB0
+    * @param reset the adapter line wired to NRST, RYLR998_RESET_NONE, _RTS or _DTR
+    * @param debug true to trace the AT traffic on stderr
+    */
+    RYLR998(const char *device, int reset = RYLR998_RESET_NONE, bool debug = false);
+#endif
     ~RYLR998();
 
     /**
@@ -169,6 +266,43 @@ public:
         rf_param(int sf, int bw, int cr, int pp) : sf(sf), bw(bw), cr(cr), pp(pp) {}
     };
 
+    struct dedup_stats {
+        uint32_t hits;      // duplicate frames dropped
+        uint32_t misses;    // new frames
+        uint32_t evictions; // entries replaced before their window ended
+    };
+
+    struct health_stats {
+        uint32_t failures;          // commands that timed out or lost framing
+        uint32_t errors;            // +ERR replies
+        uint32_t rx_errors;         // frames lost on the air, +ERR=12 and 19
+        uint32_t recoveries;        // successful recoveries
+        uint32_t recover_attempts;  // recoveries started, each first flushes the input
+        uint32_t resets;
+        uint32_t hw_resets;
+        uint32_t tx_replayed;       // queued frames sent after a recovery
+        uint32_t tx_dropped;        // queued frames lost on a full queue or spool error
+        uint32_t tx_rejected;       // frames the module refused, not queued
+        uint32_t last_recover_ms;   // first failure to recovered
+        uint32_t max_recover_ms;
+        int tx_queued;
+        int tx_spooled;             // frames waiting in the TX spool
+        bool down;                  // recovery failed, commands fail fast
+    };
+
+    struct power_stats {
+        uint32_t windows;               // RX windows opened
+        uint32_t missed_windows;        // opened late or not at all
+        uint32_t wake_latency_last_ms;  // window due to module in RX
+        uint32_t wake_latency_max_ms;
+        uint32_t rx_ms;                 // time in RX while power save is on
+        uint32_t sleep_ms;              // time asleep
+        uint32_t tx_deferred;           // sends queued for the next window
+        uint32_t early_wakes;           // windows opened early by a full queue
+        int tx_queued;                  // deferred sends waiting
+        bool asleep;
+    };
+
 
     /**
     * Hardware reset RYLR998 module
@@ -211,8 +345,9 @@ public:
     * @param bw the Bandwidth
     * @param cr the Coding Rate
     * @param pp the Programmed Preamble
+    * @return true if the module accepted it
     */
-    void set_rf_parameter(int sf, int bw, int cr, int pp);
+    bool set_rf_parameter(int sf, int bw, int cr, int pp);
 
     /**
     * Return RF parameters
@@ -226,15 +361,17 @@ public:
     * Set the wireless work mode
     *
     * @param mode work mode. 0 to transmit and receive mode, 1 to sleep mode
+    * @return true if the module accepted it
     */
-    void set_mode(int mode);
+    bool set_mode(int mode);
 
     /**
     * Set the UART baud rate
     *
     * @param rate the UART baud rate. Default is 115200.
+    * @return true if the module accepted it
     */
-    void set_baudrate(int rate);
+    bool set_baudrate(int rate);
 
     /**
     * Return the UART baud rate
@@ -247,8 +384,9 @@ public:
     * Set RF frequency
     *
     * @param freq the RF frequency, unit is Hz. Default is 915000000 for 915MHz.
+    * @return true if the module accepted it
     */
-    void set_band(int freq);
+    bool set_band(int freq);
 
     /**
     * Return RF frequency
@@ -261,8 +399,9 @@ public:
     * Set the address of module
     *
     * @param addr the address of module. Default is 0, up to 65535.
+    * @return true if the module accepted it
     */
-    void set_address(int addr);
+    bool set_address(int addr);
 
     /**
     * Return the address of module
@@ -275,8 +414,9 @@ public:
     * Set the network ID
     *
     * @param id the network ID. Default is 1, up to 255.
+    * @return true if the module accepted it
     */
-    void set_network_id(int id);
+    bool set_network_id(int id);
 
     /**
     * Return the network ID
@@ -289,8 +429,9 @@ public:
     * Set the RF output power
     *
     * @param power the power in dBm. Default is 22 (22dBm), down to 00 (0dBm).
+    * @return true if the module accepted it
     */
-    void set_rf_output_power(int power);
+    bool set_rf_output_power(int power);
 
     /**
     * Return the RF output power
@@ -303,8 +444,9 @@ public:
     * On/Off receive boost mode
     *
     * @param mode 0 to off boost, 1 to enable boost.
+    * @return true if the module accepted it
     */
-    void set_rx_boost(bool mode);
+    bool set_rx_boost(bool mode);
 
     /**
     * Return the receive boost mode
@@ -318,8 +460,21 @@ public:
     *
     * @param addr address that from 0 to 65535. 0 will send to all address.
     * @param data point to a data string
+    * @return true if the module accepted it
+    */
+    bool send(int addr, char *data);
+
+    /**
+    * Send binary data to appointed address
+    *
+    * @param addr address that from 0 to 65535. 0 will send to all address.
+    * @param data point to the data
+    * @param len the data length, up to RYLR998_MAX_PAYLOAD
+    * @return true if the module accepted it. A frame lost to a timeout or
+    *         to lost command framing is queued and sent again after a
+    *         recovery; a frame the module rejected with +ERR is dropped.
     */
-    void send(int addr, char *data);
+    bool send(int addr, const char *data, int len);
 
     /**
     * Get the received data
@@ -338,6 +493,48 @@ public:
     */
     int get_size(void);
 
+    /**
+    * Process received packets without waiting
+    *
+    * For event driven callers: call it when the serial port is readable,
+    * then pull the packets with recv(). On Linux a line still arriving
+    * is left buffered until a later call, so it does not block.
+    *
+    * @return the number of packets waiting
+    */
+    int poll(void);
+
+    /**
+    * Get a packet already received, without reading the serial port
+    *
+    * Unlike recv(), it never waits for the module, so an event handler can
+    * drain what poll() took in. The packet metadata is updated as by recv().
+    *
+    * @param addr the transmitter address
+    * @param data buffer that store the receive data, one byte more than size
+    * @param size the data buffer size
+    * @return the real data size stored in buffer, 0 if none is waiting
+    */
+    int pull(int& addr, char *data, int size);
+
+    /**
+    * Return the size of the packet pull() returns next
+    *
+    * @return the data size, 0 if none is waiting
+    */
+    int pull_size(void);
+
+#if RYLR998_PORT_POSIX
+    /**
+    * Return the serial port descriptor to watch for input
+    *
+    * @return the file descriptor, -1 if the device did not open
+    */
+    int get_fd(void) {
+        return _serial.fd();
+    }
+#endif
+
     /**
     * Return the RSSI value of the latest recevied packet
     * 
@@ -356,12 +553,201 @@ public:
         return _r_snr;
     }
 
+    /**
+    * Return the time the latest recevied packet arrived
+    * 
+    * @return the Kernel clock time in milliseconds
+    */
+    uint32_t get_timestamp(void) {
+        return _r_time;
+    }
+
+    /**
+    * Return the time on air of a frame with the current RF parameters
+    *
+    * @param len the payload length
+    * @return the time on air in microseconds, 0 if the RF parameters are unknown
+    */
+    int get_time_on_air_us(int len);
+
+    /**
+    * Return a pseudo random number, e.g. for a backoff
+    *
+    * The generator is seeded on first use from the module UID, the address
+    * and the microsecond clock, so the nodes of a network draw different
+    * sequences and a node draws a new one after a restart.
+    *
+    * @return a 32 bit pseudo random number
+    */
+    uint32_t get_random(void);
+
+    /**
+    * Enable or disable duplicate frame suppression
+    *
+    * Sent frames are tagged with a sequence ID. Received frames whose
+    * source address and sequence ID were seen within the window are
+    * dropped before they are queued. Use it on every node of the network.
+    *
+    * The source is the +RCV address, the node that put the copy on the
+    * air, so only copies sent again over the same hop are removed. A frame
+    * forwarded by several relays arrives with a different source and
+    * sequence ID each time; RYLR998_Relay drops those by origin and
+    * message ID.
+    *
+    * Sequence IDs start at a random value, so frames of a node restarted
+    * within the window are not taken for copies.
+    *
+    * @param enable true to tag sent frames and drop duplicates
+    * @param window_ms how long a frame is remembered
+    */
+    void set_dedup(bool enable, uint32_t window_ms = RYLR998_DUP_WINDOW_MS);
+
+    /**
+    * Return the duplicate cache counters
+    *
+    * @return dedup_stats
+    */
+    struct dedup_stats get_dedup_stats(void);
+
+    /**
+    * Enable or disable payload compression to a destination
+    *
+    * Only the sending side is switched; every node decompresses what it
+    * receives. The first enable sends a capability request, repeated with
+    * the next sends to addr after RYLR998_LINK_CAPS_RETRY_MS, doubling up
+    * to RYLR998_LINK_CAPS_RETRY_MAX_MS, until the peer answers. Frames are
+    * compressed only after that, and only when that saves airtime. Peers
+    * learned from received frames are evicted least recently used first
+    * to make room; peers with compression enabled are kept.
+    *
+    * @param addr the destination address
+    * @param enable true to compress frames sent to addr
+    * @return false if all RYLR998_LINK_PEERS entries have compression enabled
+    */
+    bool set_compression(int addr, bool enable);
+
+    /**
+    * Set the preset compression dictionary
+    *
+    * The dictionary is used only towards peers that announced the same one.
+    * The buffer is not copied and must stay valid.
+    *
+    * @param dict the dictionary, typical strings of the payload
+    * @param len the dictionary length, up to RYLR998_LZ_MAX_DICT
+    */
+    void set_compression_dictionary(const char *dict, int len);
+
+    /**
+    * Record driver events (module errors, dropped frames) to a deferred log
+    *
+    * @param log the log, or nullptr to stop logging
+    */
+    void set_log(RYLR998_Log *log) {
+        _log = log;
+    }
+
+    /**
+    * Spool received packets to storage when the application falls behind
+    *
+    * Once ram_frames packets wait in RAM, new packets go to the spool
+    * until it is drained again. recv() returns RAM and spooled packets in
+    * arrival order, and packets a mounted spool kept over a reset come
+    * before those received since. If the spool can not be written, packets
+    * stay in RAM behind the spooled ones. The spool is committed from
+    * recv(), get_size() and poll().
+    *
+    * @param spool a mounted spool, or nullptr to keep everything in RAM
+    * @param ram_frames packets kept in RAM before spooling
+    */
+    void set_spool(RYLR998_Spool *spool, int ram_frames = RYLR998_SPOOL_RAM_FRAMES);
+
+    /**
+    * Spool frames to send while the module is down
+    *
+    * Frames whose send timed out are replayed after recovery. With a
+    * spool they are appended to it instead of the RYLR998_HEALTH_TX_QUEUE
+    * frames RAM queue, and sent in order once a command succeeds, also
+    * after a reset: call recover() or any setter to send the frames a
+    * mounted spool kept. A frame leaves the spool when the module accepts or
+    * rejects it, so a reset before the next commit may send it again. The
+    * spool is committed from recv(), get_size() and poll(); use another
+    * storage than the RX spool.
+    *
+    * @param spool a mounted spool, or nullptr to keep only the RAM queue
+    */
+    void set_tx_spool(RYLR998_Spool *spool);
+
+    /**
+    * Return the code of the latest +ERR reply
+    *
+    * @return the error code, 0 if none yet
+    */
+    int get_last_error(void) {
+        return _last_error;
+    }
+
+    /**
+    * Recover the module now
+    *
+    * Commands recover on their own after RYLR998_HEALTH_FAIL_THRESHOLD
+    * failures. Recovery escalates from a flush to AT+RESET to a hardware
+    * reset, restores the settings made through this driver and replays
+    * the frames whose send failed. If every step fails, commands fail
+    * fast and recovery is retried every RYLR998_HEALTH_RETRY_MS.
+    *
+    * @return true if the module answers again
+    */
+    bool recover(void);
+
+    /**
+    * Return the health counters
+    *
+    * @return health_stats
+    */
+    struct health_stats get_health(void);
+
+    /**
+    * Cycle the module between RX windows and sleep
+    *
+    * The schedule runs from recv(), get_size() and poll(), so call one of
+    * them at least every few ms, or call poll() when get_power_deadline()
+    * comes due, as RYLR998_EventLoop does. Sends while asleep are queued, up to
+    * RYLR998_POWER_TX_QUEUE frames, and go out in order when the next
+    * window opens. A send to a full queue opens the window at once and
+    * goes out behind the queued frames. Other commands wake the module
+    * at once and start a new window. Frames sent to a sleeping module are
+    * lost, so peers need to retry or send when the node is known awake.
+    *
+    * @param rx_ms length of each RX window, 0 to stay in RX
+    * @param sleep_ms sleep between windows, the worst case delay of a queued send
+    * @return false if the module did not wake up when turned off
+    */
+    bool set_power_save(uint32_t rx_ms, uint32_t sleep_ms);
+
+    /**
+    * Return the power save counters
+    *
+    * @return power_stats
+    */
+    struct power_stats get_power_stats(void);
+
+    /**
+    * Return when the power save schedule next needs a call to poll()
+    *
+    * For event driven callers, which only call poll() on input: a
+    * sleeping module sends nothing, so it would never be woken up.
+    *
+    * @return ms until the next window opens or closes, 0 if due now, -1
+    *         if nothing is scheduled
+    */
+    int get_power_deadline(void);
+
     /**
     * Allows timeout to be changed between commands
     *
     * @param timeout timeout of the command
     */
-    void set_timeout(mbed::chrono::milliseconds_u32 timeout = RYLR998_CMD_TIMEOUT);
+    void set_timeout(std::chrono::duration<uint32_t, std::milli> timeout = RYLR998_CMD_TIMEOUT);
 
     /**
      * Flush the serial port input buffers.
@@ -383,19 +769,105 @@ private:
     bool _rx_boost;
     int _r_rssi;
     int _r_snr;
+    uint32_t _r_time;
+    int _mode;
+    uint8_t _config;    // RYLR998_CFG_ bits of the cached settings
     int _last_error;
+    uint32_t _rand_state;   // 0 until seeded
 
-    mbed::BufferedSerial _serial;
-    mbed::DigitalOut _reset;
-    rtos::Mutex _smutex;
+    rylr998_port::Serial _serial;
+    rylr998_port::ResetPin _reset;
+    rylr998_port::Mutex _smutex;
 
-    mbed::ATCmdParser _parser;
+    rylr998_port::Parser _parser;
     _Packet_LinkedList _packet_buffer;
 
+    struct _Link_Peer {
+        int addr;           // -1 for a free entry
+        bool compress;      // compression wanted towards this peer
+        bool caps_known;    // caps and dict_id are valid
+        bool caps_pending;  // peer asked for our capabilities
+        uint32_t caps_asked;    // last request sent
+        uint32_t caps_backoff;  // wait before the next one
+        uint8_t caps;
+        uint16_t dict_id;
+        uint32_t used;      // last lookup, for eviction
+    };
+    _Link_Peer _peers[RYLR998_LINK_PEERS];
+    RYLR998_Compressor _compressor;
+    bool _dedup;
+    uint16_t _tx_seq;
+    RYLR998_DupCache _dup_cache;
+    RYLR998_Log *_log;
+    RYLR998_Spool *_spool;
+    int _spool_ram;
+    int _ram_older;         // RAM packets that arrived before the spooled ones
+    RYLR998_Spool *_tx_spool;
+
+    void _queue_packet(int addr, char *data, int len, int rssi, int snr, uint32_t time);
+
+    // Health
+    struct _Tx_Frame {
+        int addr;
+        int len;
+        char data[RYLR998_MAX_PAYLOAD];
+    };
+    int _fail_count;
+    bool _err_pending;  // +ERR seen during the current command
+    bool _err_link;     // and it means lost framing
+    bool _recovering;
+    bool _down;
+    uint32_t _down_since;
+    uint32_t _last_attempt;
+    _Tx_Frame _tx_queue[RYLR998_HEALTH_TX_QUEUE];
+    int _tx_head;
+    int _tx_count;
+    struct health_stats _health;
+
+    bool _ready(void);
+    bool _check(bool done);
+    bool _probe(void);
+    bool _recover(void);
+    bool _apply_config(void);
+    void _tx_enqueue(int addr, const char *data, int len);
+    void _replay(void);
+    bool _drain(_Tx_Frame *queue, int size, int &head, int &count, uint32_t *sent);
+    bool _drain_spool(void);
+
+    // Power save
+    uint32_t _pwr_rx_ms;
+    uint32_t _pwr_sleep_ms;     // 0 when off
+    uint32_t _pwr_phase_start;  // start of the current RX window or sleep
+    bool _asleep;
+    bool _pwr_busy;
+    _Tx_Frame _pwr_queue[RYLR998_POWER_TX_QUEUE];
+    int _pwr_head;
+    int _pwr_count;
+    struct power_stats _pwr_stats;
+
+    void _power_service(void);
+    bool _power_sleep(void);
+    bool _power_wake(uint32_t due);
+
+    // Link layer
+    bool _link_caps_due(int addr);
+    _Link_Peer *_link_peer(int addr, bool create);
+    int _link_encode(int addr, const char *data, int len, char *frame);
+    bool _link_send_caps(int addr, bool reply);
+    void _link_service();
+    bool _send_frame(int addr, const char *data, int len);
+    uint32_t _now_ms(void);
+
+    void _init(bool debug);
+
     // OOB processing
     void _process_oob(std::chrono::duration<uint32_t, std::milli> timeout, bool all);
+#if RYLR998_PORT_POSIX
+    bool _line_ready(void);
+#endif
 
     // OOB message handlers
+    int _read_line(char *line, int size);
     void _oob_packet_hdlr();
     void _oob_error_hdlr();
 };
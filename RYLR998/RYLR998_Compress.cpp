@@ -0,0 +1,182 @@
+/*
+ * Copyright (c) 2023, Nuvoton Technology Corporation
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <string.h>
+#include "RYLR998_Compress.h"
+
+static inline int _lz_hash(const uint8_t *p)
+{
+    uint32_t v = p[0] | (p[1] << 8) | (p[2] << 16);
+    return (int)((v * 2654435761u) >> (32 - RYLR998_LZ_HASH_BITS));
+}
+
+RYLR998_Compressor::RYLR998_Compressor(const uint8_t *dict, int dict_len)
+{
+    set_dictionary(dict, dict_len);
+}
+
+void RYLR998_Compressor::set_dictionary(const uint8_t *dict, int dict_len)
+{
+    if (dict == nullptr || dict_len <= 0)
+    {
+        _dict = nullptr;
+        _dict_len = 0;
+        _dict_id = 0;
+        return;
+    }
+
+    if (dict_len > RYLR998_LZ_MAX_DICT)
+    {
+        // Keep the tail, matches are most likely near the end
+        dict += dict_len - RYLR998_LZ_MAX_DICT;
+        dict_len = RYLR998_LZ_MAX_DICT;
+    }
+
+    _dict = dict;
+    _dict_len = dict_len;
+
+    // Fletcher-16, with 0 reserved for no dictionary
+    uint16_t a = 0, b = 0;
+    for (int i = 0; i < dict_len; i++)
+    {
+        a = (a + dict[i]) % 255;
+        b = (b + a) % 255;
+    }
+    _dict_id = (b << 8) | a;
+    if (_dict_id == 0)
+        _dict_id = 1;
+}
+
+int RYLR998_Compressor::compress(const uint8_t *in, int len, uint8_t *out, int size, bool use_dict)
+{
+    // Positions are counted over the dictionary followed by the input
+    const uint8_t *dict = (use_dict) ? _dict : nullptr;
+    int base = (use_dict) ? _dict_len : 0;
+    int o = 0, flag_pos = -1, nitems = 8;
+
+    for (int i = 0; i < RYLR998_LZ_HASH_SIZE; i++)
+        _table[i] = -1;
+
+    for (int i = 0; i + RYLR998_LZ_MIN_MATCH <= base; i++)
+        _table[_lz_hash(&dict[i])] = i;
+
+    int i = 0;
+    while (i < len)
+    {
+        int vp = base + i;
+        int mlen = 0, moff = 0;
+
+        if (i + RYLR998_LZ_MIN_MATCH <= len)
+        {
+            int h = _lz_hash(&in[i]);
+            int cand = _table[h];
+            _table[h] = vp;
+
+            if (cand >= 0 && vp - cand <= RYLR998_LZ_MAX_OFFSET)
+            {
+                int limit = len - i;
+                if (limit > RYLR998_LZ_MAX_MATCH)
+                    limit = RYLR998_LZ_MAX_MATCH;
+
+                while (mlen < limit)
+                {
+                    int src = cand + mlen;
+                    uint8_t c = (src < base) ? dict[src] : in[src - base];
+                    if (c != in[i + mlen])
+                        break;
+                    mlen++;
+                }
+                moff = vp - cand;
+            }
+        }
+
+        if (nitems == 8)
+        {
+            if (o >= size)
+                return -1;
+            flag_pos = o++;
+            out[flag_pos] = 0;
+            nitems = 0;
+        }
+
+        if (mlen >= RYLR998_LZ_MIN_MATCH)
+        {
+            if (o + 2 > size)
+                return -1;
+            out[flag_pos] |= 1 << nitems;
+            out[o++] = (moff - 1) & 0xFF;
+            out[o++] = (((moff - 1) >> 8) << 7) | (mlen - RYLR998_LZ_MIN_MATCH);
+
+            // Index the positions inside the match for later matches
+            for (int k = 1; k < mlen && i + k + RYLR998_LZ_MIN_MATCH <= len; k++)
+                _table[_lz_hash(&in[i + k])] = vp + k;
+            i += mlen;
+        }
+        else
+        {
+            if (o >= size)
+                return -1;
+            out[o++] = in[i++];
+        }
+        nitems++;
+    }
+
+    return o;
+}
+
+int RYLR998_Compressor::decompress(const uint8_t *in, int len, uint8_t *out, int size, bool use_dict)
+{
+    if (use_dict && _dict_len == 0)
+        return -1;
+
+    int base = (use_dict) ? _dict_len : 0;
+    int i = 0, o = 0;
+
+    while (i < len)
+    {
+        uint8_t flags = in[i++];
+
+        for (int n = 0; n < 8 && i < len; n++)
+        {
+            if ((flags & (1 << n)) == 0)
+            {
+                if (o >= size)
+                    return -1;
+                out[o++] = in[i++];
+                continue;
+            }
+
+            if (i + 2 > len)
+                return -1;
+
+            int off = (in[i] | ((in[i + 1] >> 7) << 8)) + 1;
+            int mlen = (in[i + 1] & 0x7F) + RYLR998_LZ_MIN_MATCH;
+            i += 2;
+
+            int src = base + o - off;
+            if (src < 0 || o + mlen > size)
+                return -1;
+
+            // Byte by byte, the match may overlap its own output
+            for (int k = 0; k < mlen; k++, src++)
+                out[o++] = (src < base) ? _dict[src] : out[src - base];
+        }
+    }
+
+    return o;
+}
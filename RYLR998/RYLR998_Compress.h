@@ -0,0 +1,99 @@
+/*
+ * Copyright (c) 2023, Nuvoton Technology Corporation
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef __RYLR998_COMPRESS_H__
+#define __RYLR998_COMPRESS_H__
+
+#include <stdint.h>
+
+#ifndef RYLR998_LZ_HASH_BITS
+#define RYLR998_LZ_HASH_BITS    8
+#endif
+
+#define RYLR998_LZ_HASH_SIZE    (1 << RYLR998_LZ_HASH_BITS)
+#define RYLR998_LZ_MIN_MATCH    3
+#define RYLR998_LZ_MAX_MATCH    (RYLR998_LZ_MIN_MATCH + 127)
+#define RYLR998_LZ_MAX_OFFSET   512
+#define RYLR998_LZ_MAX_DICT     256
+
+/** RYLR998_Compressor class.
+    Small window LZ compressor for single frames.
+
+    The output is a series of groups, each a flag byte followed by up to
+    eight items. A clear flag bit is a literal byte, a set bit is a two byte
+    match of 9 bit offset and 7 bit length. Matches may reach back into an
+    optional preset dictionary, which is what makes short, repetitive text
+    frames compressible at all. RAM use is the hash table only.
+ */
+class RYLR998_Compressor {
+public:
+    /**
+    * @param dict the preset dictionary, or nullptr for none
+    * @param dict_len the dictionary length, up to RYLR998_LZ_MAX_DICT
+    */
+    RYLR998_Compressor(const uint8_t *dict = nullptr, int dict_len = 0);
+
+    /**
+    * Replace the preset dictionary. Both peers must use the same dictionary.
+    *
+    * @param dict the preset dictionary, or nullptr for none
+    * @param dict_len the dictionary length, up to RYLR998_LZ_MAX_DICT
+    */
+    void set_dictionary(const uint8_t *dict, int dict_len);
+
+    /**
+    * Return the dictionary identifier
+    *
+    * @return a checksum of the dictionary, 0 if there is none
+    */
+    uint16_t dict_id(void) {
+        return _dict_id;
+    }
+
+    /**
+    * Compress a frame
+    *
+    * @param in the data to compress
+    * @param len the data length
+    * @param out buffer that stores the compressed data
+    * @param size the buffer size
+    * @param use_dict true to match against the preset dictionary
+    * @return the compressed size, or -1 if it does not fit in size
+    */
+    int compress(const uint8_t *in, int len, uint8_t *out, int size, bool use_dict);
+
+    /**
+    * Decompress a frame
+    *
+    * @param in the compressed data
+    * @param len the compressed length
+    * @param out buffer that stores the data
+    * @param size the buffer size
+    * @param use_dict true if the frame was compressed with the dictionary
+    * @return the data size, or -1 if the frame is corrupt or too large
+    */
+    int decompress(const uint8_t *in, int len, uint8_t *out, int size, bool use_dict);
+
+private:
+    const uint8_t *_dict;
+    int _dict_len;
+    uint16_t _dict_id;
+    int16_t _table[RYLR998_LZ_HASH_SIZE];
+};
+
+#endif // __RYLR998_COMPRESS_H__
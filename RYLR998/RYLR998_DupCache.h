@@ -0,0 +1,135 @@
+/*
+ * Copyright (c) 2023, Nuvoton Technology Corporation
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef __RYLR998_DUPCACHE_H__
+#define __RYLR998_DUPCACHE_H__
+
+#include <stdint.h>
+
+#ifndef RYLR998_DUP_CACHE_SIZE
+#define RYLR998_DUP_CACHE_SIZE  32      // entries, a power of two
+#endif
+
+#ifndef RYLR998_DUP_CACHE_PROBE
+#define RYLR998_DUP_CACHE_PROBE 4       // entries searched per lookup
+#endif
+
+#ifndef RYLR998_DUP_WINDOW_MS
+#define RYLR998_DUP_WINDOW_MS   10000
+#endif
+
+/** RYLR998_DupCache class.
+    Remembers recently seen (source address, sequence ID) pairs.
+
+    Entries are hashed into a fixed table and searched over a short probe
+    run. An entry older than the window no longer counts as seen and is
+    reused; if the probe run is full the oldest entry is replaced.
+
+    The address is the caller's choice: the driver uses the +RCV source,
+    the node that sent the copy over the air, while RYLR998_Relay uses
+    the node that originated the frame.
+ */
+class RYLR998_DupCache {
+public:
+    RYLR998_DupCache(uint32_t window_ms = RYLR998_DUP_WINDOW_MS) : _window(window_ms) {
+        clear();
+    }
+
+    /**
+    * Check a frame and remember it
+    *
+    * @param addr the source address
+    * @param seq the sequence ID of the frame
+    * @param now_ms the current time in milliseconds
+    * @return true if the frame was seen within the window
+    */
+    bool seen(uint16_t addr, uint16_t seq, uint32_t now_ms) {
+        uint32_t h = ((uint32_t)addr << 16 | seq) * 2654435761u;
+        int base = (h >> 16) & (RYLR998_DUP_CACHE_SIZE - 1);
+        _Entry *victim = nullptr;
+        bool victim_live = true;
+
+        for (int i = 0; i < RYLR998_DUP_CACHE_PROBE; i++) {
+            _Entry *e = &_table[(base + i) & (RYLR998_DUP_CACHE_SIZE - 1)];
+            bool live = e->used && (now_ms - e->time) < _window;
+
+            if (live && e->addr == addr && e->seq == seq) {
+                _hits++;
+                return true;
+            }
+
+            // Prefer a free or expired entry, else the oldest one
+            if (victim == nullptr || (victim_live && (!live || now_ms - e->time > now_ms - victim->time))) {
+                victim = e;
+                victim_live = live;
+            }
+        }
+
+        if (victim_live)
+            _evictions++;
+
+        victim->used = true;
+        victim->addr = addr;
+        victim->seq = seq;
+        victim->time = now_ms;
+        _misses++;
+
+        return false;
+    }
+
+    void clear(void) {
+        for (int i = 0; i < RYLR998_DUP_CACHE_SIZE; i++)
+            _table[i].used = false;
+        _hits = 0;
+        _misses = 0;
+        _evictions = 0;
+    }
+
+    void set_window(uint32_t window_ms) {
+        _window = window_ms;
+    }
+
+    uint32_t hits(void) {
+        return _hits;
+    }
+
+    uint32_t misses(void) {
+        return _misses;
+    }
+
+    // Live entries pushed out before their window ended
+    uint32_t evictions(void) {
+        return _evictions;
+    }
+
+private:
+    struct _Entry {
+        bool used;
+        uint16_t addr;
+        uint16_t seq;
+        uint32_t time;
+    };
+
+    _Entry _table[RYLR998_DUP_CACHE_SIZE];
+    uint32_t _window;
+    uint32_t _hits;
+    uint32_t _misses;
+    uint32_t _evictions;
+};
+
+#endif // __RYLR998_DUPCACHE_H__
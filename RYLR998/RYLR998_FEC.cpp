@@ -0,0 +1,587 @@
+/*
+ * Copyright (c) 2023, Nuvoton Technology Corporation
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "RYLR998_FEC.h"
+
+// GF(256) with polynomial 0x11D
+static uint8_t _gf_exp[512];
+static uint8_t _gf_log[256];
+static bool _gf_ready = false;
+
+static void _gf_init(void)
+{
+    if (_gf_ready)
+        return;
+
+    int x = 1;
+    for (int i = 0; i < 255; i++)
+    {
+        _gf_exp[i] = x;
+        _gf_log[x] = i;
+        x <<= 1;
+        if (x & 0x100)
+            x ^= 0x11D;
+    }
+    for (int i = 255; i < 512; i++)
+        _gf_exp[i] = _gf_exp[i - 255];
+
+    _gf_ready = true;
+}
+
+static inline uint8_t _gf_mul(uint8_t a, uint8_t b)
+{
+    return (a == 0 || b == 0) ? 0 : _gf_exp[_gf_log[a] + _gf_log[b]];
+}
+
+static inline uint8_t _gf_inv(uint8_t a)
+{
+    return _gf_exp[255 - _gf_log[a]];
+}
+
+// dst ^= c * src
+static void _gf_mul_add(uint8_t *dst, const uint8_t *src, uint8_t c, int size)
+{
+    if (c == 0)
+        return;
+
+    int lc = _gf_log[c];
+    for (int i = 0; i < size; i++)
+    {
+        if (src[i])
+            dst[i] ^= _gf_exp[lc + _gf_log[src[i]]];
+    }
+}
+
+static void _gf_scale(uint8_t *dst, uint8_t c, int size)
+{
+    for (int i = 0; i < size; i++)
+        dst[i] = _gf_mul(dst[i], c);
+}
+
+// Cauchy matrix entry for repair row j and data column i. The row and
+// column sets never overlap, so every square submatrix is invertible.
+static inline uint8_t _fec_coef(int j, int i)
+{
+    return _gf_inv((0x80 | j) ^ i);
+}
+
+static int _popcount(uint32_t v)
+{
+    int n = 0;
+    for (; v; v &= v - 1)
+        n++;
+    return n;
+}
+
+RYLR998_FEC::RYLR998_FEC(RYLR998 &rylr, int k, int m)
+    : _rylr(rylr),
+      _auto(false),
+      _sf(9),
+      _tx_addr(-1),
+      _tx_id(0),
+      _tx_count(0),
+      _rx_tick(0)
+{
+    _gf_init();
+    set_redundancy(k, m);
+
+    _tx_k = _k;
+    _tx_m = _m;
+    _tx_size = 0;
+
+    for (int i = 0; i < RYLR998_FEC_RX_BLOCKS; i++)
+        _rx[i].used = false;
+
+    for (int i = 0; i < RYLR998_FEC_PEERS; i++)
+        _peers[i].addr = -1;
+
+    memset(&_stats, 0, sizeof(_stats));
+}
+
+void RYLR998_FEC::set_redundancy(int k, int m)
+{
+    if (k < 1 || k > RYLR998_FEC_MAX_K || m < 0 || m > RYLR998_FEC_MAX_M)
+        return;
+
+    _k = k;
+    _m = m;
+}
+
+void RYLR998_FEC::set_auto_redundancy(bool enable)
+{
+    _auto = enable;
+
+    if (enable)
+    {
+        int sf = _rylr.get_rf_parameter().sf;
+        if (sf >= 7)
+            _sf = sf;
+    }
+}
+
+bool RYLR998_FEC::send(int addr, const char *data, int len)
+{
+    if (data == NULL || len < 0 || len > RYLR998_FEC_MAX_DATA)
+        return false;
+
+    bool done = true;
+
+    if (_tx_count > 0 && addr != _tx_addr)
+        done = flush();
+
+    if (_tx_count == 0)
+        _tx_begin(addr);
+
+    char frame[RYLR998_MAX_PAYLOAD];
+    frame[0] = RYLR998_FEC_MAGIC;
+    frame[1] = _tx_id;
+    frame[2] = _tx_count;
+    frame[3] = ((_tx_k - 1) << 4) | _tx_m;
+    memcpy(frame + RYLR998_FEC_HDR_SIZE, data, len);
+
+    // A refused frame is still coded, the repair frames may rebuild it
+    if (!_rylr.send(addr, frame, len + RYLR998_FEC_HDR_SIZE))
+    {
+        _stats.refused++;
+        done = false;
+    }
+    _stats.data_sent++;
+
+    // The symbol is the length byte followed by the data
+    uint8_t sym_len = len;
+    for (int j = 0; j < _tx_m; j++)
+    {
+        uint8_t c = _fec_coef(j, _tx_count);
+        _gf_mul_add(_tx_repair[j], &sym_len, c, 1);
+        _gf_mul_add(_tx_repair[j] + 1, (const uint8_t *)data, c, len);
+    }
+
+    if (len + 1 > _tx_size)
+        _tx_size = len + 1;
+
+    if (++_tx_count == _tx_k && !_tx_repairs())
+        done = false;
+
+    return done;
+}
+
+bool RYLR998_FEC::send_plain(int addr, const char *data, int len)
+{
+    if (data == NULL || len < 0 || len > RYLR998_FEC_MAX_DATA)
+        return false;
+
+    char frame[RYLR998_MAX_PAYLOAD];
+
+    if (len > 0 && (uint8_t)data[0] == RYLR998_FEC_MAGIC)
+    {
+        frame[0] = RYLR998_FEC_MAGIC;
+        frame[1] = 0;
+        frame[2] = RYLR998_FEC_PLAIN;
+        frame[3] = 0;
+        memcpy(frame + RYLR998_FEC_HDR_SIZE, data, len);
+        data = frame;
+        len += RYLR998_FEC_HDR_SIZE;
+    }
+
+    if (_rylr.send(addr, data, len))
+        return true;
+
+    _stats.refused++;
+    return false;
+}
+
+bool RYLR998_FEC::flush(void)
+{
+    return (_tx_count > 0) ? _tx_repairs() : true;
+}
+
+int RYLR998_FEC::recv(int &addr, char *data, int size)
+{
+    int len = _rx_deliver(addr, data, size);
+    if (len > 0)
+        return len;
+
+    uint8_t buf[RYLR998_MAX_PAYLOAD + 1];
+
+    while (true)
+    {
+        int from;
+        len = _rylr.recv(from, (char *)buf, RYLR998_MAX_PAYLOAD);
+        if (len <= 0)
+            return 0;
+
+        _Peer *peer = _peer(from);
+        peer->snr = _rylr.get_snr();
+
+        if (len < RYLR998_FEC_HDR_SIZE || buf[0] != RYLR998_FEC_MAGIC || buf[2] == RYLR998_FEC_PLAIN)
+        {
+            // Not coded, pass it through
+            if (len >= RYLR998_FEC_HDR_SIZE && buf[0] == RYLR998_FEC_MAGIC)
+            {
+                len -= RYLR998_FEC_HDR_SIZE;
+                memmove(buf, buf + RYLR998_FEC_HDR_SIZE, len);
+            }
+            if (len > size)
+                len = size;
+            memcpy(data, buf, len);
+            data[len] = '\0';
+            addr = from;
+            return len;
+        }
+
+        uint8_t id = buf[1];
+        bool repair = (buf[2] & RYLR998_FEC_REPAIR) != 0;
+        int idx = buf[2] & ~RYLR998_FEC_REPAIR;
+        int k = (buf[3] >> 4) + 1;
+        uint8_t *payload = buf + RYLR998_FEC_HDR_SIZE;
+        int plen = len - RYLR998_FEC_HDR_SIZE;
+
+        if (k > RYLR998_FEC_MAX_K || idx >= ((repair) ? RYLR998_FEC_MAX_M : k))
+            continue;
+
+        _Rx_Block *blk = _rx_block(from, id, k);
+
+        if (!repair)
+        {
+            if (plen > RYLR998_FEC_MAX_DATA || (blk->data_mask & (1 << idx)))
+                continue;
+
+            memset(blk->data[idx], 0, RYLR998_FEC_SYMBOL_SIZE);
+            blk->data[idx][0] = plen;
+            memcpy(blk->data[idx] + 1, payload, plen);
+            blk->data_mask |= 1 << idx;
+            blk->delivered_mask |= 1 << idx;
+            if (idx == blk->k - 1)
+                blk->k_known = true;
+            blk->received++;
+            _stats.data_received++;
+
+            if (plen > size)
+                plen = size;
+            memcpy(data, payload, plen);
+            data[plen] = '\0';
+            addr = from;
+            return plen;
+        }
+
+        if (plen < 1 || (blk->size != 0 && blk->size != plen) || (blk->repair_mask & (1 << idx)))
+            continue;
+
+        // The repair frame tells the real block size, also for a short block
+        blk->k = k;
+        blk->k_known = true;
+        blk->size = plen;
+        memcpy(blk->repair[idx], payload, plen);
+        blk->repair_mask |= 1 << idx;
+        _stats.repair_received++;
+
+        _rx_decode(blk);
+
+        len = _rx_deliver(addr, data, size);
+        if (len > 0)
+            return len;
+    }
+}
+
+void RYLR998_FEC::_tx_begin(int addr)
+{
+    _tx_addr = addr;
+    _tx_k = _k;
+    _tx_m = _pick_m(addr);
+    _tx_size = 0;
+
+    for (int j = 0; j < _tx_m; j++)
+        memset(_tx_repair[j], 0, RYLR998_FEC_SYMBOL_SIZE);
+}
+
+bool RYLR998_FEC::_tx_repairs(void)
+{
+    char frame[RYLR998_MAX_PAYLOAD];
+    bool done = true;
+
+    for (int j = 0; j < _tx_m; j++)
+    {
+        frame[0] = RYLR998_FEC_MAGIC;
+        frame[1] = _tx_id;
+        frame[2] = RYLR998_FEC_REPAIR | j;
+        frame[3] = ((_tx_count - 1) << 4) | _tx_m;
+        memcpy(frame + RYLR998_FEC_HDR_SIZE, _tx_repair[j], _tx_size);
+
+        if (!_rylr.send(_tx_addr, frame, _tx_size + RYLR998_FEC_HDR_SIZE))
+        {
+            _stats.refused++;
+            done = false;
+        }
+        _stats.repair_sent++;
+    }
+
+    _tx_count = 0;
+    _tx_id++;
+
+    return done;
+}
+
+int RYLR998_FEC::_pick_m(int addr)
+{
+    if (!_auto)
+        return _m;
+
+    _Peer *peer = NULL;
+    for (int i = 0; i < RYLR998_FEC_PEERS; i++)
+    {
+        if (_peers[i].addr == addr)
+            peer = &_peers[i];
+    }
+
+    if (peer == NULL)
+        return _m;
+
+    // SNR margin above the demodulation floor, -7.5 dB at SF7 and 2.5 dB
+    // lower per SF step, counted in half dB
+    int margin = 2 * peer->snr + 15 + 5 * (_sf - 7);
+    int m;
+    if (margin >= 20)
+        m = 0;
+    else if (margin >= 10)
+        m = 1;
+    else if (margin >= 4)
+        m = 2;
+    else
+        m = RYLR998_FEC_MAX_M;
+
+    // Cover twice the expected losses per block
+    int m_loss = (2 * _k * peer->loss + 255) / 256;
+    if (m_loss > m)
+        m = m_loss;
+
+    return (m > RYLR998_FEC_MAX_M) ? RYLR998_FEC_MAX_M : m;
+}
+
+RYLR998_FEC::_Peer *RYLR998_FEC::_peer(int addr)
+{
+    _Peer *free = NULL;
+
+    for (int i = 0; i < RYLR998_FEC_PEERS; i++)
+    {
+        if (_peers[i].addr == addr)
+            return &_peers[i];
+        if (_peers[i].addr < 0 && free == NULL)
+            free = &_peers[i];
+    }
+
+    if (free == NULL)
+        free = &_peers[addr % RYLR998_FEC_PEERS];
+
+    free->addr = addr;
+    free->snr = 0;
+    free->loss = 0;
+
+    return free;
+}
+
+RYLR998_FEC::_Rx_Block *RYLR998_FEC::_rx_block(int addr, uint8_t id, int k)
+{
+    _Rx_Block *blk = NULL;
+
+    for (int i = 0; i < RYLR998_FEC_RX_BLOCKS; i++)
+    {
+        if (_rx[i].used && _rx[i].addr == addr && _rx[i].id == id)
+            return &_rx[i];
+    }
+
+    for (int i = 0; i < RYLR998_FEC_RX_BLOCKS; i++)
+    {
+        if (!_rx[i].used)
+        {
+            blk = &_rx[i];
+            break;
+        }
+        if (blk == NULL || _rx[i].age < blk->age)
+            blk = &_rx[i];
+    }
+
+    _rx_retire(blk);
+
+    blk->used = true;
+    blk->addr = addr;
+    blk->id = id;
+    blk->k = k;
+    blk->k_known = false;
+    blk->size = 0;
+    blk->received = 0;
+    blk->age = ++_rx_tick;
+    blk->data_mask = 0;
+    blk->delivered_mask = 0;
+    blk->repair_mask = 0;
+
+    return blk;
+}
+
+void RYLR998_FEC::_rx_retire(_Rx_Block *blk)
+{
+    if (!blk->used)
+        return;
+
+    // A block flushed early is shorter than announced, and only a repair
+    // frame or its last data frame tells. Until then only the frames missing
+    // before the latest one received are known to be lost.
+    int k = blk->k;
+    if (!blk->k_known)
+    {
+        while (k > 0 && (blk->data_mask & (1 << (k - 1))) == 0)
+            k--;
+    }
+
+    if (k > 0)
+    {
+        uint16_t all = (1 << k) - 1;
+        _stats.lost += _popcount(all & ~blk->data_mask);
+
+        // Loss rate of the link as seen before repair
+        _Peer *peer = _peer(blk->addr);
+        int sample = (k - blk->received) * 256 / k;
+        peer->loss += (sample - peer->loss) / 8;
+    }
+
+    blk->used = false;
+}
+
+bool RYLR998_FEC::_rx_decode(_Rx_Block *blk)
+{
+    int missing[RYLR998_FEC_MAX_K];
+    int rows[RYLR998_FEC_MAX_M];
+    int e = 0, r = 0;
+
+    for (int i = 0; i < blk->k; i++)
+    {
+        if ((blk->data_mask & (1 << i)) == 0)
+            missing[e++] = i;
+    }
+
+    if (e == 0)
+        return true;
+
+    for (int j = 0; j < RYLR998_FEC_MAX_M && r < e; j++)
+    {
+        if (blk->repair_mask & (1 << j))
+            rows[r++] = j;
+    }
+
+    if (r < e)
+        return false;
+
+    // Remove the known data from the repair symbols, leaving an e x e
+    // system over the missing ones, then solve it by Gauss-Jordan
+    uint8_t a[RYLR998_FEC_MAX_M][RYLR998_FEC_MAX_M];
+    int size = blk->size;
+
+    for (int x = 0; x < e; x++)
+    {
+        uint8_t *rhs = blk->repair[rows[x]];
+        for (int i = 0; i < blk->k; i++)
+        {
+            if (blk->data_mask & (1 << i))
+                _gf_mul_add(rhs, blk->data[i], _fec_coef(rows[x], i), size);
+        }
+        for (int y = 0; y < e; y++)
+            a[x][y] = _fec_coef(rows[x], missing[y]);
+    }
+
+    for (int c = 0; c < e; c++)
+    {
+        int p = c;
+        while (p < e && a[p][c] == 0)
+            p++;
+        if (p == e)
+            return false;
+
+        if (p != c)
+        {
+            for (int y = 0; y < e; y++)
+            {
+                uint8_t t = a[p][y];
+                a[p][y] = a[c][y];
+                a[c][y] = t;
+            }
+            int t = rows[p];
+            rows[p] = rows[c];
+            rows[c] = t;
+        }
+
+        uint8_t inv = _gf_inv(a[c][c]);
+        for (int y = 0; y < e; y++)
+            a[c][y] = _gf_mul(a[c][y], inv);
+        _gf_scale(blk->repair[rows[c]], inv, size);
+
+        for (int x = 0; x < e; x++)
+        {
+            uint8_t f = a[x][c];
+            if (x == c || f == 0)
+                continue;
+            for (int y = 0; y < e; y++)
+                a[x][y] ^= _gf_mul(f, a[c][y]);
+            _gf_mul_add(blk->repair[rows[x]], blk->repair[rows[c]], f, size);
+        }
+    }
+
+    for (int x = 0; x < e; x++)
+    {
+        uint8_t *sym = blk->repair[rows[x]];
+        if (sym[0] >= size)
+            continue;   // corrupt, a bad length can not be delivered
+
+        memset(blk->data[missing[x]], 0, RYLR998_FEC_SYMBOL_SIZE);
+        memcpy(blk->data[missing[x]], sym, size);
+        blk->data_mask |= 1 << missing[x];
+        _stats.recovered++;
+    }
+
+    // The repair symbols were used up by the elimination
+    blk->repair_mask = 0;
+
+    return true;
+}
+
+int RYLR998_FEC::_rx_deliver(int &addr, char *data, int size)
+{
+    for (int b = 0; b < RYLR998_FEC_RX_BLOCKS; b++)
+    {
+        _Rx_Block *blk = &_rx[b];
+        if (!blk->used)
+            continue;
+
+        uint16_t ready = blk->data_mask & ~blk->delivered_mask;
+        for (int i = 0; ready && i < blk->k; i++)
+        {
+            if ((ready & (1 << i)) == 0)
+                continue;
+
+            int len = blk->data[i][0];
+            blk->delivered_mask |= 1 << i;
+
+            if (len > size)
+                len = size;
+            memcpy(data, blk->data[i] + 1, len);
+            data[len] = '\0';
+            addr = blk->addr;
+            return len;
+        }
+    }
+
+    return 0;
+}
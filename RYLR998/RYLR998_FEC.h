@@ -0,0 +1,211 @@
+/*
+ * Copyright (c) 2023, Nuvoton Technology Corporation
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef __RYLR998_FEC_H__
+#define __RYLR998_FEC_H__
+
+#include <stdint.h>
+#include "RYLR998.h"
+
+#ifndef RYLR998_FEC_MAX_K
+#define RYLR998_FEC_MAX_K       8
+#endif
+
+#ifndef RYLR998_FEC_MAX_M
+#define RYLR998_FEC_MAX_M       4
+#endif
+
+#ifndef RYLR998_FEC_RX_BLOCKS
+#define RYLR998_FEC_RX_BLOCKS   2
+#endif
+
+#ifndef RYLR998_FEC_PEERS
+#define RYLR998_FEC_PEERS       4
+#endif
+
+/* FEC frame header: magic, block id, index (bit 7 set for a repair frame),
+ * (k - 1) << 4 | m. A data frame carries its payload as is; the coded
+ * symbol is the payload length byte followed by the payload, zero padded.
+ * A repair frame gives the real k of its block, which is less than the
+ * announced one when the block was flushed early. An uncoded payload that
+ * starts with the magic is sent behind a header with index RYLR998_FEC_PLAIN.
+ */
+#define RYLR998_FEC_MAGIC       0xA8
+#define RYLR998_FEC_HDR_SIZE    4
+#define RYLR998_FEC_REPAIR      0x80
+#define RYLR998_FEC_PLAIN       0x7F
+#define RYLR998_FEC_SYMBOL_SIZE (RYLR998_MAX_PAYLOAD - RYLR998_FEC_HDR_SIZE)
+#define RYLR998_FEC_MAX_DATA    (RYLR998_FEC_SYMBOL_SIZE - 1)
+
+/** RYLR998_FEC class.
+    Erasure coding layer on top of RYLR998::send/recv.
+
+    Every k data frames sent to a destination are followed by m repair
+    frames, computed with a systematic Cauchy Reed-Solomon code over
+    GF(256). The receiver rebuilds up to m lost data frames of a block
+    without a retransmission. Data frames are delivered as soon as they
+    arrive; rebuilt frames are delivered once their block can be decoded,
+    so frames may come out of order.
+
+    With automatic redundancy, m is picked per block from the SNR margin of
+    the latest frames received from the destination and from the loss rate
+    seen on frames received from it.
+ */
+class RYLR998_FEC {
+public:
+    RYLR998_FEC(RYLR998 &rylr, int k = 4, int m = 1);
+
+    struct fec_stats {
+        uint32_t data_sent;
+        uint32_t repair_sent;
+        uint32_t data_received;
+        uint32_t repair_received;
+        uint32_t recovered;     // data frames rebuilt from repair frames
+        uint32_t lost;          // data frames neither received nor rebuilt
+        uint32_t refused;       // frames the driver did not take at once
+    };
+
+    /**
+    * Set the block size and the number of repair frames
+    *
+    * @param k data frames per block, 1 to RYLR998_FEC_MAX_K
+    * @param m repair frames per block, 0 to RYLR998_FEC_MAX_M
+    */
+    void set_redundancy(int k, int m);
+
+    /**
+    * Pick the number of repair frames per block from link quality
+    *
+    * @param enable true to adapt m, false to use the value of set_redundancy
+    */
+    void set_auto_redundancy(bool enable);
+
+    /**
+    * Send data to appointed address as part of a block
+    *
+    * @param addr address that from 0 to 65535. 0 will send to all address.
+    * @param data point to the data
+    * @param len the data length, up to RYLR998_FEC_MAX_DATA
+    * @return false if len is too big, or if the driver did not take this
+    *         frame or a repair frame of the block it closed. A refused data
+    *         frame stays in its block and can still be rebuilt.
+    */
+    bool send(int addr, const char *data, int len);
+
+    /**
+    * Send data to appointed address without coding
+    *
+    * Peers receiving through RYLR998_FEC take any frame that starts with
+    * RYLR998_FEC_MAGIC for a coded one; here such data is escaped.
+    *
+    * @param addr address that from 0 to 65535. 0 will send to all address.
+    * @param data point to the data
+    * @param len the data length, up to RYLR998_FEC_MAX_DATA
+    * @return true if the driver took the frame
+    */
+    bool send_plain(int addr, const char *data, int len);
+
+    /**
+    * Close the current block early, sending its repair frames
+    *
+    * @return false if the driver did not take a repair frame
+    */
+    bool flush(void);
+
+    /**
+    * Get the received or rebuilt data
+    *
+    * @param addr the transmitter address
+    * @param data buffer that store the receive data
+    * @param size the data buffer size
+    * @return the real data size stored in buffer
+    */
+    int recv(int &addr, char *data, int size);
+
+    /**
+    * Return the repair frames used for the current block
+    *
+    * @return m of the current block
+    */
+    int get_redundancy(void) {
+        return _tx_m;
+    }
+
+    /**
+    * Return the coding counters
+    *
+    * @return fec_stats
+    */
+    struct fec_stats get_stats(void) {
+        return _stats;
+    }
+
+private:
+    struct _Rx_Block {
+        bool used;
+        int addr;
+        uint8_t id;
+        int k;
+        bool k_known;               // k is the real block size, not only the announced one
+        int size;                   // symbol size, known once a repair frame arrives
+        int received;               // data frames received directly
+        uint32_t age;
+        uint16_t data_mask;         // data symbols held
+        uint16_t delivered_mask;    // data symbols handed to the application
+        uint8_t repair_mask;        // repair symbols held
+        uint8_t data[RYLR998_FEC_MAX_K][RYLR998_FEC_SYMBOL_SIZE];
+        uint8_t repair[RYLR998_FEC_MAX_M][RYLR998_FEC_SYMBOL_SIZE];
+    };
+
+    struct _Peer {
+        int addr;       // -1 for a free entry
+        int snr;        // latest SNR received from the peer
+        int loss;       // received data frame loss, in 1/256
+    };
+
+    RYLR998 &_rylr;
+    int _k;
+    int _m;
+    bool _auto;
+    int _sf;
+
+    // Current transmit block
+    int _tx_addr;
+    uint8_t _tx_id;
+    int _tx_k;
+    int _tx_m;
+    int _tx_count;
+    int _tx_size;
+    uint8_t _tx_repair[RYLR998_FEC_MAX_M][RYLR998_FEC_SYMBOL_SIZE];
+
+    _Rx_Block _rx[RYLR998_FEC_RX_BLOCKS];
+    uint32_t _rx_tick;
+    _Peer _peers[RYLR998_FEC_PEERS];
+    struct fec_stats _stats;
+
+    void _tx_begin(int addr);
+    bool _tx_repairs(void);
+    int _pick_m(int addr);
+    _Peer *_peer(int addr);
+    _Rx_Block *_rx_block(int addr, uint8_t id, int k);
+    void _rx_retire(_Rx_Block *blk);
+    bool _rx_decode(_Rx_Block *blk);
+    int _rx_deliver(int &addr, char *data, int size);
+};
+
+#endif // __RYLR998_FEC_H__
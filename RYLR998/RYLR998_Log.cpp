@@ -0,0 +1,182 @@
+/*
+ * Copyright (c) 2023, Nuvoton Technology Corporation
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <stdio.h>
+#include "RYLR998_Log.h"
+
+#define RYLR998_LOG_LINE_SIZE   128
+
+RYLR998_Log::RYLR998_Log()
+    : _tail(0),
+      _head(0),
+      _dropped(0),
+      _thread(nullptr)
+{
+    for (uint32_t i = 0; i < RYLR998_LOG_RECORDS; i++)
+        _ring[i].seq = i;
+}
+
+RYLR998_Log::~RYLR998_Log()
+{
+    if (_thread != nullptr)
+    {
+        _thread->terminate();
+        delete _thread;
+    }
+}
+
+void RYLR998_Log::start(rylr998_port::Priority priority)
+{
+    if (_thread != nullptr)
+        return;
+
+    _thread = new rylr998_port::Thread(priority, 2048, nullptr, "rylr998_log");
+    _thread->start(rylr998_port::callback(this, &RYLR998_Log::_run));
+}
+
+RYLR998_Log::_Record *RYLR998_Log::_reserve(uint32_t &pos)
+{
+    // Bounded multi-producer ring: a slot is free for position pos when
+    // its sequence equals pos, and holds a record when it equals pos + 1
+    uint32_t tail = core_util_atomic_load_u32(&_tail);
+
+    while (true)
+    {
+        _Record *r = &_ring[tail & (RYLR998_LOG_RECORDS - 1)];
+        int32_t diff = (int32_t)(core_util_atomic_load_u32(&r->seq) - tail);
+
+        if (diff == 0)
+        {
+            if (core_util_atomic_cas_u32(&_tail, &tail, tail + 1))
+            {
+                pos = tail;
+                return r;
+            }
+        }
+        else if (diff < 0)
+        {
+            core_util_atomic_incr_u32(&_dropped, 1);
+            return nullptr;
+        }
+        else
+        {
+            tail = core_util_atomic_load_u32(&_tail);
+        }
+    }
+}
+
+int RYLR998_Log::drain(void)
+{
+    int n = 0;
+
+    while (true)
+    {
+        _Record *r = &_ring[_head & (RYLR998_LOG_RECORDS - 1)];
+        if (core_util_atomic_load_u32(&r->seq) != _head + 1)
+            break;
+
+        _print(r);
+
+        core_util_atomic_store_u32(&r->seq, _head + RYLR998_LOG_RECORDS);
+        _head++;
+        n++;
+    }
+
+    return n;
+}
+
+void RYLR998_Log::_print(_Record *r)
+{
+    char line[RYLR998_LOG_LINE_SIZE];
+    int o = snprintf(line, sizeof(line), "[%lu] ", (unsigned long)r->time);
+    const char *p = r->fmt;
+    int arg = 0;
+
+    while (*p != '\0' && o < (int)sizeof(line) - 1)
+    {
+        if (*p != '%' || p[1] == '%')
+        {
+            line[o++] = *p;
+            p += (*p == '%') ? 2 : 1;
+            continue;
+        }
+
+        // Copy the conversion spec without its length modifier, the
+        // argument width is fixed by the record
+        char spec[16];
+        int s = 0;
+        const char *start = p;
+
+        spec[s++] = *p++;
+        while (*p != '\0' && strchr("-+ #0123456789.", *p) != NULL && s < (int)sizeof(spec) - 2)
+            spec[s++] = *p++;
+        while (*p != '\0' && strchr("hlLqjzt", *p) != NULL)
+            p++;
+
+        char conv = *p;
+        if (conv == '\0' || arg >= r->nargs)
+        {
+            // Not enough arguments recorded, keep the text
+            while (start < p && o < (int)sizeof(line) - 1)
+                line[o++] = *start++;
+            continue;
+        }
+        p++;
+
+        spec[s++] = conv;
+        spec[s] = '\0';
+
+        int room = sizeof(line) - o;
+        int n;
+        const _Arg &a = r->args[arg++];
+
+        switch (conv)
+        {
+        case 'd': case 'i': case 'c':
+            n = snprintf(line + o, room, spec, (int)a.i);
+            break;
+        case 'u': case 'x': case 'X': case 'o':
+            n = snprintf(line + o, room, spec, (unsigned int)a.i);
+            break;
+        case 'f': case 'F': case 'e': case 'E': case 'g': case 'G':
+            n = snprintf(line + o, room, spec, (double)a.f);
+            break;
+        case 's':
+            n = snprintf(line + o, room, spec, &r->str[a.str]);
+            break;
+        default:
+            n = 0;
+            break;
+        }
+
+        if (n > 0)
+            o += (n < room) ? n : room - 1;
+    }
+
+    line[o] = '\0';
+    fputs(line, stdout);
+}
+
+void RYLR998_Log::_run(void)
+{
+    while (true)
+    {
+        drain();
+        rylr998_port::sleep_for(RYLR998_LOG_PERIOD);
+    }
+}
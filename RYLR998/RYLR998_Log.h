@@ -0,0 +1,183 @@
+/*
+ * Copyright (c) 2023, Nuvoton Technology Corporation
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef __RYLR998_LOG_H__
+#define __RYLR998_LOG_H__
+
+#include <stdint.h>
+#include <string.h>
+#include <type_traits>
+
+#include "RYLR998_Port.h"
+
+#ifndef RYLR998_LOG_RECORDS
+#define RYLR998_LOG_RECORDS     32      // ring size, a power of two
+#endif
+
+#ifndef RYLR998_LOG_MAX_ARGS
+#define RYLR998_LOG_MAX_ARGS    6
+#endif
+
+#ifndef RYLR998_LOG_STR_SIZE
+#define RYLR998_LOG_STR_SIZE    32      // bytes for copied string arguments
+#endif
+
+#ifndef RYLR998_LOG_PERIOD
+#define RYLR998_LOG_PERIOD      std::chrono::milliseconds(50)
+#endif
+
+/** RYLR998_Log class.
+    Deferred printf style logging.
+
+    log() only stores the format pointer, a timestamp and the raw arguments
+    into a lock-free ring, so it is cheap enough for the RX path. The
+    formatting and the stdio write happen later in drain(), normally from
+    the low priority thread started by start(). Integer, float, char and
+    string arguments are supported; strings are copied, up to
+    RYLR998_LOG_STR_SIZE bytes per record. When the ring is full the record
+    is dropped and counted.
+
+    @code
+    RYLR998_Log rx_log;
+    rx_log.start();
+    rx_log.log("Recv Addr(%d) RSSI(%d) \"%s\"\n", addr, rssi, buf);
+    @endcode
+ */
+class RYLR998_Log {
+public:
+    RYLR998_Log();
+    ~RYLR998_Log();
+
+    /**
+    * Record a message
+    *
+    * @param fmt the printf format, must be a string literal or otherwise outlive the record
+    * @param args up to RYLR998_LOG_MAX_ARGS arguments
+    */
+    template <typename... Args>
+    void log(const char *fmt, Args... args) {
+        static_assert(sizeof...(Args) <= RYLR998_LOG_MAX_ARGS, "too many log arguments");
+
+        uint32_t pos;
+        _Record *r = _reserve(pos);
+        if (r == nullptr)
+            return;
+
+        r->fmt = fmt;
+        r->time = rylr998_port::now_ms();
+        r->nargs = sizeof...(Args);
+        r->str_used = 0;
+        r->str[RYLR998_LOG_STR_SIZE - 1] = '\0';
+        _pack(r, 0, args...);
+
+        core_util_atomic_store_u32(&r->seq, pos + 1);
+    }
+
+    /**
+    * Start the thread that drains the ring
+    *
+    * @param priority priority of the drain thread
+    */
+    void start(rylr998_port::Priority priority = rylr998_port::PRIORITY_LOW);
+
+    /**
+    * Format and print every pending record
+    *
+    * @return the number of records printed
+    */
+    int drain(void);
+
+    /**
+    * Return the number of records dropped because the ring was full
+    *
+    * @return the drop count
+    */
+    uint32_t get_dropped(void) {
+        return core_util_atomic_load_u32(&_dropped);
+    }
+
+private:
+    union _Arg {
+        int32_t i;
+        float f;
+        uint16_t str;   // offset into the record string area
+    };
+
+    struct _Record {
+        volatile uint32_t seq;
+        const char *fmt;
+        uint32_t time;
+        uint8_t nargs;
+        uint16_t str_used;
+        _Arg args[RYLR998_LOG_MAX_ARGS];
+        char str[RYLR998_LOG_STR_SIZE];
+    };
+
+    _Record _ring[RYLR998_LOG_RECORDS];
+    volatile uint32_t _tail;    // next position to reserve, shared by producers
+    uint32_t _head;             // next position to drain, owned by the consumer
+    volatile uint32_t _dropped;
+    rylr998_port::Thread *_thread;
+
+    _Record *_reserve(uint32_t &pos);
+    void _print(_Record *r);
+    void _run(void);
+
+    static void _pack(_Record *, int) {
+    }
+
+    template <typename T, typename... Rest>
+    static void _pack(_Record *r, int i, T v, Rest... rest) {
+        _put(r, i, v);
+        _pack(r, i + 1, rest...);
+    }
+
+    template <typename T>
+    static typename std::enable_if<std::is_integral<T>::value || std::is_enum<T>::value>::type
+    _put(_Record *r, int i, T v) {
+        r->args[i].i = (int32_t)v;
+    }
+
+    template <typename T>
+    static typename std::enable_if<std::is_floating_point<T>::value>::type
+    _put(_Record *r, int i, T v) {
+        r->args[i].f = (float)v;
+    }
+
+    static void _put(_Record *r, int i, const char *s) {
+        int room = RYLR998_LOG_STR_SIZE - 1 - r->str_used;
+        int n = 0;
+
+        // Out of room, point at the terminator of the area
+        if (room <= 0) {
+            r->args[i].str = RYLR998_LOG_STR_SIZE - 1;
+            return;
+        }
+
+        if (s != nullptr) {
+            while (n < room && s[n] != '\0')
+                n++;
+            memcpy(r->str + r->str_used, s, n);
+        }
+        r->args[i].str = r->str_used;
+        r->str[r->str_used + n] = '\0';
+        r->str_used += n + 1;
+    }
+};
+
+#endif // __RYLR998_LOG_H__
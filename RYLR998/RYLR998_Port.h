@@ -0,0 +1,99 @@
+/*
+ * Copyright (c) 2023, Nuvoton Technology Corporation
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef __RYLR998_PORT_H__
+#define __RYLR998_PORT_H__
+
+/* Transport and OS port of the driver.
+ *
+ * Everything the driver needs from the platform goes through the
+ * rylr998_port namespace:
+ *   Serial, Parser    the UART and an ATCmdParser compatible parser
+ *   ResetPin          the module NRST line
+ *   Mutex, Thread     recursive mutex, a thread with start and terminate
+ *   callback()        binds a member function for the parser and threads
+ *   now_ms()          a monotonic millisecond clock
+ *   now_us()          a free running microsecond clock
+ *   sleep_for()       blocks the calling thread
+ * plus the core_util_atomic_*_u32 functions of mbed.
+ *
+ * Mbed OS builds use the mbed classes as they are. Other builds use the
+ * POSIX port in posix/, termios for the UART and pthreads.
+ */
+
+#include <stdint.h>
+#include <string.h>
+#include <chrono>
+
+#if defined(__MBED__)
+#define RYLR998_PORT_MBED       1
+#else
+#define RYLR998_PORT_POSIX      1
+#endif
+
+#if RYLR998_PORT_MBED
+
+#include "drivers/BufferedSerial.h"
+#include "drivers/DigitalOut.h"
+#include "drivers/HighResClock.h"
+#include "PinNames.h"
+#include "platform/ATCmdParser.h"
+#include "platform/Callback.h"
+#include "platform/mbed_atomic.h"
+#include "rtos/Kernel.h"
+#include "rtos/Mutex.h"
+#include "rtos/ThisThread.h"
+#include "rtos/Thread.h"
+
+namespace rylr998_port {
+
+typedef mbed::BufferedSerial Serial;
+typedef mbed::ATCmdParser Parser;
+typedef mbed::DigitalOut ResetPin;
+typedef rtos::Mutex Mutex;
+typedef rtos::Thread Thread;
+typedef osPriority Priority;
+
+const Priority PRIORITY_LOW = osPriorityLow;
+
+using mbed::callback;
+
+inline uint32_t now_ms(void)
+{
+    return std::chrono::duration_cast<std::chrono::milliseconds>(rtos::Kernel::Clock::now().time_since_epoch()).count();
+}
+
+inline uint32_t now_us(void)
+{
+    return std::chrono::duration_cast<std::chrono::microseconds>(mbed::HighResClock::now().time_since_epoch()).count();
+}
+
+inline void sleep_for(std::chrono::milliseconds t)
+{
+    rtos::ThisThread::sleep_for(t);
+}
+
+} // namespace rylr998_port
+
+#else
+
+#include "posix/RYLR998_Posix.h"
+
+#endif
+
+#endif // __RYLR998_PORT_H__
@@ -0,0 +1,346 @@
+/*
+ * Copyright (c) 2023, Nuvoton Technology Corporation
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "RYLR998_Relay.h"
+
+RYLR998_Relay::RYLR998_Relay(RYLR998 &rylr, bool relay)
+    : _rylr(rylr),
+      _relay(relay),
+      _ttl(RYLR998_RELAY_TTL),
+      _my_addr(-1),
+      _tx_id(0),
+      _tx_id_set(false)
+{
+    for (int i = 0; i < RYLR998_RELAY_ROUTES; i++)
+        _routes[i].dest = -1;
+
+    for (int i = 0; i < RYLR998_RELAY_QUEUE; i++)
+        _queue[i].used = false;
+
+    memset(&_stats, 0, sizeof(_stats));
+}
+
+void RYLR998_Relay::set_ttl(int ttl)
+{
+    if (ttl < 1)
+        ttl = 1;
+    if (ttl > 15)
+        ttl = 15;
+    _ttl = ttl;
+}
+
+bool RYLR998_Relay::send(int addr, const char *data, int len)
+{
+    uint8_t frame[RYLR998_MAX_PAYLOAD];
+
+    if (data == NULL || len < 0 || len > RYLR998_RELAY_MAX_DATA || addr < 0 || addr > 0xFFFF)
+        return false;
+
+    int me = _addr();
+    if (me < 0)
+        return false;
+
+    // Start at a random ID, so after a restart peers do not take the new
+    // frames for copies of the old ones
+    if (!_tx_id_set)
+    {
+        _tx_id = _rylr.get_random() & 0xFFFF;
+        _tx_id_set = true;
+    }
+
+    uint16_t id = _tx_id++;
+    uint32_t now = _now_ms();
+
+    frame[0] = RYLR998_RELAY_MAGIC;
+    frame[1] = _ttl;
+    frame[2] = me & 0xFF;
+    frame[3] = (me >> 8) & 0xFF;
+    frame[4] = addr & 0xFF;
+    frame[5] = (addr >> 8) & 0xFF;
+    frame[6] = id & 0xFF;
+    frame[7] = (id >> 8) & 0xFF;
+    memcpy(frame + RYLR998_RELAY_HDR_SIZE, data, len);
+
+    // Copies relayed back to us are dropped as duplicates
+    _dup.seen(me, id, now);
+
+    _Route *r = (addr != 0) ? _route(addr, now) : NULL;
+    int link_dst = (r != NULL) ? r->next_hop : 0;
+
+    if (!_rylr.send(link_dst, (const char *)frame, RYLR998_RELAY_HDR_SIZE + len))
+        return false;
+
+    _stats.originated++;
+    return true;
+}
+
+int RYLR998_Relay::recv(int &addr, char *data, int size)
+{
+    uint8_t buf[RYLR998_MAX_PAYLOAD + 1];
+
+    _service(_now_ms());
+
+    while (true)
+    {
+        int from;
+        int len = _rylr.recv(from, (char *)buf, RYLR998_MAX_PAYLOAD);
+        if (len <= 0)
+            return 0;
+
+        if (len < RYLR998_RELAY_HDR_SIZE || buf[0] != RYLR998_RELAY_MAGIC)
+        {
+            // Plain single hop frame
+            if (len > size)
+                len = size;
+            memcpy(data, buf, len);
+            data[len] = '\0';
+            addr = from;
+            return len;
+        }
+
+        uint32_t now = _now_ms();
+        int me = _addr();
+        int hops = buf[1] >> 4;
+        int ttl = buf[1] & 0x0F;
+        uint16_t origin = buf[2] | (buf[3] << 8);
+        uint16_t dest = buf[4] | (buf[5] << 8);
+        uint16_t id = buf[6] | (buf[7] << 8);
+        int rssi = _rylr.get_rssi();
+
+        // The link source is a neighbour, the origin is behind it
+        _learn(from, from, 1, rssi, now);
+        if (origin != from && origin != me)
+            _learn(origin, from, hops + 1, rssi, now);
+
+        if (_dup.seen(origin, id, now))
+        {
+            _stats.duplicates++;
+            _heard_again(origin, id);
+            _service(now);
+            continue;
+        }
+
+        if (_relay && dest != me && origin != me)
+        {
+            if (ttl <= 1)
+            {
+                _stats.expired++;
+            }
+            else
+            {
+                // Unicast on a known route, unless it points back to the sender
+                _Route *r = (dest != 0) ? _route(dest, now) : NULL;
+                int link_dst = (r != NULL && r->next_hop != from) ? r->next_hop : 0;
+
+                buf[1] = (hops + 1) << 4 | (ttl - 1);
+                _enqueue(link_dst, buf, len, now);
+            }
+        }
+
+        _service(now);
+
+        if (dest != me && dest != 0)
+            continue;
+
+        len -= RYLR998_RELAY_HDR_SIZE;
+        if (len > size)
+            len = size;
+        memcpy(data, buf + RYLR998_RELAY_HDR_SIZE, len);
+        data[len] = '\0';
+        addr = origin;
+        _stats.delivered++;
+        return len;
+    }
+}
+
+int RYLR998_Relay::get_route(int addr, int *hops)
+{
+    _Route *r = _route(addr, _now_ms());
+
+    if (r == NULL)
+        return -1;
+
+    if (hops != NULL)
+        *hops = r->hops;
+    return r->next_hop;
+}
+
+struct RYLR998_Relay::relay_stats RYLR998_Relay::get_stats(void)
+{
+    struct relay_stats stats = _stats;
+    uint32_t now = _now_ms();
+
+    stats.routes = 0;
+    for (int i = 0; i < RYLR998_RELAY_ROUTES; i++)
+    {
+        if (_routes[i].dest >= 0 && now - _routes[i].seen < RYLR998_RELAY_ROUTE_TIMEOUT_MS)
+            stats.routes++;
+    }
+
+    return stats;
+}
+
+uint32_t RYLR998_Relay::_now_ms(void)
+{
+    return rylr998_port::now_ms();
+}
+
+int RYLR998_Relay::_addr(void)
+{
+    if (_my_addr < 0)
+        _my_addr = _rylr.get_address();
+
+    return _my_addr;
+}
+
+RYLR998_Relay::_Route *RYLR998_Relay::_route(int dest, uint32_t now)
+{
+    for (int i = 0; i < RYLR998_RELAY_ROUTES; i++)
+    {
+        _Route *r = &_routes[i];
+        if (r->dest == dest)
+            return (now - r->seen < RYLR998_RELAY_ROUTE_TIMEOUT_MS) ? r : NULL;
+    }
+
+    return NULL;
+}
+
+void RYLR998_Relay::_learn(int dest, int via, int hops, int rssi, uint32_t now)
+{
+    _Route *r = NULL;
+    _Route *victim = NULL;
+
+    for (int i = 0; i < RYLR998_RELAY_ROUTES; i++)
+    {
+        _Route *e = &_routes[i];
+        if (e->dest == dest)
+        {
+            r = e;
+            break;
+        }
+
+        // A free entry, else the one heard from least recently
+        if (victim == NULL || (victim->dest >= 0 && (e->dest < 0 || now - e->seen > now - victim->seen)))
+            victim = e;
+    }
+
+    if (r != NULL)
+    {
+        bool stale = now - r->seen >= RYLR998_RELAY_ROUTE_TIMEOUT_MS;
+
+        // The current next hop always refreshes the route; another one has
+        // to be shorter, or as short and clearly stronger
+        if (!stale && via != r->next_hop && hops > r->hops)
+            return;
+        if (!stale && via != r->next_hop && hops == r->hops && rssi < r->rssi + RYLR998_RELAY_RSSI_MARGIN)
+            return;
+    }
+    else
+    {
+        r = victim;
+        r->dest = dest;
+    }
+
+    r->next_hop = via;
+    r->hops = hops;
+    r->rssi = rssi;
+    r->seen = now;
+}
+
+void RYLR998_Relay::_enqueue(int link_dst, const uint8_t *frame, int len, uint32_t now)
+{
+    _Forward *f = NULL;
+
+    for (int i = 0; i < RYLR998_RELAY_QUEUE; i++)
+    {
+        if (!_queue[i].used)
+        {
+            f = &_queue[i];
+            break;
+        }
+    }
+
+    if (f == NULL)
+    {
+        _stats.queue_full++;
+        return;
+    }
+
+    // Wait a random number of frame times, so the sender can finish its
+    // burst and relays that heard the same flood spread out
+    int toa = _rylr.get_time_on_air_us(len + RYLR998_LINK_HDR_SIZE + RYLR998_LINK_SEQ_SIZE);
+    int slot_ms = (toa > 0) ? (toa + 999) / 1000 : RYLR998_RELAY_SLOT_MS;
+
+    f->used = true;
+    f->rx_time = now;
+    f->due = now + slot_ms * (1 + _rylr.get_random() % RYLR998_RELAY_BACKOFF_SLOTS);
+    f->link_dst = link_dst;
+    f->origin = frame[2] | (frame[3] << 8);
+    f->id = frame[6] | (frame[7] << 8);
+    f->copies = 0;
+    f->len = len;
+    memcpy(f->frame, frame, len);
+}
+
+void RYLR998_Relay::_heard_again(uint16_t origin, uint16_t id)
+{
+    for (int i = 0; i < RYLR998_RELAY_QUEUE; i++)
+    {
+        _Forward *f = &_queue[i];
+        if (!f->used || f->link_dst != 0 || f->origin != origin || f->id != id)
+            continue;
+
+        if (++f->copies >= RYLR998_RELAY_SUPPRESS)
+        {
+            f->used = false;
+            _stats.suppressed++;
+        }
+        return;
+    }
+}
+
+void RYLR998_Relay::_service(uint32_t now)
+{
+    while (true)
+    {
+        // Earliest due frame first
+        _Forward *f = NULL;
+        for (int i = 0; i < RYLR998_RELAY_QUEUE; i++)
+        {
+            _Forward *e = &_queue[i];
+            if (e->used && (int32_t)(now - e->due) >= 0
+                && (f == NULL || (int32_t)(e->due - f->due) < 0))
+                f = e;
+        }
+
+        if (f == NULL)
+            return;
+
+        f->used = false;
+        if (!_rylr.send(f->link_dst, (const char *)f->frame, f->len))
+            continue;
+
+        uint32_t latency = now - f->rx_time;
+        _stats.forwarded++;
+        if (f->link_dst == 0)
+            _stats.flooded++;
+        _stats.hop_latency_last_ms = latency;
+        if (latency > _stats.hop_latency_max_ms)
+            _stats.hop_latency_max_ms = latency;
+    }
+}
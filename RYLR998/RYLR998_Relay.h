@@ -0,0 +1,198 @@
+/*
+ * Copyright (c) 2023, Nuvoton Technology Corporation
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef __RYLR998_RELAY_H__
+#define __RYLR998_RELAY_H__
+
+#include <stdint.h>
+#include "RYLR998.h"
+#include "RYLR998_DupCache.h"
+
+#ifndef RYLR998_RELAY_ROUTES
+#define RYLR998_RELAY_ROUTES        16
+#endif
+
+#ifndef RYLR998_RELAY_QUEUE
+#define RYLR998_RELAY_QUEUE         8       // frames waiting to be forwarded
+#endif
+
+#ifndef RYLR998_RELAY_TTL
+#define RYLR998_RELAY_TTL           4       // hops, up to 15
+#endif
+
+#ifndef RYLR998_RELAY_ROUTE_TIMEOUT_MS
+#define RYLR998_RELAY_ROUTE_TIMEOUT_MS  300000
+#endif
+
+#ifndef RYLR998_RELAY_RSSI_MARGIN
+#define RYLR998_RELAY_RSSI_MARGIN   6       // dB better before an equal hop route is replaced
+#endif
+
+#ifndef RYLR998_RELAY_SLOT_MS
+#define RYLR998_RELAY_SLOT_MS       20      // backoff slot when the time on air is unknown
+#endif
+
+#ifndef RYLR998_RELAY_BACKOFF_SLOTS
+#define RYLR998_RELAY_BACKOFF_SLOTS 4
+#endif
+
+#ifndef RYLR998_RELAY_SUPPRESS
+#define RYLR998_RELAY_SUPPRESS      2       // copies heard that cancel a pending flood
+#endif
+
+/* Relay frame header: magic, hops << 4 | ttl, origin (u16), destination
+ * (u16, 0 for all), message ID (u16). Little endian.
+ */
+#define RYLR998_RELAY_MAGIC         0xAA
+#define RYLR998_RELAY_HDR_SIZE      8
+#define RYLR998_RELAY_MAX_DATA      (RYLR998_MAX_PAYLOAD - RYLR998_RELAY_HDR_SIZE)
+
+/** RYLR998_Relay class.
+    Multi-hop store-and-forward on top of RYLR998::send/recv.
+
+    Every node learns routes from the relay frames it hears: the link
+    source of a frame is a one hop neighbour, and the frame's origin is
+    reachable through that neighbour with one hop more than the frame has
+    travelled. Fewer hops win, then a stronger RSSI on the first hop.
+
+    A frame with a known route goes hop by hop as unicast; otherwise it is
+    flooded as a broadcast, limited by its TTL. Nodes with the relay role
+    keep frames for others in a bounded queue and forward them after a
+    random backoff of a few times the frame's time on air, so the forward
+    does not land on top of the sender's next frame or of other relays. A
+    pending flood is dropped when enough other relays were heard repeating
+    it. Copies are recognised by origin and message ID and delivered once.
+
+    All nodes must call recv() regularly: it forwards due frames and
+    returns the application data addressed to this node.
+ */
+class RYLR998_Relay {
+public:
+    /**
+    * @param rylr the driver
+    * @param relay true to forward frames for other nodes
+    */
+    RYLR998_Relay(RYLR998 &rylr, bool relay = true);
+
+    struct relay_stats {
+        uint32_t originated;        // frames sent by this node
+        uint32_t delivered;         // frames for this node handed to the application
+        uint32_t forwarded;         // frames sent on for other nodes
+        uint32_t flooded;           // of which as broadcast, no route known
+        uint32_t duplicates;        // copies dropped
+        uint32_t expired;           // TTL ran out
+        uint32_t queue_full;        // frames dropped on a full forward queue
+        uint32_t suppressed;        // floods cancelled, repeated by others
+        uint32_t hop_latency_last_ms;   // receive to forward
+        uint32_t hop_latency_max_ms;
+        int routes;                 // routes in the table
+    };
+
+    /**
+    * Turn forwarding for other nodes on or off
+    */
+    void set_relay(bool enable) {
+        _relay = enable;
+    }
+
+    /**
+    * Set the hop limit of frames sent by this node
+    *
+    * @param ttl hops, 1 to 15
+    */
+    void set_ttl(int ttl);
+
+    /**
+    * Send data to a node, over as many hops as needed
+    *
+    * @param addr the final destination, 0 for all nodes
+    * @param data point to the data
+    * @param len the data length, up to RYLR998_RELAY_MAX_DATA
+    * @return false if len is too big or the driver did not take the frame
+    */
+    bool send(int addr, const char *data, int len);
+
+    /**
+    * Forward due frames and get received data
+    *
+    * @param addr the node that originated the data
+    * @param data buffer that store the receive data
+    * @param size the data buffer size
+    * @return the real data size stored in buffer, 0 if none
+    */
+    int recv(int &addr, char *data, int size);
+
+    /**
+    * Return the next hop towards a node
+    *
+    * @param addr the destination
+    * @param hops set to the number of hops, if known
+    * @return the next hop address, -1 if no route is known
+    */
+    int get_route(int addr, int *hops = NULL);
+
+    /**
+    * Return the relay counters
+    *
+    * @return relay_stats
+    */
+    struct relay_stats get_stats(void);
+
+private:
+    struct _Route {
+        int dest;           // -1 for a free entry
+        int next_hop;
+        int hops;
+        int rssi;           // of the first hop
+        uint32_t seen;
+    };
+
+    struct _Forward {
+        bool used;
+        uint32_t due;
+        uint32_t rx_time;
+        int link_dst;       // 0 for a flood
+        uint16_t origin;
+        uint16_t id;
+        int copies;
+        int len;
+        uint8_t frame[RYLR998_MAX_PAYLOAD];
+    };
+
+    RYLR998 &_rylr;
+    bool _relay;
+    int _ttl;
+    int _my_addr;
+    uint16_t _tx_id;
+    bool _tx_id_set;        // _tx_id drawn on the first send
+    RYLR998_DupCache _dup;
+
+    _Route _routes[RYLR998_RELAY_ROUTES];
+    _Forward _queue[RYLR998_RELAY_QUEUE];
+    struct relay_stats _stats;
+
+    uint32_t _now_ms(void);
+    int _addr(void);
+    _Route *_route(int dest, uint32_t now);
+    void _learn(int dest, int via, int hops, int rssi, uint32_t now);
+    void _service(uint32_t now);
+    void _enqueue(int link_dst, const uint8_t *frame, int len, uint32_t now);
+    void _heard_again(uint16_t origin, uint16_t id);
+};
+
+#endif // __RYLR998_RELAY_H__
@@ -0,0 +1,490 @@
+/*
+ * Copyright (c) 2023, Nuvoton Technology Corporation
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef __RYLR998_SCHEMA_H__
+#define __RYLR998_SCHEMA_H__
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <type_traits>
+
+#ifndef RYLR998_MAX_PAYLOAD
+#define RYLR998_MAX_PAYLOAD     240
+#endif
+
+#ifndef RYLR998_SCHEMA_KEYFRAME_INTERVAL
+#define RYLR998_SCHEMA_KEYFRAME_INTERVAL    16
+#endif
+
+/**
+ * Field encodings supported by RYLR998_Schema
+ */
+enum RYLR998_FieldType : uint8_t {
+    RYLR998_FIELD_UVARINT = 0,  // unsigned LEB128 varint
+    RYLR998_FIELD_SVARINT,      // zigzag signed varint
+    RYLR998_FIELD_BITS          // fixed width, bit packed
+};
+
+/**
+ * Field descriptor. Use the RYLR998_UVARINT / RYLR998_SVARINT / RYLR998_BITS
+ * macros to build these from a struct member.
+ */
+struct RYLR998_Field {
+    uint16_t offset;    // offsetof() the member
+    uint8_t size;       // sizeof() the member, 1, 2 or 4
+    uint8_t type;       // RYLR998_FieldType
+    uint8_t bits;       // width for RYLR998_FIELD_BITS, 1 to 32
+    bool is_signed;     // member is a signed integer
+};
+
+#define _RYLR998_FIELD(T, m, type, bits) \
+    RYLR998_Field { offsetof(T, m), sizeof(T::m), (type), (bits), std::is_signed<decltype(T::m)>::value }
+
+#define RYLR998_UVARINT(T, m)       _RYLR998_FIELD(T, m, RYLR998_FIELD_UVARINT, 0)
+#define RYLR998_SVARINT(T, m)       _RYLR998_FIELD(T, m, RYLR998_FIELD_SVARINT, 0)
+#define RYLR998_BITS(T, m, bits)    _RYLR998_FIELD(T, m, RYLR998_FIELD_BITS, bits)
+
+/** _Bit_Writer class.
+    LSB first bit stream writer over a caller supplied buffer
+ */
+class _Bit_Writer {
+private:
+    uint8_t *buf;
+    int size;
+    int pos;    // in bits
+
+public:
+    _Bit_Writer(uint8_t *buf, int size) : buf(buf), size(size), pos(0) {}
+
+    bool put(uint32_t value, int bits) {
+        if (pos + bits > size * 8)
+            return false;
+
+        for (int i = 0; i < bits; i++) {
+            int byte = pos >> 3;
+            int shift = pos & 7;
+            if (shift == 0)
+                buf[byte] = 0;
+            buf[byte] |= ((value >> i) & 1) << shift;
+            pos++;
+        }
+        return true;
+    }
+
+    bool put_varint(uint64_t value) {
+        do {
+            uint32_t group = value & 0x7F;
+            value >>= 7;
+            if (value)
+                group |= 0x80;
+            if (!put(group, 8))
+                return false;
+        } while (value);
+        return true;
+    }
+
+    int length() {
+        return (pos + 7) >> 3;
+    }
+};
+
+/** _Bit_Reader class.
+    LSB first bit stream reader, counterpart of _Bit_Writer
+ */
+class _Bit_Reader {
+private:
+    const uint8_t *buf;
+    int size;
+    int pos;    // in bits
+
+public:
+    _Bit_Reader(const uint8_t *buf, int size) : buf(buf), size(size), pos(0) {}
+
+    bool get(uint32_t &value, int bits) {
+        if (pos + bits > size * 8)
+            return false;
+
+        value = 0;
+        for (int i = 0; i < bits; i++) {
+            value |= (uint32_t)((buf[pos >> 3] >> (pos & 7)) & 1) << i;
+            pos++;
+        }
+        return true;
+    }
+
+    bool get_varint(uint64_t &value) {
+        value = 0;
+        for (int shift = 0; shift < 64; shift += 7) {
+            uint32_t group;
+            if (!get(group, 8))
+                return false;
+            value |= (uint64_t)(group & 0x7F) << shift;
+            if ((group & 0x80) == 0)
+                return true;
+        }
+        return false;
+    }
+};
+
+/** RYLR998_Schema class.
+    Encodes the fields of T into a compact binary frame.
+
+    The frame is a header byte (bit 7 set for a delta frame, bits 0-6 the
+    frame sequence) followed by the fields as one LSB first bit stream.
+    In a delta frame varint fields carry the zigzag difference against
+    the previous frame instead of the value; bit fields are always sent
+    as is.
+
+    Schemas are meant to be declared constexpr, so max_size() can be
+    checked against the 240 byte frame limit at compile time:
+
+    @code
+    struct reading { uint16_t id; int16_t temp; uint8_t flags; };
+    static constexpr RYLR998_Field reading_fields[] = {
+        RYLR998_UVARINT(reading, id),
+        RYLR998_SVARINT(reading, temp),
+        RYLR998_BITS(reading, flags, 3),
+    };
+    static constexpr RYLR998_Schema<reading> reading_schema(reading_fields);
+    static_assert(reading_schema.valid(), "bad schema");
+    static_assert(reading_schema.max_size() <= RYLR998_MAX_PAYLOAD, "too big");
+    @endcode
+ */
+template <typename T>
+class RYLR998_Schema {
+public:
+    template <size_t N>
+    constexpr RYLR998_Schema(const RYLR998_Field (&fields)[N]) : _fields(fields), _count(N) {}
+
+    /**
+    * Check every field has a supported size and width
+    *
+    * @return true if the schema can be used
+    */
+    constexpr bool valid() const {
+        return _valid_from(0);
+    }
+
+    /**
+    * Return the worst case encoded size, header included
+    *
+    * @return the frame size in bytes
+    */
+    constexpr int max_size() const {
+        return 1 + (int)((_bits_from(0) + 7) / 8);
+    }
+
+    /**
+    * Encode a value
+    *
+    * @param value the value to encode
+    * @param seq the frame sequence, 0 to 127
+    * @param prev the previous value for a delta frame, or nullptr for a full frame
+    * @param buf buffer that stores the frame
+    * @param size the buffer size
+    * @return the frame length, or -1 if the buffer is too small
+    */
+    int encode(const T &value, uint8_t seq, const T *prev, uint8_t *buf, int size) const {
+        if (size < 1)
+            return -1;
+
+        buf[0] = (seq & 0x7F) | ((prev != nullptr) ? 0x80 : 0);
+
+        _Bit_Writer w(buf + 1, size - 1);
+        for (size_t i = 0; i < _count; i++) {
+            const RYLR998_Field &f = _fields[i];
+            int64_t v = _load(value, f);
+            bool done;
+
+            if (f.type == RYLR998_FIELD_BITS) {
+                done = w.put((uint32_t)v, f.bits);
+            } else if (prev != nullptr) {
+                done = w.put_varint(_zigzag(v - _load(*prev, f)));
+            } else if (f.type == RYLR998_FIELD_SVARINT) {
+                done = w.put_varint(_zigzag(v));
+            } else {
+                done = w.put_varint((uint64_t)v);
+            }
+
+            if (!done)
+                return -1;
+        }
+
+        return 1 + w.length();
+    }
+
+    /**
+    * Decode a frame
+    *
+    * @param buf the frame
+    * @param len the frame length
+    * @param prev the previous value, required if the frame is a delta frame
+    * @param value the decoded value
+    * @return true only if the frame decodes completely
+    */
+    bool decode(const uint8_t *buf, int len, const T *prev, T &value) const {
+        if (len < 1)
+            return false;
+
+        bool delta = is_delta(buf[0]);
+        if (delta && prev == nullptr)
+            return false;
+
+        _Bit_Reader r(buf + 1, len - 1);
+        for (size_t i = 0; i < _count; i++) {
+            const RYLR998_Field &f = _fields[i];
+            uint64_t raw;
+            int64_t v;
+
+            if (f.type == RYLR998_FIELD_BITS) {
+                uint32_t bits;
+                if (!r.get(bits, f.bits))
+                    return false;
+                v = bits;
+                if (f.is_signed && f.bits < 32 && (bits >> (f.bits - 1)) & 1)
+                    v -= (int64_t)1 << f.bits;
+            } else {
+                if (!r.get_varint(raw))
+                    return false;
+                if (delta)
+                    v = _load(*prev, f) + _unzigzag(raw);
+                else if (f.type == RYLR998_FIELD_SVARINT)
+                    v = _unzigzag(raw);
+                else
+                    v = (int64_t)raw;
+            }
+
+            _store(value, f, v);
+        }
+
+        return true;
+    }
+
+    static bool is_delta(uint8_t header) {
+        return (header & 0x80) != 0;
+    }
+
+    static uint8_t sequence(uint8_t header) {
+        return header & 0x7F;
+    }
+
+private:
+    const RYLR998_Field *_fields;
+    size_t _count;
+
+    constexpr bool _valid_from(size_t i) const {
+        return (i >= _count) ? true :
+               ((_fields[i].size == 1 || _fields[i].size == 2 || _fields[i].size == 4) &&
+                (_fields[i].type != RYLR998_FIELD_BITS ||
+                 (_fields[i].bits >= 1 && _fields[i].bits <= 32 && _fields[i].bits <= _fields[i].size * 8)) &&
+                _valid_from(i + 1));
+    }
+
+    // A delta of two n bit values needs n + 1 bits once zigzagged
+    constexpr size_t _bits_from(size_t i) const {
+        return (i >= _count) ? 0 :
+               ((_fields[i].type == RYLR998_FIELD_BITS) ? _fields[i].bits
+                                                        : ((_fields[i].size * 8 + 1 + 6) / 7) * 8) +
+               _bits_from(i + 1);
+    }
+
+    static uint64_t _zigzag(int64_t v) {
+        return ((uint64_t)v << 1) ^ (uint64_t)(v >> 63);
+    }
+
+    static int64_t _unzigzag(uint64_t v) {
+        return (int64_t)(v >> 1) ^ -(int64_t)(v & 1);
+    }
+
+    static int64_t _load(const T &value, const RYLR998_Field &f) {
+        const uint8_t *p = reinterpret_cast<const uint8_t *>(&value) + f.offset;
+
+        switch (f.size) {
+        case 1: {
+            uint8_t v;
+            memcpy(&v, p, 1);
+            return f.is_signed ? (int64_t)(int8_t)v : (int64_t)v;
+        }
+        case 2: {
+            uint16_t v;
+            memcpy(&v, p, 2);
+            return f.is_signed ? (int64_t)(int16_t)v : (int64_t)v;
+        }
+        default: {
+            uint32_t v;
+            memcpy(&v, p, 4);
+            return f.is_signed ? (int64_t)(int32_t)v : (int64_t)v;
+        }
+        }
+    }
+
+    static void _store(T &value, const RYLR998_Field &f, int64_t v) {
+        uint8_t *p = reinterpret_cast<uint8_t *>(&value) + f.offset;
+
+        switch (f.size) {
+        case 1: {
+            uint8_t t = (uint8_t)v;
+            memcpy(p, &t, 1);
+            break;
+        }
+        case 2: {
+            uint16_t t = (uint16_t)v;
+            memcpy(p, &t, 2);
+            break;
+        }
+        default: {
+            uint32_t t = (uint32_t)v;
+            memcpy(p, &t, 4);
+            break;
+        }
+        }
+    }
+};
+
+/** RYLR998_SchemaLink class.
+    Keeps the previous value per peer so frames can be delta encoded.
+
+    A full frame is sent to a new peer and then every
+    RYLR998_SCHEMA_KEYFRAME_INTERVAL frames. On the receive side a delta
+    frame is only accepted if it follows the last decoded frame from the
+    same source, so a lost frame is never silently applied to the wrong base.
+    Up to SLOTS peers are tracked in each direction; the oldest is replaced.
+ */
+template <typename T, int SLOTS = 4>
+class RYLR998_SchemaLink {
+public:
+    RYLR998_SchemaLink(const RYLR998_Schema<T> &schema) : _schema(schema), _tick(0) {
+        memset(_tx, 0, sizeof(_tx));
+        memset(_rx, 0, sizeof(_rx));
+    }
+
+    /**
+    * Encode a value for a destination, as a delta frame when possible
+    *
+    * @param addr the destination address
+    * @param value the value to encode
+    * @param buf buffer that stores the frame
+    * @param size the buffer size
+    * @return the frame length, or -1 if the buffer is too small
+    */
+    int encode(int addr, const T &value, uint8_t *buf, int size) {
+        _Slot *slot = _find(_tx, addr);
+        const T *prev = nullptr;
+
+        if (slot->valid && slot->addr == addr && slot->since_key < RYLR998_SCHEMA_KEYFRAME_INTERVAL)
+            prev = &slot->last;
+
+        uint8_t seq = (slot->valid && slot->addr == addr) ? ((slot->seq + 1) & 0x7F) : 0;
+        int len = _schema.encode(value, seq, prev, buf, size);
+        if (len < 0)
+            return len;
+
+        slot->addr = addr;
+        slot->valid = true;
+        slot->seq = seq;
+        slot->since_key = (prev == nullptr) ? 1 : slot->since_key + 1;
+        slot->used = ++_tick;
+        slot->last = value;
+
+        return len;
+    }
+
+    /**
+    * Decode a frame from a source
+    *
+    * @param addr the source address
+    * @param buf the frame
+    * @param len the frame length
+    * @param value the decoded value
+    * @return true only if the frame decodes against a known base
+    */
+    bool decode(int addr, const uint8_t *buf, int len, T &value) {
+        if (len < 1)
+            return false;
+
+        _Slot *slot = _find(_rx, addr);
+        bool known = slot->valid && slot->addr == addr;
+        uint8_t seq = RYLR998_Schema<T>::sequence(buf[0]);
+        const T *prev = nullptr;
+
+        if (RYLR998_Schema<T>::is_delta(buf[0])) {
+            if (!known || seq != ((slot->seq + 1) & 0x7F))
+                return false;
+            prev = &slot->last;
+        }
+
+        T decoded = known ? slot->last : T();
+        if (!_schema.decode(buf, len, prev, decoded))
+            return false;
+
+        slot->addr = addr;
+        slot->valid = true;
+        slot->seq = seq;
+        slot->used = ++_tick;
+        slot->last = decoded;
+        value = decoded;
+
+        return true;
+    }
+
+    /**
+    * Forget a peer so the next frame to it is a full frame
+    *
+    * @param addr the peer address
+    */
+    void reset(int addr) {
+        for (int i = 0; i < SLOTS; i++) {
+            if (_tx[i].addr == addr)
+                _tx[i].valid = false;
+            if (_rx[i].addr == addr)
+                _rx[i].valid = false;
+        }
+    }
+
+private:
+    struct _Slot {
+        int addr;
+        bool valid;
+        uint8_t seq;
+        uint8_t since_key;
+        uint32_t used;
+        T last;
+    };
+
+    const RYLR998_Schema<T> &_schema;
+    _Slot _tx[SLOTS];
+    _Slot _rx[SLOTS];
+    uint32_t _tick;
+
+    // Slot for addr, or the least recently used one
+    _Slot *_find(_Slot *slots, int addr) {
+        _Slot *lru = &slots[0];
+        for (int i = 0; i < SLOTS; i++) {
+            if (slots[i].valid && slots[i].addr == addr)
+                return &slots[i];
+            if (!slots[i].valid)
+                lru = (lru->valid) ? &slots[i] : lru;
+            else if (lru->valid && slots[i].used < lru->used)
+                lru = &slots[i];
+        }
+        return lru;
+    }
+};
+
+#endif // __RYLR998_SCHEMA_H__
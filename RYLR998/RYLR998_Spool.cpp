@@ -0,0 +1,683 @@
+/*
+ * Copyright (c) 2023, Nuvoton Technology Corporation
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <string.h>
+#include "RYLR998_Spool.h"
+
+#define _REC_MAX    (RYLR998_SPOOL_REC_HDR + 255)
+
+static_assert(RYLR998_SPOOL_BUFFER >= RYLR998_SPOOL_SECTOR_HDR + _REC_MAX,
+              "RYLR998_SPOOL_BUFFER must hold a sector header and a full record");
+
+static uint16_t _crc16(uint16_t crc, const uint8_t *data, int len)
+{
+    for (int i = 0; i < len; i++)
+    {
+        crc ^= (uint16_t)data[i] << 8;
+        for (int b = 0; b < 8; b++)
+            crc = (crc & 0x8000) ? (crc << 1) ^ 0x1021 : crc << 1;
+    }
+
+    return crc;
+}
+
+static uint32_t _get32(const uint8_t *p)
+{
+    return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static void _put32(uint8_t *p, uint32_t v)
+{
+    p[0] = v & 0xFF;
+    p[1] = (v >> 8) & 0xFF;
+    p[2] = (v >> 16) & 0xFF;
+    p[3] = (v >> 24) & 0xFF;
+}
+
+static bool _rec_valid(const uint8_t *rec)
+{
+    int len = rec[1];
+    uint16_t crc = _crc16(0xFFFF, rec, 16);
+    crc = _crc16(crc, rec + RYLR998_SPOOL_REC_HDR, len);
+
+    return (rec[16] | (rec[17] << 8)) == crc;
+}
+
+RYLR998_Spool::RYLR998_Spool(RYLR998_Storage &storage)
+    : _storage(storage),
+      _mounted(false),
+      _erase_size(0),
+      _prog_size(1),
+      _sectors(0)
+{
+    _reset_state();
+    memset(&_stats, 0, sizeof(_stats));
+}
+
+void RYLR998_Spool::_reset_state(void)
+{
+    // The first push opens sector 0
+    _wr_sector = (_sectors > 0) ? _sectors - 1 : 0;
+    _sector_seq = 0;
+    _new_sector = true;
+    _buf_base = 0;
+    _buf_len = 0;
+    _dirty = false;
+    _dirty_since = 0;
+    _next_seq = 1;
+
+    _rd = 0;
+    _acked = 0;
+    _ack_pending = false;
+    _count = 0;
+}
+
+bool RYLR998_Spool::mount(void)
+{
+    _mounted = false;
+    _erase_size = _storage.get_erase_size();
+    _prog_size = _storage.get_program_size();
+    if (_erase_size == 0 || _prog_size == 0)
+        return false;
+    _sectors = _storage.size() / _erase_size;
+
+    if (_sectors < 2 || _erase_size < RYLR998_SPOOL_SECTOR_HDR + _REC_MAX
+        || _erase_size % _prog_size != 0 || RYLR998_SPOOL_BUFFER % _prog_size != 0)
+        return false;
+
+    _reset_state();
+
+    // The newest sector is the write sector
+    bool found = false;
+    uint32_t newest = 0;
+    uint32_t newest_seq = 0;
+    for (uint32_t i = 0; i < _sectors; i++)
+    {
+        uint8_t hdr[RYLR998_SPOOL_SECTOR_HDR];
+        if (!_read(i * _erase_size, hdr, sizeof(hdr)) || _get32(hdr) != RYLR998_SPOOL_MAGIC)
+            continue;
+
+        uint32_t seq = _get32(hdr + 4);
+        if (!found || (int32_t)(seq - newest_seq) > 0)
+        {
+            found = true;
+            newest = i;
+            newest_seq = seq;
+        }
+    }
+
+    _mounted = true;
+    if (!found)
+        return true;
+
+    // Walk back while the sequence counts down, sectors before that are
+    // stale. A sector without a header is passed over: its first program
+    // failed and the records went on to the next sector.
+    uint32_t oldest = newest;
+    uint32_t chain = 1;
+    for (uint32_t back = 1; back < _sectors; back++)
+    {
+        uint32_t prev = (newest + _sectors - back) % _sectors;
+        uint8_t hdr[RYLR998_SPOOL_SECTOR_HDR];
+        if (!_read(prev * _erase_size, hdr, sizeof(hdr)))
+            break;
+        if (_get32(hdr) != RYLR998_SPOOL_MAGIC)
+            continue;
+        if (_get32(hdr + 4) != newest_seq - back)
+            break;
+        oldest = prev;
+        chain = back + 1;
+    }
+
+    // First pass finds the last ack, the second counts the frames after it
+    _Scan all;
+    memset(&all, 0, sizeof(all));
+    for (uint32_t k = 0; k < chain; k++)
+    {
+        _scan((oldest + k) % _sectors, all);
+        if (all.torn)
+            _stats.torn++;
+    }
+
+    _Scan left;
+    memset(&left, 0, sizeof(left));
+    left.after_valid = all.has_ack;
+    left.after = all.max_ack;
+    for (uint32_t k = 0; k < chain; k++)
+        _scan((oldest + k) % _sectors, left);
+
+    // Appending goes on behind the last record, if the rest of the
+    // sector is still erased
+    bool clean = !all.torn;
+    uint32_t end = newest * _erase_size + all.end;
+    uint32_t sector_end = (newest + 1) * _erase_size;
+    end = (end + _prog_size - 1) / _prog_size * _prog_size;
+
+    for (uint32_t a = end; clean && a < sector_end; a += 64)
+    {
+        uint8_t chunk[64];
+        uint32_t n = (sector_end - a < sizeof(chunk)) ? sector_end - a : sizeof(chunk);
+        if (!_read(a, chunk, n))
+        {
+            clean = false;
+            break;
+        }
+        for (uint32_t i = 0; i < n; i++)
+        {
+            if (chunk[i] != 0xFF)
+            {
+                clean = false;
+                _stats.torn++;
+                break;
+            }
+        }
+    }
+
+    _wr_sector = newest;
+    _sector_seq = newest_seq;
+    _buf_base = end;
+    _new_sector = !clean || end + RYLR998_SPOOL_REC_HDR > sector_end;
+
+    uint32_t last = (all.has_ack && (!all.has_seq || (int32_t)(all.max_ack - all.max_seq) > 0))
+                    ? all.max_ack : all.max_seq;
+    _next_seq = (all.has_seq || all.has_ack) ? last + 1 : 1;
+    _acked = all.max_ack;
+
+    _count = left.frames;
+    _rd = left.first;
+    _stats.recovered += left.frames;
+
+    return true;
+}
+
+bool RYLR998_Spool::format(void)
+{
+    // mount() only fails on the geometry
+    if (!mount())
+        return false;
+
+    bool ok = true;
+    for (uint32_t i = 0; i < _sectors; i++)
+    {
+        if (_storage.erase(i * _erase_size, _erase_size) != 0)
+        {
+            _stats.errors++;
+            ok = false;
+        }
+        _stats.erases++;
+    }
+
+    _reset_state();
+    _mounted = ok;
+
+    return ok;
+}
+
+void RYLR998_Spool::_scan(uint32_t sector, _Scan &s)
+{
+    uint8_t rec[_REC_MAX];
+    uint32_t base = sector * _erase_size;
+    uint32_t o = RYLR998_SPOOL_SECTOR_HDR;
+
+    s.torn = false;
+    s.end = o;
+
+    // A sector whose header was not programmed holds nothing
+    if (!_read(base, rec, RYLR998_SPOOL_SECTOR_HDR) || _get32(rec) != RYLR998_SPOOL_MAGIC)
+        return;
+
+    while (o + RYLR998_SPOOL_REC_HDR <= _erase_size)
+    {
+        if (!_read(base + o, rec, RYLR998_SPOOL_REC_HDR))
+        {
+            s.torn = true;
+            break;
+        }
+
+        // Erased: commit padding up to the next program unit, or the end
+        if (rec[0] == 0xFF)
+        {
+            if (o % _prog_size == 0)
+                break;
+            o = (o + _prog_size - 1) / _prog_size * _prog_size;
+            continue;
+        }
+
+        int len = rec[1];
+        if ((rec[0] != RYLR998_SPOOL_FRAME && rec[0] != RYLR998_SPOOL_ACK)
+            || o + RYLR998_SPOOL_REC_HDR + len > _erase_size
+            || !_read(base + o + RYLR998_SPOOL_REC_HDR, rec + RYLR998_SPOOL_REC_HDR, len)
+            || !_rec_valid(rec))
+        {
+            s.torn = true;
+            break;
+        }
+
+        uint32_t seq = _get32(rec + 12);
+        if (rec[0] == RYLR998_SPOOL_ACK)
+        {
+            if (!s.has_ack || (int32_t)(seq - s.max_ack) > 0)
+                s.max_ack = seq;
+            s.has_ack = true;
+        }
+        else
+        {
+            if (!s.has_seq || (int32_t)(seq - s.max_seq) > 0)
+                s.max_seq = seq;
+            s.has_seq = true;
+
+            if (base + o >= s.from && (!s.after_valid || (int32_t)(seq - s.after) > 0))
+            {
+                if (s.frames == 0)
+                    s.first = base + o;
+                s.frames++;
+
+                // Copies left by a failed program are counted once
+                s.after_valid = true;
+                s.after = seq;
+            }
+        }
+
+        o += RYLR998_SPOOL_REC_HDR + len;
+    }
+
+    s.end = o;
+}
+
+uint32_t RYLR998_Spool::_now_ms(void)
+{
+    return rylr998_port::now_ms();
+}
+
+void RYLR998_Spool::_touch(void)
+{
+    if (!_dirty)
+    {
+        _dirty = true;
+        _dirty_since = _now_ms();
+    }
+}
+
+bool RYLR998_Spool::_read(uint32_t addr, void *buf, uint32_t len)
+{
+    uint8_t *p = (uint8_t *)buf;
+
+    // Bytes of the buffered sector from _buf_base on are still in RAM
+    if (_buf_len > 0 && addr / _erase_size == _buf_base / _erase_size && addr + len > _buf_base)
+    {
+        uint32_t head = (addr < _buf_base) ? _buf_base - addr : 0;
+        if (head > 0 && _storage.read(p, addr, head) != 0)
+        {
+            _stats.errors++;
+            return false;
+        }
+
+        for (uint32_t i = head; i < len; i++)
+        {
+            uint32_t o = addr + i - _buf_base;
+            p[i] = (o < (uint32_t)_buf_len) ? _buf[o] : 0xFF;
+        }
+        return true;
+    }
+
+    if (_storage.read(p, addr, len) != 0)
+    {
+        _stats.errors++;
+        return false;
+    }
+
+    return true;
+}
+
+bool RYLR998_Spool::_flush(void)
+{
+    if (_buf_len == 0)
+        return true;
+
+    uint32_t len = (_buf_len + _prog_size - 1) / _prog_size * _prog_size;
+    memset(_buf + _buf_len, 0xFF, len - _buf_len);
+
+    if (_storage.program(_buf, _buf_base, len) != 0)
+    {
+        // The sector is not usable past this point, the records stay in
+        // RAM for the next one
+        _stats.errors++;
+        _new_sector = true;
+        return false;
+    }
+
+    _stats.bytes_written += len;
+    _buf_base += len;
+    _buf_len = 0;
+
+    return true;
+}
+
+bool RYLR998_Spool::_open_sector(void)
+{
+    if (!_new_sector && !_flush())
+        return false;
+
+    uint32_t next = (_wr_sector + 1) % _sectors;
+
+    // The ring is full, the oldest frames make room
+    if (_count > 0 && _rd / _erase_size == next)
+    {
+        _Scan s;
+        memset(&s, 0, sizeof(s));
+        s.from = _rd;
+        _scan(next, s);
+
+        _count -= s.frames;
+        _stats.dropped += s.frames;
+        if (_count < 0)
+            _count = 0;
+        _rd = ((next + 1) % _sectors) * _erase_size;
+    }
+
+    _stats.erases++;
+    if (_storage.erase(next * _erase_size, _erase_size) != 0)
+    {
+        _stats.errors++;
+        _new_sector = true;
+        return false;
+    }
+
+    // Records left by a failed program follow the new header, and so
+    // does the read head if it is among them
+    uint32_t skip = (_buf_base % _erase_size == 0) ? RYLR998_SPOOL_SECTOR_HDR : 0;
+    uint32_t from = _buf_base + skip;
+    int carried = (_buf_len > (int)skip) ? _buf_len - (int)skip : 0;
+    if (carried > 0)
+    {
+        memmove(_buf + RYLR998_SPOOL_SECTOR_HDR, _buf + skip, carried);
+        if (_rd >= from && _rd < from + carried)
+            _rd = next * _erase_size + RYLR998_SPOOL_SECTOR_HDR + (_rd - from);
+    }
+
+    _wr_sector = next;
+    _sector_seq++;
+    _buf_base = next * _erase_size;
+    _put32(_buf, RYLR998_SPOOL_MAGIC);
+    _put32(_buf + 4, _sector_seq);
+    _buf_len = RYLR998_SPOOL_SECTOR_HDR + carried;
+    _new_sector = false;
+    _touch();
+
+    // A second failure is reported, the caller keeps what it has
+    if (carried > 0 && !_flush())
+        return false;
+
+    return true;
+}
+
+bool RYLR998_Spool::_reserve(int len)
+{
+    while (true)
+    {
+        if (_new_sector || _buf_base + _buf_len + len > (_wr_sector + 1) * _erase_size)
+        {
+            if (!_open_sector())
+                return false;
+            continue;
+        }
+
+        // Leave room for a sector header, the records may have to move
+        int room = RYLR998_SPOOL_BUFFER - ((_buf_base % _erase_size == 0) ? 0 : RYLR998_SPOOL_SECTOR_HDR);
+        if (_buf_len + len > room)
+        {
+            if (!_flush())
+                return false;
+            continue;
+        }
+
+        return true;
+    }
+}
+
+void RYLR998_Spool::_append(uint8_t type, int addr, const char *data, int len, int rssi, int snr, uint32_t time, uint32_t seq)
+{
+    uint8_t *rec = _buf + _buf_len;
+
+    rec[0] = type;
+    rec[1] = len;
+    rec[2] = addr & 0xFF;
+    rec[3] = (addr >> 8) & 0xFF;
+    rec[4] = rssi & 0xFF;
+    rec[5] = (rssi >> 8) & 0xFF;
+    rec[6] = (uint8_t)(int8_t)snr;
+    rec[7] = 0;
+    _put32(rec + 8, time);
+    _put32(rec + 12, seq);
+    if (len > 0)
+        memcpy(rec + RYLR998_SPOOL_REC_HDR, data, len);
+
+    uint16_t crc = _crc16(0xFFFF, rec, 16);
+    crc = _crc16(crc, rec + RYLR998_SPOOL_REC_HDR, len);
+    rec[16] = crc & 0xFF;
+    rec[17] = (crc >> 8) & 0xFF;
+
+    _buf_len += RYLR998_SPOOL_REC_HDR + len;
+    _touch();
+}
+
+bool RYLR998_Spool::push(int addr, const char *data, int len, int rssi, int snr, uint32_t time)
+{
+    if (!_mounted || data == NULL || len < 0 || len > 255)
+        return false;
+
+    if (!_reserve(RYLR998_SPOOL_REC_HDR + len))
+        return false;
+
+    if (_count == 0)
+        _rd = _buf_base + _buf_len;
+
+    _append(RYLR998_SPOOL_FRAME, addr, data, len, rssi, snr, time, _next_seq++);
+    _count++;
+    _stats.pushed++;
+
+    return true;
+}
+
+bool RYLR998_Spool::_next_frame(uint8_t *rec)
+{
+    uint32_t hops = 0;
+
+    while (hops <= _sectors)
+    {
+        // Past the last sector is the start of the first
+        if (_rd >= _sectors * _erase_size)
+            _rd = 0;
+
+        uint32_t sector = _rd / _erase_size;
+        uint32_t o = _rd % _erase_size;
+        bool next = false;
+
+        if (o == 0)
+        {
+            if (_read(_rd, rec, RYLR998_SPOOL_SECTOR_HDR) && _get32(rec) == RYLR998_SPOOL_MAGIC)
+                _rd += RYLR998_SPOOL_SECTOR_HDR;
+            else
+                next = true;
+        }
+        else if (o + RYLR998_SPOOL_REC_HDR > _erase_size || !_read(_rd, rec, RYLR998_SPOOL_REC_HDR))
+        {
+            next = true;
+        }
+        else if (rec[0] == 0xFF)
+        {
+            if (o % _prog_size == 0)
+            {
+                if (sector == _wr_sector)
+                    return false;
+                next = true;
+            }
+            else
+            {
+                _rd = (_rd + _prog_size - 1) / _prog_size * _prog_size;
+            }
+        }
+        else if (rec[0] == RYLR998_SPOOL_ACK)
+        {
+            _rd += RYLR998_SPOOL_REC_HDR + rec[1];
+        }
+        else if (rec[0] == RYLR998_SPOOL_FRAME
+                 && o + RYLR998_SPOOL_REC_HDR + rec[1] <= _erase_size
+                 && _read(_rd + RYLR998_SPOOL_REC_HDR, rec + RYLR998_SPOOL_REC_HDR, rec[1])
+                 && _rec_valid(rec))
+        {
+            // A copy left by a failed program is passed over
+            if ((int32_t)(_get32(rec + 12) - _acked) > 0)
+                return true;
+            _rd += RYLR998_SPOOL_REC_HDR + rec[1];
+        }
+        else
+        {
+            // Torn record, the writer moved on to the next sector
+            next = true;
+        }
+
+        if (next)
+        {
+            _rd = ((sector + 1) % _sectors) * _erase_size;
+            hops++;
+        }
+    }
+
+    return false;
+}
+
+int RYLR998_Spool::peek_size(void)
+{
+    uint8_t rec[_REC_MAX];
+
+    if (_count == 0 || !_next_frame(rec))
+        return 0;
+
+    return rec[1];
+}
+
+bool RYLR998_Spool::_head(uint8_t *rec)
+{
+    if (_count == 0)
+        return false;
+
+    if (!_next_frame(rec))
+    {
+        // Lost track of the frames, e.g. storage read errors
+        _stats.dropped += _count;
+        _count = 0;
+        return false;
+    }
+
+    return true;
+}
+
+static int _unpack(const uint8_t *rec, int &addr, char *data, int size, int &rssi, int &snr, uint32_t &time)
+{
+    int len = rec[1];
+    addr = rec[2] | (rec[3] << 8);
+    rssi = (int16_t)(rec[4] | (rec[5] << 8));
+    snr = (int8_t)rec[6];
+    time = _get32(rec + 8);
+
+    if (size > len)
+        size = len;
+    memcpy(data, rec + RYLR998_SPOOL_REC_HDR, size);
+
+    return size;
+}
+
+int RYLR998_Spool::peek(int &addr, char *data, int size, int &rssi, int &snr, uint32_t &time)
+{
+    uint8_t rec[_REC_MAX];
+
+    if (!_head(rec))
+        return 0;
+
+    return _unpack(rec, addr, data, size, rssi, snr, time);
+}
+
+int RYLR998_Spool::pull(int &addr, char *data, int size, int &rssi, int &snr, uint32_t &time)
+{
+    uint8_t rec[_REC_MAX];
+
+    if (!_head(rec))
+        return 0;
+
+    size = _unpack(rec, addr, data, size, rssi, snr, time);
+    _acked = _get32(rec + 12);
+
+    _rd += RYLR998_SPOOL_REC_HDR + rec[1];
+    if (_rd >= _sectors * _erase_size)
+        _rd = 0;
+    _ack_pending = true;
+    _touch();
+    _count--;
+    _stats.pulled++;
+
+    return size;
+}
+
+bool RYLR998_Spool::commit(void)
+{
+    if (!_mounted)
+        return false;
+
+    // The ack goes in the same program as the frames
+    if (_ack_pending && _reserve(RYLR998_SPOOL_REC_HDR))
+    {
+        _append(RYLR998_SPOOL_ACK, 0, NULL, 0, 0, 0, 0, _acked);
+        _ack_pending = false;
+    }
+
+    if (!_dirty)
+        return true;
+
+    // Records left by a failed program go to the next sector
+    bool ok = (_new_sector && _buf_len > 0) ? _open_sector() : _flush();
+    if (_storage.sync() != 0)
+    {
+        _stats.errors++;
+        ok = false;
+    }
+    _stats.commits++;
+
+    // On errors service() tries again a period later
+    if (ok)
+        _dirty = false;
+    else
+        _dirty_since = _now_ms();
+
+    return ok;
+}
+
+void RYLR998_Spool::service(void)
+{
+    if (_dirty && _now_ms() - _dirty_since >= RYLR998_SPOOL_COMMIT_MS)
+        commit();
+}
+
+struct RYLR998_Spool::spool_stats RYLR998_Spool::get_stats(void)
+{
+    struct spool_stats stats = _stats;
+
+    stats.frames = _count;
+
+    return stats;
+}
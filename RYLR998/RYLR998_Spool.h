@@ -0,0 +1,274 @@
+/*
+ * Copyright (c) 2023, Nuvoton Technology Corporation
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef __RYLR998_SPOOL_H__
+#define __RYLR998_SPOOL_H__
+
+#include <stdint.h>
+#include "RYLR998_Port.h"
+
+#if RYLR998_PORT_MBED
+#include "BlockDevice.h"
+#endif
+
+#ifndef RYLR998_SPOOL_BUFFER
+#define RYLR998_SPOOL_BUFFER        512     // bytes gathered in RAM per commit
+#endif
+
+#ifndef RYLR998_SPOOL_COMMIT_MS
+#define RYLR998_SPOOL_COMMIT_MS     1000    // longest time a record stays in RAM
+#endif
+
+/* Log layout. Each erase block starts with a sector header: magic (u32),
+ * sector sequence (u32). Records follow back to back:
+ * type, len, addr (u16), rssi (i16), snr (i8), 0, time ms (u32),
+ * record sequence (u32), CRC-16/CCITT of header and data (u16), data.
+ * Multi-byte fields are little endian. An ack record carries the
+ * sequence of the last frame drained. Erased bytes read 0xFF; a commit
+ * that ends off a program unit boundary leaves them as padding.
+ */
+#define RYLR998_SPOOL_MAGIC         0x50535952  // "RYSP"
+#define RYLR998_SPOOL_SECTOR_HDR    8
+#define RYLR998_SPOOL_REC_HDR       18
+#define RYLR998_SPOOL_FRAME         0xA5
+#define RYLR998_SPOOL_ACK           0x5A
+
+/** RYLR998_Storage class.
+    Block storage under the spool, shaped like mbed::BlockDevice.
+
+    Erased blocks read 0xFF. Programs are made once per address between
+    erases, in multiples of the program size; reads may be of any size.
+    All calls return 0 on success.
+ */
+class RYLR998_Storage {
+public:
+    virtual ~RYLR998_Storage() {}
+
+    virtual int read(void *buffer, uint32_t addr, uint32_t size) = 0;
+    virtual int program(const void *buffer, uint32_t addr, uint32_t size) = 0;
+    virtual int erase(uint32_t addr, uint32_t size) = 0;
+
+    /**
+    * Make the programmed data durable
+    */
+    virtual int sync(void) {
+        return 0;
+    }
+
+    virtual uint32_t get_program_size(void) = 0;
+    virtual uint32_t get_erase_size(void) = 0;
+    virtual uint32_t size(void) = 0;
+};
+
+#if RYLR998_PORT_MBED
+/** RYLR998_BlockStorage class.
+    An initialized mbed BlockDevice with a read size of 1, e.g. SPIF or
+    FlashIAP.
+ */
+class RYLR998_BlockStorage : public RYLR998_Storage {
+public:
+    RYLR998_BlockStorage(mbed::BlockDevice &bd) : _bd(bd) {
+    }
+
+    int read(void *buffer, uint32_t addr, uint32_t size) {
+        return _bd.read(buffer, addr, size);
+    }
+
+    int program(const void *buffer, uint32_t addr, uint32_t size) {
+        return _bd.program(buffer, addr, size);
+    }
+
+    int erase(uint32_t addr, uint32_t size) {
+        return _bd.erase(addr, size);
+    }
+
+    int sync(void) {
+        return _bd.sync();
+    }
+
+    uint32_t get_program_size(void) {
+        return _bd.get_program_size();
+    }
+
+    uint32_t get_erase_size(void) {
+        return _bd.get_erase_size();
+    }
+
+    uint32_t size(void) {
+        return (uint32_t)_bd.size();
+    }
+
+private:
+    mbed::BlockDevice &_bd;
+};
+#endif
+
+/** RYLR998_Spool class.
+    A persistent FIFO of frames in an append-only log.
+
+    push() appends records to a RAM buffer that is programmed in one go
+    when it fills, when commit() is called, or by service() once the
+    oldest buffered record is RYLR998_SPOOL_COMMIT_MS old. Erase blocks
+    are used as a ring; a block is erased just before it is written, and
+    when the ring is full the oldest frames are dropped. Records whose
+    program fails stay in RAM and are written again behind the header of
+    the next sector; push() or commit() return false if that fails too.
+
+    pull() returns frames in arrival order. Drained frames are recorded
+    by an ack record at the next commit, so a reset can replay the frames
+    drained since then, but never loses a committed frame. mount() rebuilds
+    the state from the log, dropping a record torn by a reset.
+ */
+class RYLR998_Spool {
+public:
+    RYLR998_Spool(RYLR998_Storage &storage);
+
+    struct spool_stats {
+        uint32_t pushed;            // frames appended
+        uint32_t pulled;            // frames drained
+        uint32_t dropped;           // frames erased unread, the log was full
+        uint32_t recovered;         // frames found by mount()
+        uint32_t torn;              // records discarded by mount()
+        uint32_t commits;
+        uint32_t bytes_written;
+        uint32_t erases;
+        uint32_t errors;            // storage calls that failed
+        int frames;                 // frames waiting
+    };
+
+    /**
+    * Recover the log from the storage
+    *
+    * @return false if the storage geometry does not fit the log
+    */
+    bool mount(void);
+
+    /**
+    * Erase the storage and start an empty log
+    *
+    * @return false on storage errors
+    */
+    bool format(void);
+
+    /**
+    * Append a frame
+    *
+    * @return false if not mounted or the storage failed
+    */
+    bool push(int addr, const char *data, int len, int rssi, int snr, uint32_t time);
+
+    /**
+    * Return the data size of the next frame, 0 if none
+    */
+    int peek_size(void);
+
+    /**
+    * Read the next frame and leave it in the spool
+    *
+    * @return the data size stored in data, 0 if none
+    */
+    int peek(int &addr, char *data, int size, int &rssi, int &snr, uint32_t &time);
+
+    /**
+    * Take the next frame
+    *
+    * @return the data size stored in data, 0 if none
+    */
+    int pull(int &addr, char *data, int size, int &rssi, int &snr, uint32_t &time);
+
+    /**
+    * Return the number of frames waiting
+    */
+    int size(void) {
+        return _count;
+    }
+
+    /**
+    * Program the buffered records and sync the storage
+    *
+    * @return false on storage errors
+    */
+    bool commit(void);
+
+    /**
+    * Commit when the oldest buffered record is due
+    */
+    void service(void);
+
+    /**
+    * Return the spool counters
+    *
+    * @return spool_stats
+    */
+    struct spool_stats get_stats(void);
+
+private:
+    RYLR998_Storage &_storage;
+    bool _mounted;
+    uint32_t _erase_size;
+    uint32_t _prog_size;
+    uint32_t _sectors;
+
+    // Write head, the buffer holds the bytes from _buf_base on
+    uint32_t _wr_sector;
+    uint32_t _sector_seq;
+    bool _new_sector;           // the rest of the write sector can not be used,
+                                // buffered records go to the next one
+    uint32_t _buf_base;
+    int _buf_len;
+    uint8_t _buf[RYLR998_SPOOL_BUFFER];
+    bool _dirty;
+    uint32_t _dirty_since;
+    uint32_t _next_seq;
+
+    // Read head
+    uint32_t _rd;
+    uint32_t _acked;            // sequence of the last frame drained
+    bool _ack_pending;
+    int _count;
+
+    struct spool_stats _stats;
+
+    struct _Scan {
+        uint32_t from;          // count the frames stored from here on
+        bool after_valid;       // and only those after this sequence
+        uint32_t after;
+        int frames;
+        uint32_t first;         // address of the first frame counted
+        bool has_seq;
+        uint32_t max_seq;
+        bool has_ack;
+        uint32_t max_ack;
+        uint32_t end;           // end of the valid records of the sector
+        bool torn;              // the sector ends with an invalid record
+    };
+
+    uint32_t _now_ms(void);
+    void _reset_state(void);
+    void _touch(void);
+    bool _read(uint32_t addr, void *buf, uint32_t len);
+    bool _flush(void);
+    bool _open_sector(void);
+    bool _reserve(int len);
+    void _append(uint8_t type, int addr, const char *data, int len, int rssi, int snr, uint32_t time, uint32_t seq);
+    bool _next_frame(uint8_t *rec);
+    bool _head(uint8_t *rec);
+    void _scan(uint32_t sector, _Scan &s);
+};
+
+#endif // __RYLR998_SPOOL_H__
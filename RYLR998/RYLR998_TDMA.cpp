@@ -0,0 +1,527 @@
+/*
+ * Copyright (c) 2023, Nuvoton Technology Corporation
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "RYLR998_TDMA.h"
+
+RYLR998_TDMA::RYLR998_TDMA(RYLR998 &rylr, bool gateway)
+    : _rylr(rylr),
+      _gateway(gateway),
+      _beacon_ms(0),
+      _slot_ms(0),
+      _slots(0),
+      _contention(0),
+      _period_us(0),
+      _sf_start(0),
+      _sf_count(0),
+      _beacon_seq(0),
+      _running(false),
+      _nacks(0),
+      _synced(false),
+      _active(true),
+      _leaving(false),
+      _my_addr(-1),
+      _my_slot(-1),
+      _last_beacon(0),
+      _missed(0),
+      _sent_this_sf(false),
+      _last_sent_sf(0),
+      _join_backoff(0),
+      _join_slot(-1),
+      _drift_us(0),
+      _q_head(0),
+      _q_count(0),
+      _utilization(0)
+{
+    for (int i = 0; i < RYLR998_TDMA_MAX_SLOTS; i++)
+    {
+        _owner[i] = 0;
+        _last_heard[i] = 0;
+        _heard[i] = false;
+    }
+
+    memset(&_stats, 0, sizeof(_stats));
+}
+
+bool RYLR998_TDMA::start(int slots, int contention, int max_len)
+{
+    if (!_gateway || slots < 1 || slots > RYLR998_TDMA_MAX_SLOTS || contention < 1 || contention > 255)
+        return false;
+
+    // Room for the driver link header on top of the payload
+    int toa = _rylr.get_time_on_air_us(max_len + RYLR998_LINK_HDR_SIZE + RYLR998_LINK_SEQ_SIZE);
+    int beacon_toa = _rylr.get_time_on_air_us(RYLR998_TDMA_BEACON_HDR + 3 * RYLR998_TDMA_BEACON_ACKS);
+    if (toa <= 0 || beacon_toa <= 0)
+        return false;
+
+    int slot_ms = (toa + 999) / 1000 + RYLR998_TDMA_GUARD_MS;
+    int beacon_ms = (beacon_toa + 999) / 1000 + RYLR998_TDMA_GUARD_MS;
+    if (beacon_ms < slot_ms)
+        beacon_ms = slot_ms;
+    if (slot_ms > 0xFFFF || beacon_ms > 0xFFFF)
+        return false;
+
+    _slot_ms = slot_ms;
+    _beacon_ms = beacon_ms;
+    _slots = slots;
+    _contention = contention;
+    _period_us = (uint32_t)(_beacon_ms + (_slots + _contention) * _slot_ms) * 1000;
+
+    for (int i = 0; i < RYLR998_TDMA_MAX_SLOTS; i++)
+        _owner[i] = 0;
+    _nacks = 0;
+    _sf_count = 0;
+
+    // Beacon on the next recv()
+    _sf_start = _now_ms() - _period_us / 1000;
+    _running = true;
+
+    return true;
+}
+
+bool RYLR998_TDMA::send(int addr, const char *data, int len)
+{
+    if (data == NULL || len < 0 || len > RYLR998_MAX_PAYLOAD)
+        return false;
+
+    // Data that would be taken for a control frame gets a data header
+    int hdr = (len > 0 && (uint8_t)data[0] == RYLR998_TDMA_MAGIC) ? 2 : 0;
+    if (len + hdr > RYLR998_MAX_PAYLOAD)
+        return false;
+
+    if (_gateway)
+    {
+        char frame[RYLR998_MAX_PAYLOAD];
+        frame[0] = RYLR998_TDMA_MAGIC;
+        frame[1] = RYLR998_TDMA_DATA;
+        memcpy(frame + hdr, data, len);
+        _rylr.send(addr, frame, len + hdr);
+        return true;
+    }
+
+    if (_q_count == RYLR998_TDMA_TX_QUEUE)
+    {
+        _stats.tx_dropped++;
+        return false;
+    }
+
+    _Tx_Frame *f = &_queue[(_q_head + _q_count) % RYLR998_TDMA_TX_QUEUE];
+    f->addr = addr;
+    f->len = len + hdr;
+    f->data[0] = RYLR998_TDMA_MAGIC;
+    f->data[1] = RYLR998_TDMA_DATA;
+    memcpy(f->data + hdr, data, len);
+    _q_count++;
+    _active = true;
+
+    return true;
+}
+
+void RYLR998_TDMA::leave(void)
+{
+    if (_my_slot >= 0)
+        _leaving = true;
+    _active = false;
+}
+
+int RYLR998_TDMA::recv(int &addr, char *data, int size)
+{
+    uint8_t buf[RYLR998_MAX_PAYLOAD + 1];
+
+    _service(_now_ms());
+
+    while (true)
+    {
+        int from;
+        int len = _rylr.recv(from, (char *)buf, RYLR998_MAX_PAYLOAD);
+        if (len <= 0)
+            return 0;
+
+        bool control = len >= 2 && buf[0] == RYLR998_TDMA_MAGIC;
+        uint8_t *payload = buf;
+
+        if (control && buf[1] == RYLR998_TDMA_DATA)
+        {
+            control = false;
+            payload += 2;
+            len -= 2;
+        }
+
+        if (_gateway)
+        {
+            _gateway_heard(from);
+            if (control)
+            {
+                _gateway_control(from, buf);
+                continue;
+            }
+        }
+        else if (control)
+        {
+            if (buf[1] == RYLR998_TDMA_BEACON)
+                _node_beacon(buf, len, _rylr.get_timestamp());
+            _service(_now_ms());
+            continue;
+        }
+
+        if (len > size)
+            len = size;
+        memcpy(data, payload, len);
+        data[len] = '\0';
+        addr = from;
+        return len;
+    }
+}
+
+struct RYLR998_TDMA::tdma_stats RYLR998_TDMA::get_stats(void)
+{
+    struct tdma_stats stats = _stats;
+
+    if (_gateway)
+    {
+        stats.joined = 0;
+        for (int i = 0; i < _slots; i++)
+        {
+            if (_owner[i] != 0)
+                stats.joined++;
+        }
+    }
+    else
+    {
+        stats.joined = _my_slot;
+    }
+    stats.drift_us = _drift_us;
+
+    return stats;
+}
+
+uint32_t RYLR998_TDMA::_now_ms(void)
+{
+    return rylr998_port::now_ms();
+}
+
+void RYLR998_TDMA::_service(uint32_t now)
+{
+    if (_gateway)
+    {
+        if (_running && now - _sf_start >= _period_us / 1000)
+            _gateway_beacon(now);
+    }
+    else
+    {
+        _node_slot(now);
+    }
+}
+
+void RYLR998_TDMA::_gateway_beacon(uint32_t now)
+{
+    // Close the superframe that just ended
+    if (_sf_count > 0)
+    {
+        int offered = 0, used = 0;
+
+        for (int i = 0; i < _slots; i++)
+        {
+            if (_owner[i] == 0)
+                continue;
+
+            offered++;
+            if (_heard[i])
+                used++;
+            else if (_sf_count - _last_heard[i] > RYLR998_TDMA_IDLE_SUPERFRAMES)
+                _owner[i] = 0;
+            _heard[i] = false;
+        }
+
+        _stats.slots_total += offered;
+        _stats.slots_used += used;
+        if (offered > 0)
+            _utilization += (100 * used / offered - _utilization) / 4;
+    }
+
+    uint8_t frame[RYLR998_TDMA_BEACON_HDR + 3 * RYLR998_TDMA_BEACON_ACKS];
+    int len = RYLR998_TDMA_BEACON_HDR;
+
+    frame[0] = RYLR998_TDMA_MAGIC;
+    frame[1] = RYLR998_TDMA_BEACON;
+    frame[2] = _beacon_seq++;
+    frame[3] = _beacon_ms & 0xFF;
+    frame[4] = _beacon_ms >> 8;
+    frame[5] = _slot_ms & 0xFF;
+    frame[6] = _slot_ms >> 8;
+    frame[7] = _slots;
+    frame[8] = _contention;
+    frame[9] = _nacks;
+
+    for (int i = 0; i < _nacks; i++)
+    {
+        uint16_t owner = _owner[_acks[i]];
+        frame[len++] = owner & 0xFF;
+        frame[len++] = owner >> 8;
+        frame[len++] = _acks[i];
+    }
+    _nacks = 0;
+
+    _sf_start = now;
+    _sf_count++;
+    _stats.superframes++;
+
+    _rylr.send(0, (const char *)frame, len);
+}
+
+void RYLR998_TDMA::_gateway_control(int addr, const uint8_t *frame)
+{
+    int slot = -1, free = -1;
+
+    for (int i = 0; i < _slots; i++)
+    {
+        if (_owner[i] == addr)
+            slot = i;
+        else if (_owner[i] == 0 && free < 0)
+            free = i;
+    }
+
+    switch (frame[1])
+    {
+    case RYLR998_TDMA_JOIN:
+        // A known node asking again missed its assignment, repeat it
+        if (slot < 0)
+        {
+            if (free < 0)
+                return;
+            slot = free;
+            _owner[slot] = addr;
+            _last_heard[slot] = _sf_count;
+        }
+
+        for (int i = 0; i < _nacks; i++)
+        {
+            if (_acks[i] == slot)
+                return;
+        }
+        if (_nacks < RYLR998_TDMA_BEACON_ACKS)
+            _acks[_nacks++] = slot;
+        break;
+
+    case RYLR998_TDMA_LEAVE:
+        if (slot >= 0)
+            _owner[slot] = 0;
+        break;
+
+    default:
+        break;
+    }
+}
+
+void RYLR998_TDMA::_gateway_heard(int addr)
+{
+    for (int i = 0; i < _slots; i++)
+    {
+        if (_owner[i] == addr)
+        {
+            _last_heard[i] = _sf_count;
+            _heard[i] = true;
+            return;
+        }
+    }
+}
+
+void RYLR998_TDMA::_node_beacon(const uint8_t *frame, int len, uint32_t rx_time)
+{
+    if (len < RYLR998_TDMA_BEACON_HDR)
+        return;
+
+    int beacon_ms = frame[3] | (frame[4] << 8);
+    int slot_ms = frame[5] | (frame[6] << 8);
+    int slots = frame[7];
+    int contention = frame[8];
+    int nacks = frame[9];
+
+    if (slot_ms == 0 || slots == 0 || slots > RYLR998_TDMA_MAX_SLOTS || contention == 0
+        || len < RYLR998_TDMA_BEACON_HDR + 3 * nacks)
+        return;
+
+    // An assignment outside the slots is not from a sane gateway
+    for (int i = 0; i < nacks; i++)
+    {
+        if (frame[RYLR998_TDMA_BEACON_HDR + 3 * i + 2] >= slots)
+            return;
+    }
+
+    // The +RCV line comes after the whole beacon was on air
+    uint32_t start = rx_time - _rylr.get_time_on_air_us(len) / 1000;
+    uint32_t nominal_us = (uint32_t)(beacon_ms + (slots + contention) * slot_ms) * 1000;
+
+    if (_synced || _last_beacon != 0)
+    {
+        int64_t elapsed_us = (int64_t)(start - _last_beacon) * 1000;
+        int64_t n = (elapsed_us + nominal_us / 2) / nominal_us;
+
+        if (n > RYLR998_TDMA_IDLE_SUPERFRAMES)
+            _my_slot = -1;  // away too long, the gateway has freed the slot
+        else if (n >= 1 && n <= RYLR998_TDMA_MAX_MISSED + 1)
+            _drift_us += (int)((elapsed_us - n * nominal_us) / n - _drift_us) / 4;
+    }
+
+    _beacon_ms = beacon_ms;
+    _slot_ms = slot_ms;
+    _slots = slots;
+    _contention = contention;
+    _period_us = nominal_us + _drift_us;
+    _sf_start = start;
+    _last_beacon = start;
+    _synced = true;
+    _missed = 0;
+    _sent_this_sf = false;
+    _join_slot = -1;
+    _sf_count++;
+    _stats.superframes++;
+
+    if (_my_addr < 0)
+        _my_addr = _rylr.get_address();
+
+    if (_my_slot >= _slots)
+        _my_slot = -1;  // the superframe shrank, join again
+
+    for (int i = 0; i < nacks; i++)
+    {
+        const uint8_t *e = frame + RYLR998_TDMA_BEACON_HDR + 3 * i;
+        int addr = e[0] | (e[1] << 8);
+
+        if (addr == _my_addr)
+        {
+            _my_slot = e[2];
+            _join_backoff = 0;
+            _last_sent_sf = _sf_count;
+        }
+        else if (e[2] == _my_slot)
+        {
+            _my_slot = -1;  // given to another node, join again
+        }
+    }
+
+    if (_my_slot >= 0)
+        _stats.slots_total++;
+}
+
+void RYLR998_TDMA::_node_slot(uint32_t now)
+{
+    if (!_synced)
+        return;
+
+    // The beacon is missed once its slot is over
+    uint32_t period_ms = _period_us / 1000;
+    while (now - _sf_start >= period_ms + _beacon_ms)
+    {
+        // Run on the local clock for a while
+        _sf_start += period_ms;
+        _sf_count++;
+        _missed++;
+        _sent_this_sf = false;
+        _join_slot = -1;
+        _stats.beacons_missed++;
+
+        if (_missed > RYLR998_TDMA_MAX_MISSED)
+        {
+            _synced = false;
+            return;
+        }
+
+        if (_my_slot >= 0)
+            _stats.slots_total++;
+    }
+
+    if (_sent_this_sf)
+        return;
+
+    int slot;
+    if (_my_slot >= 0)
+    {
+        slot = _my_slot;
+    }
+    else
+    {
+        if (!_active)
+            return;
+
+        // Join in a random contention slot, backing off while unanswered.
+        // Both are drawn once per superframe.
+        if (_join_slot < 0)
+        {
+            if ((_rylr.get_random() % (1u << _join_backoff)) != 0)
+            {
+                _sent_this_sf = true;
+                return;
+            }
+            _join_slot = _slots + _rylr.get_random() % _contention;
+        }
+        slot = _join_slot;
+    }
+
+    int offset = now - _sf_start;
+    int slot_start = _beacon_ms + slot * _slot_ms + RYLR998_TDMA_GUARD_MS / 2;
+
+    if (offset < slot_start)
+        return;
+
+    _Tx_Frame *f = (_q_count > 0) ? &_queue[_q_head] : NULL;
+    int len = (f != NULL && _my_slot >= 0 && !_leaving) ? f->len + RYLR998_LINK_HDR_SIZE + RYLR998_LINK_SEQ_SIZE : 2;
+    int latest = slot_start + _slot_ms - RYLR998_TDMA_GUARD_MS - _rylr.get_time_on_air_us(len) / 1000;
+
+    _sent_this_sf = true;
+    if (offset > latest)
+        return;     // too late for this superframe
+
+    if (_my_slot < 0)
+    {
+        _send_control(0, RYLR998_TDMA_JOIN);
+        if (_join_backoff < 4)
+            _join_backoff++;
+        return;
+    }
+
+    if (_leaving)
+    {
+        _send_control(0, RYLR998_TDMA_LEAVE);
+        _leaving = false;
+        _my_slot = -1;
+        return;
+    }
+
+    if (f != NULL)
+    {
+        _rylr.send(f->addr, f->data, f->len);
+        _q_head = (_q_head + 1) % RYLR998_TDMA_TX_QUEUE;
+        _q_count--;
+        _stats.slots_used++;
+        _last_sent_sf = _sf_count;
+    }
+    else if (_sf_count - _last_sent_sf >= RYLR998_TDMA_IDLE_SUPERFRAMES / 3)
+    {
+        _send_control(0, RYLR998_TDMA_KEEPALIVE);
+        _last_sent_sf = _sf_count;
+    }
+
+    if (_stats.slots_total > 0)
+        _utilization = 100 * _stats.slots_used / _stats.slots_total;
+}
+
+void RYLR998_TDMA::_send_control(int addr, int type)
+{
+    char frame[2] = { (char)RYLR998_TDMA_MAGIC, (char)type };
+    _rylr.send(addr, frame, sizeof(frame));
+}
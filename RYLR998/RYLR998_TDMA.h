@@ -0,0 +1,211 @@
+/*
+ * Copyright (c) 2023, Nuvoton Technology Corporation
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef __RYLR998_TDMA_H__
+#define __RYLR998_TDMA_H__
+
+#include <stdint.h>
+#include "RYLR998.h"
+
+#ifndef RYLR998_TDMA_MAX_SLOTS
+#define RYLR998_TDMA_MAX_SLOTS      128
+#endif
+
+#ifndef RYLR998_TDMA_TX_QUEUE
+#define RYLR998_TDMA_TX_QUEUE       2
+#endif
+
+#ifndef RYLR998_TDMA_GUARD_MS
+#define RYLR998_TDMA_GUARD_MS       20      // per slot, for UART and drift
+#endif
+
+#ifndef RYLR998_TDMA_MAX_MISSED
+#define RYLR998_TDMA_MAX_MISSED     3       // beacons missed before a node stops sending
+#endif
+
+#ifndef RYLR998_TDMA_IDLE_SUPERFRAMES
+#define RYLR998_TDMA_IDLE_SUPERFRAMES   12  // silent superframes before a slot is freed
+#endif
+
+#ifndef RYLR998_TDMA_BEACON_ACKS
+#define RYLR998_TDMA_BEACON_ACKS    8       // slot assignments announced per beacon
+#endif
+
+/* TDMA control frame: magic, type, then per type
+ * beacon: seq, beacon_ms (u16), slot_ms (u16), slots, contention slots,
+ *         assignment count, { addr (u16), slot } ...
+ * join, leave, keepalive: nothing more
+ * data: application data that starts with the magic, escaped
+ */
+#define RYLR998_TDMA_MAGIC          0xA9
+#define RYLR998_TDMA_DATA           0
+#define RYLR998_TDMA_BEACON         1
+#define RYLR998_TDMA_JOIN           2
+#define RYLR998_TDMA_LEAVE          3
+#define RYLR998_TDMA_KEEPALIVE      4
+#define RYLR998_TDMA_BEACON_HDR     10
+
+/** RYLR998_TDMA class.
+    Time slotted access for dense networks.
+
+    The gateway broadcasts a beacon at the start of every superframe. A
+    superframe is the beacon slot, one slot per joined node and a few
+    contention slots for join requests. Slots are sized from the time on
+    air of a full frame with the current RF parameters plus a guard time.
+
+    Nodes sync to the beacon arrival time, corrected for the beacon time on
+    air, and only send in their own slot. A node that misses more than
+    RYLR998_TDMA_MAX_MISSED beacons stops sending until it hears one again.
+    Beacon to beacon drift is measured and applied to the superframe period.
+    The gateway frees slots that stay silent, so nodes send a keepalive when
+    they have nothing else to send for a while.
+
+    Both roles must call recv() regularly: it runs the schedule, handles
+    control frames and returns application data.
+ */
+class RYLR998_TDMA {
+public:
+    /**
+    * @param rylr the driver
+    * @param gateway true for the gateway role, false for a node
+    */
+    RYLR998_TDMA(RYLR998 &rylr, bool gateway);
+
+    struct tdma_stats {
+        uint32_t superframes;       // superframes started (gateway) or synced (node)
+        uint32_t beacons_missed;    // node only
+        uint32_t slots_total;       // assigned slots offered
+        uint32_t slots_used;        // assigned slots that carried a frame
+        uint32_t tx_dropped;        // frames dropped on a full queue
+        int joined;                 // nodes holding a slot (gateway) or own slot, -1 if none (node)
+        int drift_us;               // measured superframe drift (node)
+    };
+
+    /**
+    * Start the gateway schedule
+    *
+    * @param slots data slots per superframe, up to RYLR998_TDMA_MAX_SLOTS
+    * @param contention contention slots for joins
+    * @param max_len the largest payload a node sends in its slot
+    * @return false if the RF parameters are unknown or the role is not gateway
+    */
+    bool start(int slots, int contention = 2, int max_len = RYLR998_MAX_PAYLOAD);
+
+    /**
+    * Queue data for the node's next slot
+    *
+    * On the gateway the data is sent at once; keep downlinks sparse. Data
+    * that starts with RYLR998_TDMA_MAGIC takes two more bytes on air.
+    *
+    * @param addr the destination address
+    * @param data point to the data
+    * @param len the data length
+    * @return false if the queue is full or len is too big
+    */
+    bool send(int addr, const char *data, int len);
+
+    /**
+    * Leave the network, freeing the node's slot
+    */
+    void leave(void);
+
+    /**
+    * Run the schedule and get received data
+    *
+    * @param addr the transmitter address
+    * @param data buffer that store the receive data
+    * @param size the data buffer size
+    * @return the real data size stored in buffer, 0 if none
+    */
+    int recv(int &addr, char *data, int size);
+
+    /**
+    * Return the slot utilization counters
+    *
+    * @return tdma_stats
+    */
+    struct tdma_stats get_stats(void);
+
+    /**
+    * Return the slot utilization of the last superframes
+    *
+    * @return used slots per offered slot, in percent
+    */
+    int get_utilization(void) {
+        return _utilization;
+    }
+
+private:
+    struct _Tx_Frame {
+        int addr;
+        int len;
+        char data[RYLR998_MAX_PAYLOAD];
+    };
+
+    RYLR998 &_rylr;
+    bool _gateway;
+
+    // Superframe layout
+    int _beacon_ms;
+    int _slot_ms;
+    int _slots;
+    int _contention;
+    uint32_t _period_us;
+    uint32_t _sf_start;         // ms
+    uint32_t _sf_count;
+    uint8_t _beacon_seq;
+
+    // Gateway
+    bool _running;
+    uint16_t _owner[RYLR998_TDMA_MAX_SLOTS];      // 0 for a free slot
+    uint32_t _last_heard[RYLR998_TDMA_MAX_SLOTS]; // superframe of the latest frame
+    bool _heard[RYLR998_TDMA_MAX_SLOTS];          // frame in this superframe
+    uint8_t _acks[RYLR998_TDMA_BEACON_ACKS];      // slots to announce
+    int _nacks;
+
+    // Node
+    bool _synced;
+    bool _active;               // wants a slot
+    bool _leaving;              // send a leave in the next own slot
+    int _my_addr;
+    int _my_slot;
+    uint32_t _last_beacon;      // start of the latest beacon heard, ms
+    int _missed;
+    bool _sent_this_sf;
+    uint32_t _last_sent_sf;
+    int _join_backoff;
+    int _join_slot;             // contention slot of this superframe, -1 if not drawn
+    int _drift_us;
+    _Tx_Frame _queue[RYLR998_TDMA_TX_QUEUE];
+    int _q_head;
+    int _q_count;
+
+    int _utilization;
+    struct tdma_stats _stats;
+
+    uint32_t _now_ms(void);
+    void _service(uint32_t now);
+    void _gateway_beacon(uint32_t now);
+    void _gateway_control(int addr, const uint8_t *frame);
+    void _gateway_heard(int addr);
+    void _node_beacon(const uint8_t *frame, int len, uint32_t rx_time);
+    void _node_slot(uint32_t now);
+    void _send_control(int addr, int type);
+};
+
+#endif // __RYLR998_TDMA_H__
@@ -0,0 +1,265 @@
+/*
+ * Copyright (c) 2023, Nuvoton Technology Corporation
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/un.h>
+
+#include "RYLR998_Bridge.h"
+
+RYLR998_Bridge::RYLR998_Bridge(RYLR998 &rylr)
+    : _rylr(rylr),
+      _fd(-1),
+      _peer_len(0),
+      _batch_len(0),
+      _batch_count(0),
+      _batch_seq(0)
+{
+    memset(&_stats, 0, sizeof(_stats));
+}
+
+RYLR998_Bridge::~RYLR998_Bridge()
+{
+    _close();
+}
+
+void RYLR998_Bridge::_close(void)
+{
+    if (_fd >= 0)
+        close(_fd);
+    _fd = -1;
+}
+
+bool RYLR998_Bridge::open_unix(const char *path, const char *peer)
+{
+    struct sockaddr_un local;
+
+    if (strlen(path) >= sizeof(local.sun_path) || strlen(peer) >= sizeof(local.sun_path))
+        return false;
+
+    _close();
+    _fd = socket(AF_UNIX, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (_fd < 0)
+        return false;
+
+    memset(&local, 0, sizeof(local));
+    local.sun_family = AF_UNIX;
+    strcpy(local.sun_path, path);
+    unlink(path);
+    if (bind(_fd, (struct sockaddr *)&local, sizeof(local)) < 0)
+    {
+        _close();
+        return false;
+    }
+
+    struct sockaddr_un *remote = (struct sockaddr_un *)&_peer;
+    memset(&_peer, 0, sizeof(_peer));
+    remote->sun_family = AF_UNIX;
+    strcpy(remote->sun_path, peer);
+    _peer_len = sizeof(struct sockaddr_un);
+
+    return true;
+}
+
+bool RYLR998_Bridge::open_udp(int port, const char *peer_ip, int peer_port)
+{
+    struct sockaddr_in local;
+    struct sockaddr_in *remote = (struct sockaddr_in *)&_peer;
+
+    memset(&_peer, 0, sizeof(_peer));
+    remote->sin_family = AF_INET;
+    remote->sin_port = htons(peer_port);
+    if (inet_pton(AF_INET, peer_ip, &remote->sin_addr) != 1)
+        return false;
+    _peer_len = sizeof(struct sockaddr_in);
+
+    _close();
+    _fd = socket(AF_INET, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (_fd < 0)
+        return false;
+
+    memset(&local, 0, sizeof(local));
+    local.sin_family = AF_INET;
+    local.sin_port = htons(port);
+    local.sin_addr.s_addr = htonl(INADDR_ANY);
+    if (bind(_fd, (struct sockaddr *)&local, sizeof(local)) < 0)
+    {
+        _close();
+        return false;
+    }
+
+    return true;
+}
+
+int RYLR998_Bridge::forward(void)
+{
+    int n = 0;
+
+    // Only what poll() already took in, reading the port here could wait
+    // for the module and hold up the event loop
+    while (true)
+    {
+        int size = _rylr.pull_size();
+        if (size <= 0)
+            break;
+
+        // recv() terminates the data, so keep a byte spare after it
+        if (_batch_count == 255
+            || _batch_len + RYLR998_BRIDGE_UP_REC_SIZE + size + 1 > (int)sizeof(_batch))
+            _flush();
+
+        if (_batch_count == 0)
+            _batch_len = RYLR998_BRIDGE_HDR_SIZE;
+
+        // The frame lands in the datagram buffer, behind its record header
+        uint8_t *rec = _batch + _batch_len;
+        int addr;
+        int len = _rylr.pull(addr, (char *)rec + RYLR998_BRIDGE_UP_REC_SIZE, size);
+        if (len <= 0)
+            break;
+
+        int rssi = _rylr.get_rssi();
+        uint32_t time = _rylr.get_timestamp();
+
+        rec[0] = addr & 0xFF;
+        rec[1] = (addr >> 8) & 0xFF;
+        rec[2] = rssi & 0xFF;
+        rec[3] = (rssi >> 8) & 0xFF;
+        rec[4] = (uint8_t)(int8_t)_rylr.get_snr();
+        rec[5] = time & 0xFF;
+        rec[6] = (time >> 8) & 0xFF;
+        rec[7] = (time >> 16) & 0xFF;
+        rec[8] = (time >> 24) & 0xFF;
+        rec[9] = len;
+
+        _batch_len += RYLR998_BRIDGE_UP_REC_SIZE + len;
+        _batch_count++;
+        n++;
+    }
+
+    _flush();
+
+    return n;
+}
+
+void RYLR998_Bridge::_flush(void)
+{
+    if (_batch_count == 0)
+        return;
+
+    _batch[0] = RYLR998_BRIDGE_MAGIC;
+    _batch[1] = RYLR998_BRIDGE_UPLINK;
+    _batch[2] = _batch_count;
+    _batch[3] = _batch_seq++;
+
+    ssize_t r = -1;
+    if (_fd >= 0)
+    {
+        do {
+            r = sendto(_fd, _batch, _batch_len, MSG_DONTWAIT,
+                       (struct sockaddr *)&_peer, _peer_len);
+        } while (r < 0 && errno == EINTR);
+    }
+
+    if (r == _batch_len)
+    {
+        // Latency of the oldest frame in the batch
+        uint32_t now = rylr998_port::now_ms();
+        uint32_t first = _batch[RYLR998_BRIDGE_HDR_SIZE + 5]
+                         | (_batch[RYLR998_BRIDGE_HDR_SIZE + 6] << 8)
+                         | (_batch[RYLR998_BRIDGE_HDR_SIZE + 7] << 16)
+                         | ((uint32_t)_batch[RYLR998_BRIDGE_HDR_SIZE + 8] << 24);
+        uint32_t latency = now - first;
+
+        _stats.frames_up += _batch_count;
+        _stats.batches_up++;
+        _stats.latency_last_ms = latency;
+        if (latency > _stats.latency_max_ms)
+            _stats.latency_max_ms = latency;
+    }
+    else
+    {
+        _stats.frames_lost += _batch_count;
+    }
+
+    _batch_len = 0;
+    _batch_count = 0;
+}
+
+int RYLR998_Bridge::service(void)
+{
+    uint8_t buf[RYLR998_BRIDGE_DATAGRAM];
+    int sent = 0;
+
+    if (_fd < 0)
+        return 0;
+
+    while (true)
+    {
+        ssize_t len = ::recv(_fd, buf, sizeof(buf), MSG_DONTWAIT);
+        if (len < 0 && errno == EINTR)
+            continue;
+        if (len < 0)
+            break;
+
+        if (len < RYLR998_BRIDGE_HDR_SIZE || buf[0] != RYLR998_BRIDGE_MAGIC
+            || buf[1] != RYLR998_BRIDGE_DOWNLINK)
+        {
+            _stats.bad_datagrams++;
+            continue;
+        }
+
+        int count = buf[2];
+        int o = RYLR998_BRIDGE_HDR_SIZE;
+
+        for (int i = 0; i < count; i++)
+        {
+            if (o + RYLR998_BRIDGE_DOWN_REC_SIZE > len
+                || o + RYLR998_BRIDGE_DOWN_REC_SIZE + buf[o + 2] > len)
+            {
+                _stats.bad_datagrams++;
+                break;
+            }
+
+            int addr = buf[o] | (buf[o + 1] << 8);
+            int dlen = buf[o + 2];
+
+            if (_rylr.send(addr, (const char *)buf + o + RYLR998_BRIDGE_DOWN_REC_SIZE, dlen))
+            {
+                _stats.frames_down++;
+                sent++;
+            }
+            else
+            {
+                _stats.send_failed++;
+            }
+
+            o += RYLR998_BRIDGE_DOWN_REC_SIZE + dlen;
+        }
+    }
+
+    // Frames that arrived while waiting for the module to accept the
+    // downlinks are already read from the port, epoll will not report them
+    _rylr.poll();
+    forward();
+
+    return sent;
+}
@@ -0,0 +1,146 @@
+/*
+ * Copyright (c) 2023, Nuvoton Technology Corporation
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef __RYLR998_BRIDGE_H__
+#define __RYLR998_BRIDGE_H__
+
+#include <stdint.h>
+#include <sys/socket.h>
+#include "RYLR998.h"
+
+#ifndef RYLR998_BRIDGE_DATAGRAM
+#define RYLR998_BRIDGE_DATAGRAM     1472    // fits one Ethernet frame over UDP
+#endif
+
+/* Bridge datagram: magic, type, record count, batch sequence, then records
+ * uplink:   addr (u16), rssi (i16), snr (i8), time ms (u32), len (u8), data
+ * downlink: addr (u16), len (u8), data
+ * Multi-byte fields are little endian.
+ */
+#define RYLR998_BRIDGE_MAGIC        0xB5
+#define RYLR998_BRIDGE_UPLINK       1
+#define RYLR998_BRIDGE_DOWNLINK     2
+#define RYLR998_BRIDGE_HDR_SIZE     4
+#define RYLR998_BRIDGE_UP_REC_SIZE  10
+#define RYLR998_BRIDGE_DOWN_REC_SIZE    3
+
+/** RYLR998_Bridge class.
+    Forwards received frames to a local datagram socket and sends the
+    downlinks that come back.
+
+    forward() drains the packets the driver already took in, with pull()
+    rather than recv(), so it never waits on the serial port. They go
+    straight into a datagram buffer, one record per frame with its
+    metadata, and all frames waiting are written as a single datagram. service() reads downlink datagrams and sends each
+    record from the datagram buffer. Both never block on the socket: a
+    batch the peer can not take is dropped and counted.
+
+    @code
+    RYLR998_Bridge bridge(rylr);
+    bridge.open_unix("/run/rylr998.sock", "/run/lora-app.sock");
+    loop.add(rylr, [&](RYLR998 &) { bridge.forward(); });
+    loop.add(bridge.get_fd(), [&]() { bridge.service(); });
+    @endcode
+ */
+class RYLR998_Bridge {
+public:
+    RYLR998_Bridge(RYLR998 &rylr);
+    ~RYLR998_Bridge();
+
+    struct bridge_stats {
+        uint32_t frames_up;         // frames forwarded to the peer
+        uint32_t batches_up;        // datagrams written
+        uint32_t frames_lost;       // frames in batches the peer did not take
+        uint32_t frames_down;       // downlink frames sent by the module
+        uint32_t send_failed;       // downlink frames the module did not take
+        uint32_t bad_datagrams;     // malformed downlink datagrams
+        uint32_t latency_last_ms;   // frame arrival to datagram write
+        uint32_t latency_max_ms;
+    };
+
+    /**
+    * Open a Unix datagram socket
+    *
+    * @param path the local socket path, replaced if it exists
+    * @param peer the socket path of the application
+    * @return false on socket errors
+    */
+    bool open_unix(const char *path, const char *peer);
+
+    /**
+    * Open a UDP socket
+    *
+    * @param port the local port, on all interfaces
+    * @param peer_ip the IPv4 address of the application
+    * @param peer_port the port of the application
+    * @return false on socket errors
+    */
+    bool open_udp(int port, const char *peer_ip, int peer_port);
+
+    /**
+    * Return the socket to watch for downlinks
+    *
+    * @return the descriptor, -1 if not open
+    */
+    int get_fd(void) {
+        return _fd;
+    }
+
+    /**
+    * Forward every frame the driver has taken in to the peer
+    *
+    * Call it after RYLR998::poll(), as the RYLR998_EventLoop handler does.
+    *
+    * @return the number of frames forwarded
+    */
+    int forward(void);
+
+    /**
+    * Send the pending downlinks
+    *
+    * @return the number of frames sent
+    */
+    int service(void);
+
+    /**
+    * Return the bridge counters
+    *
+    * @return bridge_stats
+    */
+    struct bridge_stats get_stats(void) {
+        return _stats;
+    }
+
+private:
+    RYLR998 &_rylr;
+    int _fd;
+    struct sockaddr_storage _peer;
+    socklen_t _peer_len;
+
+    uint8_t _batch[RYLR998_BRIDGE_DATAGRAM];
+    int _batch_len;
+    int _batch_count;
+    uint8_t _batch_seq;
+
+    struct bridge_stats _stats;
+
+    void _close(void);
+    void _flush(void);
+};
+
+#endif // __RYLR998_BRIDGE_H__
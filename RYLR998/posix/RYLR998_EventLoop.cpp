@@ -0,0 +1,173 @@
+/*
+ * Copyright (c) 2023, Nuvoton Technology Corporation
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <errno.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+
+#include "RYLR998_EventLoop.h"
+
+RYLR998_EventLoop::RYLR998_EventLoop()
+    : _running(false)
+{
+    _epfd = epoll_create1(EPOLL_CLOEXEC);
+
+    for (int i = 0; i < RYLR998_EVENT_LOOP_MODULES; i++)
+    {
+        _modules[i].fd = -1;
+        _modules[i].rylr = nullptr;
+    }
+}
+
+RYLR998_EventLoop::~RYLR998_EventLoop()
+{
+    if (_epfd >= 0)
+        close(_epfd);
+}
+
+RYLR998_EventLoop::_Module *RYLR998_EventLoop::_watch(int fd)
+{
+    if (_epfd < 0 || fd < 0)
+        return nullptr;
+
+    for (int i = 0; i < RYLR998_EVENT_LOOP_MODULES; i++)
+    {
+        if (_modules[i].fd >= 0)
+            continue;
+
+        struct epoll_event ev;
+        ev.events = EPOLLIN;
+        ev.data.ptr = &_modules[i];
+        if (epoll_ctl(_epfd, EPOLL_CTL_ADD, fd, &ev) < 0)
+            return nullptr;
+
+        _modules[i].fd = fd;
+        return &_modules[i];
+    }
+
+    return nullptr;
+}
+
+bool RYLR998_EventLoop::add(RYLR998 &rylr, Handler handler)
+{
+    _Module *m = _watch(rylr.get_fd());
+    if (m == nullptr)
+        return false;
+
+    m->rylr = &rylr;
+    m->handler = handler;
+    return true;
+}
+
+bool RYLR998_EventLoop::add(int fd, rylr998_port::Callback handler)
+{
+    _Module *m = _watch(fd);
+    if (m == nullptr)
+        return false;
+
+    m->rylr = nullptr;
+    m->io = handler;
+    return true;
+}
+
+void RYLR998_EventLoop::remove(RYLR998 &rylr)
+{
+    remove(rylr.get_fd());
+}
+
+void RYLR998_EventLoop::remove(int fd)
+{
+    for (int i = 0; i < RYLR998_EVENT_LOOP_MODULES; i++)
+    {
+        if (fd < 0 || _modules[i].fd != fd)
+            continue;
+
+        epoll_ctl(_epfd, EPOLL_CTL_DEL, fd, nullptr);
+        _modules[i].fd = -1;
+        _modules[i].rylr = nullptr;
+        _modules[i].handler = nullptr;
+        _modules[i].io = nullptr;
+    }
+}
+
+int RYLR998_EventLoop::run_once(int timeout_ms)
+{
+    struct epoll_event events[RYLR998_EVENT_LOOP_MODULES];
+    bool served[RYLR998_EVENT_LOOP_MODULES] = { false };
+
+    // A sleeping module sends nothing, wake up in time for its schedule
+    for (int i = 0; i < RYLR998_EVENT_LOOP_MODULES; i++)
+    {
+        if (_modules[i].fd < 0 || _modules[i].rylr == nullptr)
+            continue;
+
+        int deadline = _modules[i].rylr->get_power_deadline();
+        if (deadline >= 0 && (timeout_ms < 0 || deadline < timeout_ms))
+            timeout_ms = deadline;
+    }
+
+    int n = epoll_wait(_epfd, events, RYLR998_EVENT_LOOP_MODULES, timeout_ms);
+    if (n < 0)
+        return (errno == EINTR) ? 0 : -1;
+
+    for (int i = 0; i < n; i++)
+    {
+        _Module *m = (_Module *)events[i].data.ptr;
+
+        // A handler may have removed it
+        if (m->fd < 0)
+            continue;
+
+        if (m->rylr == nullptr)
+        {
+            if (m->io)
+                m->io();
+            continue;
+        }
+
+        // poll() consumes everything buffered so far, epoll wakes us for more
+        served[m - _modules] = true;
+        if (m->rylr->poll() > 0 && m->handler)
+            m->handler(*m->rylr);
+    }
+
+    // poll() also runs the power save schedule
+    for (int i = 0; i < RYLR998_EVENT_LOOP_MODULES; i++)
+    {
+        _Module *m = &_modules[i];
+        if (m->fd < 0 || m->rylr == nullptr || served[i] || m->rylr->get_power_deadline() != 0)
+            continue;
+
+        n++;
+        if (m->rylr->poll() > 0 && m->handler)
+            m->handler(*m->rylr);
+    }
+
+    return n;
+}
+
+void RYLR998_EventLoop::run(void)
+{
+    _running = true;
+
+    while (_running)
+    {
+        if (run_once(-1) < 0)
+            break;
+    }
+}
@@ -0,0 +1,128 @@
+/*
+ * Copyright (c) 2023, Nuvoton Technology Corporation
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef __RYLR998_EVENTLOOP_H__
+#define __RYLR998_EVENTLOOP_H__
+
+#include <functional>
+#include "RYLR998.h"
+
+#ifndef RYLR998_EVENT_LOOP_MODULES
+#define RYLR998_EVENT_LOOP_MODULES  16
+#endif
+
+/** RYLR998_EventLoop class.
+    Serves many modules from one thread with epoll.
+
+    Each module's serial port is watched for input. When one becomes
+    readable its driver processes the pending frames with poll() and the
+    handler is called if packets are waiting; it should pull them all with
+    recv(). poll() does not wait for the end of a line still arriving.
+    A module in power save is also polled when its schedule comes due,
+    whether or not it sent anything.
+
+    Commands and send() from a handler run synchronously on the same
+    thread. Frames that arrive during a command are read from the port
+    with its reply, so after commands issued outside the module's handler
+    call the handler again or they wait for the next input.
+
+    @code
+    RYLR998 a("/dev/ttyUSB0"), b("/dev/ttyUSB1");
+    RYLR998_EventLoop loop;
+    loop.add(a, on_packet);
+    loop.add(b, on_packet);
+    loop.run();
+    @endcode
+ */
+class RYLR998_EventLoop {
+public:
+    typedef std::function<void(RYLR998 &)> Handler;
+
+    RYLR998_EventLoop();
+    ~RYLR998_EventLoop();
+
+    /**
+    * Watch a module
+    *
+    * @param rylr the driver, must outlive the loop or be removed first
+    * @param handler called with the driver when it has packets waiting
+    * @return false if the module's port is not open or the loop is full
+    */
+    bool add(RYLR998 &rylr, Handler handler);
+
+    /**
+    * Stop watching a module
+    *
+    * @param rylr the driver
+    */
+    void remove(RYLR998 &rylr);
+
+    /**
+    * Watch another descriptor, e.g. a bridge socket
+    *
+    * @param fd the descriptor
+    * @param handler called when fd is readable
+    * @return false if the loop is full
+    */
+    bool add(int fd, rylr998_port::Callback handler);
+
+    /**
+    * Stop watching a descriptor
+    *
+    * @param fd the descriptor
+    */
+    void remove(int fd);
+
+    /**
+    * Wait for input once and serve the readable modules
+    *
+    * The wait ends early when a module's power save schedule is due.
+    *
+    * @param timeout_ms how long to wait, -1 for ever
+    * @return the number of modules and descriptors served, -1 on error
+    */
+    int run_once(int timeout_ms);
+
+    /**
+    * Serve modules until stop() is called
+    */
+    void run(void);
+
+    /**
+    * Make run() return, callable from a handler
+    */
+    void stop(void) {
+        _running = false;
+    }
+
+private:
+    struct _Module {
+        int fd;             // -1 for a free entry
+        RYLR998 *rylr;      // nullptr for a plain descriptor
+        Handler handler;
+        rylr998_port::Callback io;
+    };
+
+    int _epfd;
+    volatile bool _running;
+    _Module _modules[RYLR998_EVENT_LOOP_MODULES];
+
+    _Module *_watch(int fd);
+};
+
+#endif // __RYLR998_EVENTLOOP_H__
@@ -0,0 +1,129 @@
+/*
+ * Copyright (c) 2023, Nuvoton Technology Corporation
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "RYLR998_FileStorage.h"
+
+RYLR998_FileStorage::RYLR998_FileStorage(const char *path, uint32_t size, uint32_t erase_size,
+                                         uint32_t program_size)
+    : _size(size),
+      _erase_size(erase_size),
+      _program_size(program_size)
+{
+    _fd = ::open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+    if (_fd < 0)
+        return;
+
+    // A new or shorter file is extended with erased blocks
+    struct stat st;
+    if (fstat(_fd, &st) == 0 && (uint64_t)st.st_size < size)
+    {
+        uint32_t from = st.st_size / erase_size * erase_size;
+        if (erase(from, size - from) != 0)
+        {
+            ::close(_fd);
+            _fd = -1;
+        }
+    }
+}
+
+RYLR998_FileStorage::~RYLR998_FileStorage()
+{
+    if (_fd >= 0)
+        ::close(_fd);
+}
+
+bool RYLR998_FileStorage::_check(uint32_t addr, uint32_t size, uint32_t unit)
+{
+    return _fd >= 0 && addr % unit == 0 && size % unit == 0
+           && addr <= _size && size <= _size - addr;
+}
+
+int RYLR998_FileStorage::read(void *buffer, uint32_t addr, uint32_t size)
+{
+    if (!_check(addr, size, 1))
+        return -1;
+
+    uint8_t *p = (uint8_t *)buffer;
+    uint32_t done = 0;
+    while (done < size)
+    {
+        ssize_t n = ::pread(_fd, p + done, size - done, addr + done);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return -1;
+        done += n;
+    }
+
+    return 0;
+}
+
+int RYLR998_FileStorage::program(const void *buffer, uint32_t addr, uint32_t size)
+{
+    uint8_t chunk[256];
+    const uint8_t *p = (const uint8_t *)buffer;
+
+    if (!_check(addr, size, _program_size))
+        return -1;
+
+    // Read, clear bits, write back
+    for (uint32_t o = 0; o < size; o += sizeof(chunk))
+    {
+        uint32_t n = (size - o < sizeof(chunk)) ? size - o : sizeof(chunk);
+        if (read(chunk, addr + o, n) != 0)
+            return -1;
+        for (uint32_t i = 0; i < n; i++)
+            chunk[i] &= p[o + i];
+        if (::pwrite(_fd, chunk, n, addr + o) != (ssize_t)n)
+            return -1;
+    }
+
+    return 0;
+}
+
+int RYLR998_FileStorage::erase(uint32_t addr, uint32_t size)
+{
+    uint8_t chunk[256];
+
+    if (!_check(addr, size, _erase_size))
+        return -1;
+
+    memset(chunk, 0xFF, sizeof(chunk));
+    for (uint32_t o = 0; o < size; o += sizeof(chunk))
+    {
+        uint32_t n = (size - o < sizeof(chunk)) ? size - o : sizeof(chunk);
+        if (::pwrite(_fd, chunk, n, addr + o) != (ssize_t)n)
+            return -1;
+    }
+
+    return 0;
+}
+
+int RYLR998_FileStorage::sync(void)
+{
+    if (_fd < 0)
+        return -1;
+
+    return (::fdatasync(_fd) == 0) ? 0 : -1;
+}
@@ -0,0 +1,77 @@
+/*
+ * Copyright (c) 2023, Nuvoton Technology Corporation
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef __RYLR998_FILESTORAGE_H__
+#define __RYLR998_FILESTORAGE_H__
+
+#include <stdint.h>
+#include "RYLR998_Spool.h"
+
+/** RYLR998_FileStorage class.
+    Spool storage in a regular file, behaving like NOR flash.
+
+    The file is created erased (0xFF) at the given size. Programs clear
+    bits only, as on flash, so a program over data that was not erased
+    shows up as corruption instead of silently working. sync() is fsync().
+ */
+class RYLR998_FileStorage : public RYLR998_Storage {
+public:
+    /**
+    * @param path the file, created if missing
+    * @param size the storage size, a multiple of erase_size
+    * @param erase_size the erase block size
+    * @param program_size the program unit
+    */
+    RYLR998_FileStorage(const char *path, uint32_t size, uint32_t erase_size = 4096,
+                        uint32_t program_size = 1);
+    ~RYLR998_FileStorage();
+
+    /**
+    * Return true if the file opened
+    */
+    bool is_open(void) {
+        return _fd >= 0;
+    }
+
+    int read(void *buffer, uint32_t addr, uint32_t size);
+    int program(const void *buffer, uint32_t addr, uint32_t size);
+    int erase(uint32_t addr, uint32_t size);
+    int sync(void);
+
+    uint32_t get_program_size(void) {
+        return _program_size;
+    }
+
+    uint32_t get_erase_size(void) {
+        return _erase_size;
+    }
+
+    uint32_t size(void) {
+        return _size;
+    }
+
+private:
+    int _fd;
+    uint32_t _size;
+    uint32_t _erase_size;
+    uint32_t _program_size;
+
+    bool _check(uint32_t addr, uint32_t size, uint32_t unit);
+};
+
+#endif // __RYLR998_FILESTORAGE_H__
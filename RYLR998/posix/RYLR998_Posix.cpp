@@ -0,0 +1,586 @@
+/*
+ * Copyright (c) 2023, Nuvoton Technology Corporation
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <stdio.h>
+#include <string.h>
+#include <termios.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+
+#include "RYLR998_Posix.h"
+
+namespace rylr998_port {
+
+// termios has fixed rates only, anything else can not be set
+static bool _baud_to_speed(int baud, speed_t *speed)
+{
+    switch (baud)
+    {
+    case 300:    *speed = B300;    return true;
+    case 1200:   *speed = B1200;   return true;
+    case 2400:   *speed = B2400;   return true;
+    case 4800:   *speed = B4800;   return true;
+    case 9600:   *speed = B9600;   return true;
+    case 19200:  *speed = B19200;  return true;
+    case 38400:  *speed = B38400;  return true;
+    case 57600:  *speed = B57600;  return true;
+    case 115200: *speed = B115200; return true;
+#ifdef B230400
+    case 230400: *speed = B230400; return true;
+#endif
+#ifdef B460800
+    case 460800: *speed = B460800; return true;
+#endif
+#ifdef B921600
+    case 921600: *speed = B921600; return true;
+#endif
+    default:     return false;
+    }
+}
+
+Serial::Serial(const char *device, int baud)
+    : _head(0),
+      _tail(0),
+      _stamp_pos(0)
+{
+    _stamp[0] = _stamp[1] = 0;
+
+    speed_t speed;
+    if (!_baud_to_speed(baud, &speed))
+    {
+        _fd = -1;
+        return;
+    }
+
+    _fd = ::open(device, O_RDWR | O_NOCTTY | O_NONBLOCK | O_CLOEXEC);
+    if (_fd < 0)
+        return;
+
+    struct termios tio;
+    if (tcgetattr(_fd, &tio) == 0)
+    {
+        cfmakeraw(&tio);
+        tio.c_cflag |= CLOCAL | CREAD;
+        tio.c_cflag &= ~(CSTOPB | CRTSCTS);
+        tio.c_cc[VMIN] = 0;
+        tio.c_cc[VTIME] = 0;
+        cfsetispeed(&tio, speed);
+        cfsetospeed(&tio, speed);
+        tcsetattr(_fd, TCSANOW, &tio);
+    }
+}
+
+Serial::~Serial()
+{
+    if (_fd >= 0)
+        ::close(_fd);
+}
+
+bool Serial::_fill(int timeout_ms)
+{
+    if (_head != _tail)
+        return true;
+
+    if (_fd < 0)
+        return false;
+
+    while (true)
+    {
+        ssize_t n = ::read(_fd, _buf, sizeof(_buf));
+        if (n > 0)
+        {
+            _head = 0;
+            _tail = n;
+            _stamp[0] = _stamp[1] = now_ms();
+            _stamp_pos = 0;
+            return true;
+        }
+        if (n < 0 && errno == EINTR)
+            continue;
+
+        // With VMIN and VTIME at 0 an empty tty reads 0 rather than EAGAIN
+        if ((n < 0 && errno != EAGAIN && errno != EWOULDBLOCK) || timeout_ms <= 0)
+            return false;
+
+        struct pollfd pfd = { _fd, POLLIN, 0 };
+        int r = ::poll(&pfd, 1, timeout_ms);
+        if (r < 0 && errno == EINTR)
+            continue;
+        if (r <= 0)
+            return false;
+
+        // One wait per call, the caller's timeout is per byte
+        timeout_ms = 0;
+    }
+}
+
+bool Serial::readable(void)
+{
+    return _fill(0);
+}
+
+int Serial::getc(int timeout_ms)
+{
+    if (!_fill(timeout_ms))
+        return -1;
+
+    return _buf[_head++];
+}
+
+int Serial::peek(const uint8_t **data)
+{
+    // Move what is left to the front and read behind it
+    if (_head > 0)
+    {
+        memmove(_buf, _buf + _head, _tail - _head);
+        _tail -= _head;
+        _stamp_pos = (_stamp_pos > _head) ? _stamp_pos - _head : 0;
+        _head = 0;
+    }
+
+    int old = _tail;
+    while (_fd >= 0 && _tail < (int)sizeof(_buf))
+    {
+        ssize_t n = ::read(_fd, _buf + _tail, sizeof(_buf) - _tail);
+        if (n > 0)
+        {
+            _tail += n;
+            continue;
+        }
+        if (n < 0 && errno == EINTR)
+            continue;
+        break;
+    }
+
+    // Keep the time of the bytes already buffered apart from the new ones
+    if (_tail > old)
+    {
+        uint32_t now = now_ms();
+        _stamp[0] = (old > 0) ? _stamp[1] : now;
+        _stamp[1] = now;
+        _stamp_pos = old;
+    }
+
+    *data = _buf;
+    return _tail;
+}
+
+uint32_t Serial::rx_time(void)
+{
+    return (_head - 1 >= _stamp_pos) ? _stamp[1] : _stamp[0];
+}
+
+int Serial::write(const void *data, int len, int timeout_ms)
+{
+    const uint8_t *p = (const uint8_t *)data;
+    int done = 0;
+
+    if (_fd < 0)
+        return -1;
+
+    while (done < len)
+    {
+        ssize_t n = ::write(_fd, p + done, len - done);
+        if (n > 0)
+        {
+            done += n;
+            continue;
+        }
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n < 0 && errno != EAGAIN && errno != EWOULDBLOCK)
+            return -1;
+
+        struct pollfd pfd = { _fd, POLLOUT, 0 };
+        if (::poll(&pfd, 1, timeout_ms) <= 0)
+            return -1;
+    }
+
+    return len;
+}
+
+void Serial::flush_input(void)
+{
+    _head = 0;
+    _tail = 0;
+
+    if (_fd >= 0)
+        tcflush(_fd, TCIFLUSH);
+}
+
+void Serial::set_line(int line, bool asserted)
+{
+    int bits = (line == RYLR998_RESET_DTR) ? TIOCM_DTR : TIOCM_RTS;
+
+    if (_fd >= 0)
+        ioctl(_fd, (asserted) ? TIOCMBIS : TIOCMBIC, &bits);
+}
+
+Parser::Parser(Serial *serial)
+    : _serial(serial),
+      _delimiter("\r"),
+      _delim_size(1),
+      _timeout(8000),
+      _dbg_on(false),
+      _aborted(false),
+      _line_time(0),
+      _noobs(0)
+{
+}
+
+void Parser::set_delimiter(const char *delimiter)
+{
+    _delimiter = delimiter;
+    _delim_size = strlen(delimiter);
+}
+
+void Parser::oob(const char *prefix, Callback cb)
+{
+    if (_noobs == RYLR998_POSIX_MAX_OOBS)
+        return;
+
+    _oobs[_noobs].prefix = prefix;
+    _oobs[_noobs].len = strlen(prefix);
+    _oobs[_noobs].cb = cb;
+    _noobs++;
+}
+
+int Parser::_getc(void)
+{
+    return _serial->getc(_timeout);
+}
+
+bool Parser::_check_oob(int len, bool &restart)
+{
+    for (int i = 0; i < _noobs; i++)
+    {
+        if (len == _oobs[i].len && memcmp(_oobs[i].prefix, _buffer, len) == 0)
+        {
+            if (_dbg_on)
+                fprintf(stderr, "AT! %s\n", _oobs[i].prefix);
+            _oobs[i].cb();
+            restart = !_aborted;
+            return true;
+        }
+    }
+
+    return false;
+}
+
+int Parser::_suppress(const char *in, int len, char *out, int size)
+{
+    // Clobber every conversion with '*' and end with %n, so a sscanf pass
+    // tells how much of the input the format matched
+    int o = 0;
+
+    for (int i = 0; i < len; i++)
+    {
+        if (o + 4 >= size)
+            return -1;
+
+        out[o++] = in[i];
+        if (in[i] == '%' && i + 1 < len)
+        {
+            if (in[i + 1] == '%')
+                out[o++] = in[++i];
+            else if (in[i + 1] != '*')
+                out[o++] = '*';
+        }
+    }
+
+    out[o++] = '%';
+    out[o++] = 'n';
+    out[o] = '\0';
+
+    return o;
+}
+
+bool Parser::send(const char *command, ...)
+{
+    va_list args;
+    va_start(args, command);
+    int n = vsnprintf(_buffer, sizeof(_buffer), command, args);
+    va_end(args);
+
+    if (n < 0 || n >= (int)sizeof(_buffer))
+        return false;
+
+    if (_dbg_on)
+        fprintf(stderr, "AT> %s\n", _buffer);
+
+    return _serial->write(_buffer, n, _timeout) == n
+           && _serial->write(_delimiter, _delim_size, _timeout) == _delim_size;
+}
+
+bool Parser::recv(const char *response, ...)
+{
+    va_list args;
+    va_start(args, response);
+
+restart:
+    _aborted = false;
+    const char *resp = response;
+
+    // Each line of the response is matched against received lines, lines
+    // that do not match are skipped
+    while (*resp)
+    {
+        int i = 0;
+        while (resp[i] && resp[i] != '\n')
+            i++;
+        bool whole_line = resp[i] == '\n';
+
+        char seg[RYLR998_POSIX_PARSER_BUFFER];
+        if (i >= (int)sizeof(seg) || _suppress(resp, i, _format, sizeof(_format)) < 0)
+        {
+            va_end(args);
+            return false;
+        }
+        memcpy(seg, resp, i);
+        seg[i] = '\0';
+
+        int j = 0;
+        while (true)
+        {
+            int c = _getc();
+            if (c < 0)
+            {
+                va_end(args);
+                return false;
+            }
+
+            if (j + 1 >= (int)sizeof(_buffer))
+                j = 0;
+            if (j == 0)
+                _line_time = _serial->rx_time();
+            _buffer[j++] = c;
+            _buffer[j] = '\0';
+
+            bool again = false;
+            if (_check_oob(j, again))
+            {
+                if (!again)
+                {
+                    va_end(args);
+                    return false;
+                }
+                va_end(args);
+                va_start(args, response);
+                goto restart;
+            }
+
+            bool at_delim = j >= _delim_size
+                            && memcmp(_buffer + j - _delim_size, _delimiter, _delim_size) == 0;
+            if (whole_line && !at_delim)
+                continue;
+
+            int len = (whole_line) ? j - _delim_size : j;
+            char saved = _buffer[len];
+            int count = -1;
+
+            _buffer[len] = '\0';
+            sscanf(_buffer, _format, &count);
+
+            if (count == len)
+            {
+                if (_dbg_on)
+                    fprintf(stderr, "AT= %s\n", _buffer);
+
+                va_list values;
+                va_copy(values, args);
+                vsscanf(_buffer, seg, values);
+                va_end(values);
+
+                // Step over the pointers this line consumed
+                for (int k = 0; k < i; k++)
+                {
+                    if (seg[k] != '%')
+                        continue;
+                    if (seg[k + 1] == '%' || seg[k + 1] == '*')
+                    {
+                        k++;
+                        continue;
+                    }
+                    (void)va_arg(args, void *);
+                }
+
+                resp += i + ((whole_line) ? 1 : 0);
+                break;
+            }
+
+            _buffer[len] = saved;
+            if (at_delim)
+            {
+                if (_dbg_on)
+                    fprintf(stderr, "AT< %.*s\n", j - _delim_size, _buffer);
+                j = 0;
+            }
+        }
+    }
+
+    va_end(args);
+    return true;
+}
+
+int Parser::printf(const char *format, ...)
+{
+    va_list args;
+    va_start(args, format);
+    int n = vsnprintf(_buffer, sizeof(_buffer), format, args);
+    va_end(args);
+
+    if (n < 0 || n >= (int)sizeof(_buffer))
+        return -1;
+
+    if (_dbg_on)
+        fprintf(stderr, "AT> %s", _buffer);
+
+    return (_serial->write(_buffer, n, _timeout) == n) ? n : -1;
+}
+
+int Parser::scanf(const char *format, ...)
+{
+    if (_suppress(format, strlen(format), _format, sizeof(_format)) < 0)
+        return -1;
+
+    int j = 0;
+    while (true)
+    {
+        if (j + 1 >= (int)sizeof(_buffer))
+            return -1;
+
+        int c = _getc();
+        if (c < 0)
+            return -1;
+
+        _buffer[j++] = c;
+        _buffer[j] = '\0';
+
+        // Stop as soon as the whole format is matched
+        int count = -1;
+        sscanf(_buffer, _format, &count);
+        if (count == j)
+            break;
+    }
+
+    va_list args;
+    va_start(args, format);
+    vsscanf(_buffer, format, args);
+    va_end(args);
+
+    return j;
+}
+
+int Parser::read(char *data, int size)
+{
+    for (int i = 0; i < size; i++)
+    {
+        int c = _getc();
+        if (c < 0)
+            return -1;
+        data[i] = c;
+    }
+
+    return size;
+}
+
+int Parser::getc(void)
+{
+    return _getc();
+}
+
+int Parser::write(const char *data, int size)
+{
+    return _serial->write(data, size, _timeout);
+}
+
+bool Parser::process_oob(void)
+{
+    if (!_serial->readable())
+        return false;
+
+    int i = 0;
+    while (true)
+    {
+        int c = _getc();
+        if (c < 0)
+            return false;
+
+        if (i == 0)
+            _line_time = _serial->rx_time();
+        _buffer[i++] = c;
+        _buffer[i] = '\0';
+
+        bool again;
+        if (_check_oob(i, again))
+            return true;
+
+        // Drop the line at the delimiter or when out of space
+        if (i + 1 >= (int)sizeof(_buffer)
+            || (i >= _delim_size && memcmp(_buffer + i - _delim_size, _delimiter, _delim_size) == 0))
+        {
+            if (_dbg_on)
+                fprintf(stderr, "AT< %s", _buffer);
+            // Unlike mbed, return after each line rather than wait out the
+            // timeout for a next one
+            return true;
+        }
+    }
+}
+
+void Parser::flush(void)
+{
+    _serial->flush_input();
+}
+
+void *Thread::_entry(void *arg)
+{
+    Thread *t = (Thread *)arg;
+    t->_task();
+    return nullptr;
+}
+
+int Thread::start(Callback task)
+{
+    if (_started)
+        return -1;
+
+    _task = task;
+    if (pthread_create(&_thread, nullptr, _entry, this) != 0)
+        return -1;
+
+    _started = true;
+    return 0;
+}
+
+int Thread::terminate(void)
+{
+    if (!_started)
+        return 0;
+
+    pthread_cancel(_thread);
+    pthread_join(_thread, nullptr);
+    _started = false;
+
+    return 0;
+}
+
+} // namespace rylr998_port
@@ -0,0 +1,315 @@
+/*
+ * Copyright (c) 2023, Nuvoton Technology Corporation
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef __RYLR998_POSIX_H__
+#define __RYLR998_POSIX_H__
+
+#include <stdint.h>
+#include <stdarg.h>
+#include <pthread.h>
+#include <chrono>
+#include <functional>
+#include <mutex>
+#include <thread>
+
+#ifndef RYLR998_POSIX_RX_BUFFER
+#define RYLR998_POSIX_RX_BUFFER     512
+#endif
+
+#ifndef RYLR998_POSIX_PARSER_BUFFER
+#define RYLR998_POSIX_PARSER_BUFFER 256
+#endif
+
+#ifndef RYLR998_POSIX_MAX_OOBS
+#define RYLR998_POSIX_MAX_OOBS      4
+#endif
+
+/* Modem control line of a USB-UART adapter wired to the module NRST */
+#define RYLR998_RESET_NONE          0
+#define RYLR998_RESET_RTS           1
+#define RYLR998_RESET_DTR           2
+
+/* Same contract as the mbed atomics, for code shared with the MCU build */
+inline uint32_t core_util_atomic_load_u32(const volatile uint32_t *p)
+{
+    return __atomic_load_n(p, __ATOMIC_SEQ_CST);
+}
+
+inline void core_util_atomic_store_u32(volatile uint32_t *p, uint32_t v)
+{
+    __atomic_store_n(p, v, __ATOMIC_SEQ_CST);
+}
+
+inline bool core_util_atomic_cas_u32(volatile uint32_t *p, uint32_t *expected, uint32_t desired)
+{
+    return __atomic_compare_exchange_n(p, expected, desired, false, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST);
+}
+
+inline uint32_t core_util_atomic_incr_u32(volatile uint32_t *p, uint32_t delta)
+{
+    return __atomic_add_fetch(p, delta, __ATOMIC_SEQ_CST);
+}
+
+namespace rylr998_port {
+
+typedef std::function<void()> Callback;
+
+template <typename T>
+Callback callback(T *obj, void (T::*method)())
+{
+    return [obj, method]() { (obj->*method)(); };
+}
+
+inline uint32_t now_ms(void)
+{
+    return (uint32_t)std::chrono::duration_cast<std::chrono::milliseconds>(
+               std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+inline uint32_t now_us(void)
+{
+    return (uint32_t)std::chrono::duration_cast<std::chrono::microseconds>(
+               std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+inline void sleep_for(std::chrono::milliseconds t)
+{
+    std::this_thread::sleep_for(t);
+}
+
+/** Serial class.
+    A termios UART in raw, non-blocking mode.
+
+    Reads go through a small buffer; the fd can be watched with epoll or
+    poll for readability.
+ */
+class Serial {
+public:
+    /**
+    * @param device the tty, e.g. /dev/ttyUSB0
+    * @param baud the baud rate, one termios supports (300 to 921600);
+    *        another leaves the port closed
+    */
+    Serial(const char *device, int baud);
+    ~Serial();
+
+    /**
+    * Return the file descriptor, -1 if the device did not open
+    */
+    int fd(void) {
+        return _fd;
+    }
+
+    /**
+    * Check for buffered or pending input without blocking
+    */
+    bool readable(void);
+
+    /**
+    * Read one byte
+    *
+    * @param timeout_ms how long to wait
+    * @return the byte, -1 on timeout or error
+    */
+    int getc(int timeout_ms);
+
+    /**
+    * Take in the pending input without blocking and look at what is buffered
+    *
+    * @param data set to the buffered bytes, which stay buffered
+    * @return the number of bytes, up to RYLR998_POSIX_RX_BUFFER
+    */
+    int peek(const uint8_t **data);
+
+    /**
+    * Return when the byte last returned by getc() was read from the tty
+    *
+    * @return the now_ms() time of the read that took it in
+    */
+    uint32_t rx_time(void);
+
+    /**
+    * Write all bytes
+    *
+    * @param timeout_ms how long to wait for room in the tty
+    * @return len, -1 on timeout or error
+    */
+    int write(const void *data, int len, int timeout_ms);
+
+    /**
+    * Drop buffered and pending input
+    */
+    void flush_input(void);
+
+    /**
+    * Drive a modem control line
+    *
+    * @param line RYLR998_RESET_RTS or RYLR998_RESET_DTR
+    * @param asserted true to assert the line, which drives the pin low
+    */
+    void set_line(int line, bool asserted);
+
+private:
+    int _fd;
+    uint8_t _buf[RYLR998_POSIX_RX_BUFFER];
+    int _head;
+    int _tail;
+    uint32_t _stamp[2];     // read time of the bytes before _stamp_pos, and from there on
+    int _stamp_pos;
+
+    bool _fill(int timeout_ms);
+};
+
+/** Parser class.
+    The part of mbed::ATCmdParser the driver uses, with the same matching
+    rules, over a POSIX Serial.
+ */
+class Parser {
+public:
+    Parser(Serial *serial);
+
+    void debug_on(bool on) {
+        _dbg_on = on;
+    }
+
+    void set_delimiter(const char *delimiter);
+
+    void set_timeout(int timeout_ms) {
+        _timeout = timeout_ms;
+    }
+
+    void oob(const char *prefix, Callback cb);
+
+    bool send(const char *command, ...);
+    bool recv(const char *response, ...);
+    int printf(const char *format, ...);
+    int scanf(const char *format, ...);
+    int read(char *data, int size);
+    int write(const char *data, int size);
+    int getc(void);
+    bool process_oob(void);
+    void flush(void);
+
+    void abort(void) {
+        _aborted = true;
+    }
+
+    /**
+    * Return when the first byte of the latest line was read from the tty
+    */
+    uint32_t line_time(void) {
+        return _line_time;
+    }
+
+private:
+    struct _Oob {
+        const char *prefix;
+        int len;
+        Callback cb;
+    };
+
+    Serial *_serial;
+    char _buffer[RYLR998_POSIX_PARSER_BUFFER];
+    char _format[RYLR998_POSIX_PARSER_BUFFER];
+    const char *_delimiter;
+    int _delim_size;
+    int _timeout;
+    bool _dbg_on;
+    bool _aborted;
+    uint32_t _line_time;
+    _Oob _oobs[RYLR998_POSIX_MAX_OOBS];
+    int _noobs;
+
+    int _getc(void);
+    bool _check_oob(int len, bool &restart);
+    int _suppress(const char *in, int len, char *out, int size);
+};
+
+/** ResetPin class.
+    The module NRST driven by a modem control line of the adapter.
+ */
+class ResetPin {
+public:
+    ResetPin(Serial &serial, int line) : _serial(serial), _line(line) {
+    }
+
+    bool is_connected(void) {
+        return _line != RYLR998_RESET_NONE && _serial.fd() >= 0;
+    }
+
+    ResetPin &operator=(int value) {
+        if (is_connected())
+            _serial.set_line(_line, value == 0);
+        return *this;
+    }
+
+private:
+    Serial &_serial;
+    int _line;
+};
+
+/** Mutex class.
+    Recursive like rtos::Mutex.
+ */
+class Mutex {
+public:
+    void lock(void) {
+        _mutex.lock();
+    }
+
+    void unlock(void) {
+        _mutex.unlock();
+    }
+
+private:
+    std::recursive_mutex _mutex;
+};
+
+typedef int Priority;
+
+const Priority PRIORITY_LOW = 0;
+
+/** Thread class.
+    Enough of rtos::Thread for the driver helpers. Priority and stack size
+    are left to the host scheduler.
+ */
+class Thread {
+public:
+    Thread(Priority = PRIORITY_LOW, uint32_t = 0,
+           unsigned char * = nullptr, const char * = nullptr)
+        : _started(false) {
+    }
+
+    ~Thread() {
+        terminate();
+    }
+
+    int start(Callback task);
+    int terminate(void);
+
+private:
+    pthread_t _thread;
+    bool _started;
+    Callback _task;
+
+    static void *_entry(void *arg);
+};
+
+} // namespace rylr998_port
+
+#endif // __RYLR998_POSIX_H__
@@ -0,0 +1,268 @@
+/*
+ * Copyright (c) 2023, Nuvoton Technology Corporation
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/* Bridge benchmark for Linux.
+ *
+ * A pseudo-terminal plays the module: it answers AT commands and emits
+ * bursts of +RCV frames carrying their write time. The bridge forwards
+ * them to a local Unix socket peer, which measures frames/s and the
+ * latency from the module's write to the peer's read. The peer also sends
+ * downlinks back through the bridge.
+ *
+ * The frames of a burst are first written one by one, then all at once,
+ * as when they pile up in the UART while the gateway is busy. The second
+ * case must carry more than one frame per datagram. Exits with 1 if
+ * frames are lost or the burst is not batched.
+ */
+
+// g++ -std=c++14 -O2 -pthread -IRYLR998 RYLR998/*.cpp RYLR998/posix/*.cpp bench/bridge_bench.cpp -o bridge_bench
+// ./bridge_bench [frames] [burst] [interval_us]
+
+#include <algorithm>
+#include <atomic>
+#include <string>
+#include <thread>
+#include <vector>
+#include <fcntl.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <termios.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "RYLR998.h"
+#include "posix/RYLR998_Bridge.h"
+#include "posix/RYLR998_EventLoop.h"
+
+#define BRIDGE_PATH "/tmp/rylr998_bridge.sock"
+#define PEER_PATH   "/tmp/rylr998_peer.sock"
+
+static uint64_t now_us(void)
+{
+    return std::chrono::duration_cast<std::chrono::microseconds>(
+               std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+static std::atomic<bool> running(true);
+static std::atomic<bool> module_running(true);
+static std::atomic<int> module_sends(0);
+
+static void write_all(int fd, const char *data, int len)
+{
+    while (len > 0)
+    {
+        int n = write(fd, data, len);
+        if (n > 0)
+        {
+            data += n;
+            len -= n;
+            continue;
+        }
+        struct pollfd pfd = { fd, POLLOUT, 0 };
+        poll(&pfd, 1, 10);
+    }
+}
+
+// Answers commands and emits a burst of frames every interval, with one
+// write per frame or one per burst
+static void fake_module(int master, int frames, int burst, int interval_us, bool together)
+{
+    uint64_t next = now_us();
+
+    char line[512];
+    int n = 0, sent = 0;
+
+    while (module_running)
+    {
+        struct pollfd pfd = { master, POLLIN, 0 };
+        if (poll(&pfd, 1, (sent < frames) ? 0 : 1) > 0)
+        {
+            char c;
+            while (read(master, &c, 1) == 1)
+            {
+                line[n++] = c;
+                if (n >= 2 && line[n - 2] == '\r' && line[n - 1] == '\n')
+                {
+                    line[n - 2] = '\0';
+                    if (strncmp(line, "AT+SEND=", 8) == 0)
+                        module_sends++;
+                    write_all(master, "+OK\r\n", 5);
+                    n = 0;
+                }
+                if (n == (int)sizeof(line))
+                    n = 0;
+            }
+        }
+
+        if (sent < frames && now_us() >= next)
+        {
+            std::string out;
+
+            next += interval_us;
+            for (int i = 0; i < burst && sent < frames; i++, sent++)
+            {
+                char frame[64];
+                int len = snprintf(frame, sizeof(frame), "+RCV=%d,16,%016llu,-42,9\r\n",
+                                   1 + sent % 50, (unsigned long long)now_us());
+                if (together)
+                    out.append(frame, len);
+                else
+                    write_all(master, frame, len);
+            }
+            if (!out.empty())
+                write_all(master, out.data(), out.size());
+        }
+    }
+}
+
+static bool run_case(const char *name, int frames, int burst, int interval_us, bool together)
+{
+    running = true;
+    module_running = true;
+    module_sends = 0;
+
+    int master = posix_openpt(O_RDWR | O_NOCTTY);
+    grantpt(master);
+    unlockpt(master);
+    struct termios tio;
+    tcgetattr(master, &tio);
+    cfmakeraw(&tio);
+    tcsetattr(master, TCSANOW, &tio);
+    fcntl(master, F_SETFL, O_NONBLOCK);
+
+    RYLR998 rylr(ptsname(master));
+    RYLR998_Bridge bridge(rylr);
+    RYLR998_EventLoop loop;
+
+    int peer = socket(AF_UNIX, SOCK_DGRAM, 0);
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, PEER_PATH);
+    unlink(PEER_PATH);
+    bind(peer, (struct sockaddr *)&addr, sizeof(addr));
+    int rcvbuf = 4 << 20;
+    setsockopt(peer, SOL_SOCKET, SO_RCVBUF, &rcvbuf, sizeof(rcvbuf));
+
+    if (!bridge.open_unix(BRIDGE_PATH, PEER_PATH))
+    {
+        printf("bridge socket failed\n");
+        close(peer);
+        close(master);
+        return false;
+    }
+
+    loop.add(rylr, [&](RYLR998 &) { bridge.forward(); });
+    loop.add(bridge.get_fd(), [&]() { bridge.service(); });
+
+    std::vector<uint32_t> latency;
+    latency.reserve(frames);
+    int batches = 0;
+    int downlinks = 0;
+
+    std::thread module(fake_module, master, frames, burst, interval_us, together);
+    std::thread app([&]() {
+        uint8_t buf[RYLR998_BRIDGE_DATAGRAM];
+        strcpy(addr.sun_path, BRIDGE_PATH);
+
+        while ((int)latency.size() < frames)
+        {
+            struct pollfd pfd = { peer, POLLIN, 0 };
+            if (poll(&pfd, 1, 2000) <= 0)
+                break;
+
+            int len = recv(peer, buf, sizeof(buf), 0);
+            uint64_t t = now_us();
+            if (len < RYLR998_BRIDGE_HDR_SIZE || buf[0] != RYLR998_BRIDGE_MAGIC)
+                continue;
+
+            batches++;
+            int o = RYLR998_BRIDGE_HDR_SIZE;
+            for (int i = 0; i < buf[2]; i++)
+            {
+                int dlen = buf[o + 9];
+                char ts[17];
+                memcpy(ts, buf + o + RYLR998_BRIDGE_UP_REC_SIZE, 16);
+                ts[16] = '\0';
+                latency.push_back((uint32_t)(t - strtoull(ts, NULL, 10)));
+                o += RYLR998_BRIDGE_UP_REC_SIZE + dlen;
+            }
+
+            // Answer every 16th batch with a downlink to its first sender
+            if (batches % 16 == 0)
+            {
+                uint8_t down[RYLR998_BRIDGE_HDR_SIZE + RYLR998_BRIDGE_DOWN_REC_SIZE + 4] =
+                    { RYLR998_BRIDGE_MAGIC, RYLR998_BRIDGE_DOWNLINK, 1, 0,
+                      buf[RYLR998_BRIDGE_HDR_SIZE], buf[RYLR998_BRIDGE_HDR_SIZE + 1], 4,
+                      'a', 'c', 'k', '!' };
+                sendto(peer, down, sizeof(down), 0, (struct sockaddr *)&addr, sizeof(addr));
+                downlinks++;
+            }
+        }
+        running = false;
+    });
+
+    uint64_t start = now_us();
+    while (running)
+        loop.run_once(50);
+    uint64_t elapsed = now_us() - start;
+
+    // Let the last downlinks through
+    for (int i = 0; i < 10; i++)
+        loop.run_once(10);
+    module_running = false;
+
+    app.join();
+    module.join();
+
+    std::sort(latency.begin(), latency.end());
+    int got = latency.size();
+    double per_datagram = (batches) ? (double)got / batches : 0.0;
+    RYLR998_Bridge::bridge_stats s = bridge.get_stats();
+
+    printf("%s: frames %d/%d in %.2f s: %.0f frames/s, %.1f frames per datagram\n",
+           name, got, frames, elapsed / 1e6, got / (elapsed / 1e6), per_datagram);
+    if (got > 0)
+        printf("  latency us: p50 %u p99 %u max %u\n",
+               latency[got / 2], latency[got * 99 / 100], latency[got - 1]);
+    printf("  downlinks %d sent %u by module %d, lost up %u\n",
+           downlinks, s.frames_down, module_sends.load(), s.frames_lost);
+
+    close(peer);
+    unlink(PEER_PATH);
+    unlink(BRIDGE_PATH);
+    close(master);
+
+    return got == frames && s.frames_lost == 0 && (!together || burst < 2 || per_datagram > 1.0);
+}
+
+int main(int argc, char **argv)
+{
+    int frames = (argc > 1) ? atoi(argv[1]) : 20000;
+    int burst = (argc > 2) ? atoi(argv[2]) : 8;
+    int interval_us = (argc > 3) ? atoi(argv[3]) : 2000;
+
+    setvbuf(stdout, NULL, _IONBF, 0);
+
+    bool ok = run_case("frame by frame", frames, burst, interval_us, false);
+    ok = run_case("burst at once", frames, burst, interval_us, true) && ok;
+
+    return (ok) ? 0 : 1;
+}
@@ -0,0 +1,448 @@
+/*
+ * Copyright (c) 2023, Nuvoton Technology Corporation
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/* Driver test for Linux.
+ *
+ * A pseudo-terminal plays the module: it answers AT commands, rejects or
+ * ignores some sends on purpose, and lets the test write raw +RCV and
+ * +ERR lines. The test checks commands, frame parsing, the failed send
+ * handling and that the event loop is not held up by a line that arrives
+ * slowly on another module. Exits with 1 if a check fails.
+ */
+
+// g++ -std=c++14 -O2 -pthread -IRYLR998 RYLR998/*.cpp RYLR998/posix/*.cpp bench/driver_test.cpp -o driver_test
+// ./driver_test
+
+#include <atomic>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include <fcntl.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <termios.h>
+#include <unistd.h>
+
+#include "RYLR998.h"
+#include "RYLR998_Compress.h"
+#include "posix/RYLR998_EventLoop.h"
+
+static int failures = 0;
+
+#define CHECK(cond) check((cond), #cond, __LINE__)
+
+static void check(bool ok, const char *what, int line)
+{
+    printf("%s  %s (line %d)\n", (ok) ? "ok  " : "FAIL", what, line);
+    if (!ok)
+        failures++;
+}
+
+static uint64_t now_us(void)
+{
+    return std::chrono::duration_cast<std::chrono::microseconds>(
+               std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// A pseudo-terminal that answers like the module and records the data
+// sent. Sends whose data holds "reject" get +ERR=5, "mute" gets no reply,
+// "rxerr" gets +ERR=12 before its +OK. A muted module answers nothing.
+struct Module {
+    int master;
+    std::string name;
+    int addr;
+    std::mutex out_lock;
+    std::mutex sent_lock;
+    std::vector<std::string> sent;
+    std::atomic<bool> running;
+    std::atomic<bool> muted;
+    std::atomic<int> sends;
+    std::thread thread;
+
+    Module() : addr(0), running(true), muted(false), sends(0)
+    {
+        master = posix_openpt(O_RDWR | O_NOCTTY);
+        grantpt(master);
+        unlockpt(master);
+        name = ptsname(master);
+
+        struct termios tio;
+        tcgetattr(master, &tio);
+        cfmakeraw(&tio);
+        tcsetattr(master, TCSANOW, &tio);
+        fcntl(master, F_SETFL, O_NONBLOCK);
+
+        thread = std::thread(&Module::loop, this);
+    }
+
+    ~Module()
+    {
+        running = false;
+        thread.join();
+        close(master);
+    }
+
+    void out(const std::string &s)
+    {
+        std::lock_guard<std::mutex> guard(out_lock);
+        size_t done = 0;
+        while (done < s.size())
+        {
+            int n = write(master, s.data() + done, s.size() - done);
+            if (n > 0)
+                done += n;
+            else
+                usleep(100);
+        }
+    }
+
+    void reply(const std::string &cmd)
+    {
+        if (muted)
+            return;
+
+        if (cmd == "AT")
+            out("+OK\r\n");
+        else if (cmd.compare(0, 11, "AT+ADDRESS=") == 0)
+        {
+            addr = atoi(cmd.c_str() + 11);
+            out("+OK\r\n");
+        }
+        else if (cmd == "AT+ADDRESS?")
+            out("+ADDRESS=" + std::to_string(addr) + "\r\n");
+        else if (cmd == "AT+VER?")
+            out("+VER=RYLR998_REYAX_V1.2.3\r\n");
+        else if (cmd.compare(0, 8, "AT+SEND=") == 0)
+        {
+            if (cmd.find("reject") != std::string::npos)
+                out("+ERR=5\r\n");
+            else if (cmd.find("mute") != std::string::npos)
+                return;
+            else
+            {
+                if (cmd.find("rxerr") != std::string::npos)
+                {
+                    out("+ERR=12\r\n");
+                    usleep(20000);
+                }
+                // AT+SEND=<addr>,<len>,<data>
+                size_t data = cmd.find(',', cmd.find(',') + 1) + 1;
+                std::lock_guard<std::mutex> guard(sent_lock);
+                sent.push_back(cmd.substr(data));
+                sends++;
+                out("+OK\r\n");
+            }
+        }
+        else
+            out("+ERR=4\r\n");
+    }
+
+    void loop(void)
+    {
+        std::string line;
+
+        while (running)
+        {
+            char c;
+            if (read(master, &c, 1) <= 0)
+            {
+                struct pollfd pfd = { master, POLLIN, 0 };
+                poll(&pfd, 1, 5);
+                continue;
+            }
+
+            line += c;
+            if (line.size() >= 2 && line.compare(line.size() - 2, 2, "\r\n") == 0)
+            {
+                reply(line.substr(0, line.size() - 2));
+                line.clear();
+            }
+        }
+    }
+};
+
+static void test_commands(void)
+{
+    Module m;
+    RYLR998 rylr(m.name.c_str());
+
+    CHECK(rylr.at_available());
+    CHECK(rylr.set_address(42));
+    CHECK(rylr.get_address() == 42);
+
+    RYLR998::fw_version v = rylr.get_fw_version();
+    CHECK(v.major == 1 && v.minor == 2 && v.patch == 3);
+
+    CHECK(!rylr.set_band(915000000));
+    CHECK(rylr.get_last_error() == 4);
+}
+
+static void test_serial(void)
+{
+    Module m;
+
+    // Rates termios has open, others fail rather than fall back
+    rylr998_port::Serial fast(m.name.c_str(), 460800);
+    CHECK(fast.fd() >= 0);
+    rylr998_port::Serial odd(m.name.c_str(), 250000);
+    CHECK(odd.fd() < 0);
+}
+
+static void test_receive(void)
+{
+    Module m;
+    RYLR998 rylr(m.name.c_str());
+    char buf[RYLR998_MAX_PAYLOAD + 1];
+    int from;
+
+    // Binary data holding the delimiter, a two-digit SNR
+    m.out(std::string("+RCV=7,6,ab\r\ncd,-97,12\r\n", 24));
+    usleep(20000);
+    int len = rylr.recv(from, buf, RYLR998_MAX_PAYLOAD);
+    CHECK(len == 6 && from == 7 && memcmp(buf, "ab\r\ncd", 6) == 0);
+    CHECK(rylr.get_rssi() == -97 && rylr.get_snr() == 12);
+
+    // A bad length is dropped with the rest of its line
+    m.out("+RCV=7,999,junk,-40,5\r\n+RCV=8,2,ok,-41,-6\r\n");
+    usleep(20000);
+    len = rylr.recv(from, buf, RYLR998_MAX_PAYLOAD);
+    CHECK(len == 2 && from == 8 && memcmp(buf, "ok", 2) == 0);
+    CHECK(rylr.get_snr() == -6);
+    CHECK(rylr.get_size() == 0);
+
+    // A header with flags the driver does not define is not ours
+    m.out(std::string("+RCV=9,3,\xA7xy,-50,3\r\n"));
+    usleep(20000);
+    len = rylr.recv(from, buf, RYLR998_MAX_PAYLOAD);
+    CHECK(len == 3 && (uint8_t)buf[0] == 0xA7);
+
+    // A frame is stamped when the start of its line is read, not when the
+    // line is parsed
+    m.out("+RCV=3,10,01234");
+    usleep(20000);
+    uint32_t start = rylr998_port::now_ms();
+    rylr.poll();
+    usleep(80000);
+    m.out("56789,-60,9\r\n");
+    usleep(20000);
+    rylr.poll();
+    CHECK(rylr.recv(from, buf, RYLR998_MAX_PAYLOAD) == 10);
+    CHECK(rylr.get_timestamp() - start < 20);
+
+    // pull() only takes what poll() read in
+    m.out("+RCV=4,2,hi,-60,9\r\n");
+    usleep(20000);
+    CHECK(rylr.pull_size() == 0 && rylr.pull(from, buf, RYLR998_MAX_PAYLOAD) == 0);
+    CHECK(rylr.poll() == 1 && rylr.pull_size() == 2);
+    CHECK(rylr.pull(from, buf, RYLR998_MAX_PAYLOAD) == 2 && from == 4);
+}
+
+static void test_link(void)
+{
+    Module m;
+    RYLR998 rylr(m.name.c_str());
+    char buf[RYLR998_MAX_PAYLOAD + 1];
+    int from;
+
+    // A node that never enabled compression still decompresses
+    const char *text = "temperature=21.5 temperature=21.5 temperature=21.5";
+    uint8_t packed[RYLR998_MAX_PAYLOAD];
+    RYLR998_Compressor lz;
+    int n = lz.compress((const uint8_t *)text, strlen(text), packed, sizeof(packed), false);
+    CHECK(n > 0 && n < (int)strlen(text));
+
+    std::string frame = std::string("\xA7\x01", 2) + std::string((const char *)packed, n);
+    m.out("+RCV=7," + std::to_string(frame.size()) + "," + frame + ",-60,9\r\n");
+    usleep(20000);
+    int len = rylr.recv(from, buf, RYLR998_MAX_PAYLOAD);
+    CHECK(len == (int)strlen(text) && memcmp(buf, text, len) == 0);
+
+    // and answers a capability request, without the reply flag
+    m.out(std::string("+RCV=7,5,\xA7\x80\x81\x00\x00,-60,9\r\n", 22));
+    usleep(20000);
+    CHECK(rylr.recv(from, buf, RYLR998_MAX_PAYLOAD) == 0);
+    {
+        std::lock_guard<std::mutex> guard(m.sent_lock);
+        CHECK(m.sent.size() == 1 && m.sent.back().size() == 5
+              && m.sent.back().compare(0, 3, "\xA7\x80\x01") == 0);
+    }
+
+    // Data that starts with the magic byte is always escaped
+    CHECK(rylr.send(7, "\xA7z", 2));
+    {
+        std::lock_guard<std::mutex> guard(m.sent_lock);
+        CHECK(m.sent.back() == std::string("\xA7\x00\xA7z", 4));
+    }
+
+    // An unanswered capability request is repeated with a later send
+    m.sent.clear();
+    CHECK(rylr.set_compression(5, true));
+    CHECK(rylr.send(5, "a", 1));
+    rylr998_port::sleep_for(std::chrono::milliseconds(RYLR998_LINK_CAPS_RETRY_MS + 100));
+    CHECK(rylr.send(5, "b", 1));
+    CHECK(rylr.send(5, "c", 1));
+    {
+        std::lock_guard<std::mutex> guard(m.sent_lock);
+        int asks = 0;
+        for (auto &f : m.sent)
+            asks += (f.size() == 5 && f.compare(0, 2, "\xA7\x80") == 0) ? 1 : 0;
+        CHECK(asks == 2 && m.sent.size() == 5);
+    }
+}
+
+static void test_dedup_restart(void)
+{
+    Module m, peer;
+    RYLR998 rylr(m.name.c_str());
+    char buf[RYLR998_MAX_PAYLOAD + 1];
+    int from;
+
+    rylr.set_dedup(true);
+
+    // The first frame of a peer, then the first one after its restart
+    std::string frames[2];
+    for (int boot = 0; boot < 2; boot++)
+    {
+        RYLR998 sender(peer.name.c_str());
+        sender.set_dedup(true);
+        CHECK(sender.send(1, "boot", 4));
+        std::lock_guard<std::mutex> guard(peer.sent_lock);
+        frames[boot] = peer.sent.back();
+    }
+    CHECK(frames[0] != frames[1]);
+
+    for (int boot = 0; boot < 2; boot++)
+    {
+        m.out("+RCV=5," + std::to_string(frames[boot].size()) + "," + frames[boot] + ",-60,9\r\n");
+        usleep(20000);
+        CHECK(rylr.recv(from, buf, RYLR998_MAX_PAYLOAD) == 4);
+    }
+    CHECK(rylr.get_dedup_stats().hits == 0);
+}
+
+static void test_send_failures(void)
+{
+    Module m;
+    RYLR998 rylr(m.name.c_str());
+
+    CHECK(rylr.send(5, "hello", 5));
+    CHECK(!rylr.send(5, "reject", 6));
+    CHECK(rylr.get_last_error() == 5);
+
+    // An RX error in the middle of a command is not its reply
+    CHECK(rylr.send(5, "rxerr", 5));
+
+    // A timeout queues the frame for replay
+    CHECK(!rylr.send(5, "mute", 4));
+
+    RYLR998::health_stats h = rylr.get_health();
+    CHECK(h.tx_rejected == 1);
+    CHECK(h.rx_errors == 1);
+    CHECK(h.tx_queued == 1);
+    CHECK(m.sends == 2);
+}
+
+static void test_stale_error(void)
+{
+    Module m;
+    RYLR998 rylr(m.name.c_str());
+
+    // A +ERR that answers no command, then a setter that times out
+    m.out("+ERR=5\r\n");
+    usleep(20000);
+    rylr.poll();
+    CHECK(rylr.get_last_error() == 5);
+
+    uint32_t failures = rylr.get_health().failures;
+    m.muted = true;
+    CHECK(!rylr.set_address(3));
+    CHECK(rylr.get_health().failures == failures + 1);
+}
+
+static void test_event_loop(void)
+{
+    Module slow, fast;
+    RYLR998 a(slow.name.c_str()), b(fast.name.c_str());
+    RYLR998_EventLoop loop;
+    int got_a = 0, got_b = 0;
+    uint64_t longest_poll = 0;
+
+    auto handler = [&](RYLR998 &rylr) {
+        char buf[RYLR998_MAX_PAYLOAD + 1];
+        int from;
+        while (rylr.recv(from, buf, RYLR998_MAX_PAYLOAD) > 0)
+        {
+            if (&rylr == &a)
+                got_a++;
+            else
+                got_b++;
+        }
+    };
+    CHECK(loop.add(a, handler));
+    CHECK(loop.add(b, handler));
+
+    // Module a sends its line in pieces, b keeps sending whole lines
+    std::thread writer([&]() {
+        std::string line = "+RCV=3,10,0123456789,-60,9\r\n";
+        for (size_t i = 0; i < line.size(); i += 4)
+        {
+            slow.out(line.substr(i, 4));
+            for (int k = 0; k < 5; k++)
+            {
+                fast.out("+RCV=4,5,hello,-50,8\r\n");
+                usleep(10000);
+            }
+        }
+    });
+
+    uint64_t end = now_us() + 2000000;
+    while (now_us() < end && (got_a < 1 || got_b < 30))
+    {
+        // Do not wait in epoll, so a turn times only the parsing
+        uint64_t t = now_us();
+        loop.run_once(0);
+        if (now_us() - t > longest_poll)
+            longest_poll = now_us() - t;
+        usleep(200);
+    }
+    writer.join();
+
+    printf("     longest event loop turn %llu us\n", (unsigned long long)longest_poll);
+    CHECK(got_a == 1);
+    CHECK(got_b >= 30);
+    CHECK(longest_poll < RYLR998_POLL_TIMEOUT.count() * 1000);
+}
+
+int main(void)
+{
+    setvbuf(stdout, NULL, _IONBF, 0);
+
+    test_commands();
+    test_serial();
+    test_receive();
+    test_link();
+    test_dedup_restart();
+    test_send_failures();
+    test_stale_error();
+    test_event_loop();
+
+    printf("%s\n", (failures == 0) ? "all passed" : "FAILED");
+    return (failures == 0) ? 0 : 1;
+}
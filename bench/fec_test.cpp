@@ -0,0 +1,423 @@
+/*
+ * Copyright (c) 2023, Nuvoton Technology Corporation
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/* Erasure coding test for Linux.
+ *
+ * Two pseudo-terminals play the modules of a sender and a receiver. The
+ * frames the sender's module is asked to send are collected, and the test
+ * hands them to the receiver's module as +RCV lines, dropping some on
+ * purpose. It checks that blocks are rebuilt, that short and flushed
+ * blocks neither lose frames nor count phantom losses, that refused frames
+ * are reported, that plain data starting with the magic gets through, and
+ * that automatic redundancy follows the loss. Exits with 1 if a check
+ * fails.
+ */
+
+// g++ -std=c++14 -O2 -pthread -IRYLR998 RYLR998/*.cpp RYLR998/posix/*.cpp bench/fec_test.cpp -o fec_test
+// ./fec_test
+
+#include <atomic>
+#include <mutex>
+#include <set>
+#include <string>
+#include <thread>
+#include <vector>
+#include <fcntl.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <termios.h>
+#include <unistd.h>
+
+#include "RYLR998.h"
+#include "RYLR998_FEC.h"
+
+static int failures = 0;
+
+#define CHECK(cond) check((cond), #cond, __LINE__)
+
+static void check(bool ok, const char *what, int line)
+{
+    printf("%s  %s (line %d)\n", (ok) ? "ok  " : "FAIL", what, line);
+    if (!ok)
+        failures++;
+}
+
+// A pseudo-terminal that answers like the module and keeps the frames it
+// is asked to send. Sends whose data holds "reject" get +ERR=5.
+struct Module {
+    int master;
+    std::string name;
+    std::mutex out_lock;
+    std::mutex sent_lock;
+    std::vector<std::string> sent;
+    std::atomic<bool> running;
+    std::thread thread;
+
+    Module() : running(true)
+    {
+        master = posix_openpt(O_RDWR | O_NOCTTY);
+        grantpt(master);
+        unlockpt(master);
+        name = ptsname(master);
+
+        struct termios tio;
+        tcgetattr(master, &tio);
+        cfmakeraw(&tio);
+        tcsetattr(master, TCSANOW, &tio);
+        fcntl(master, F_SETFL, O_NONBLOCK);
+
+        thread = std::thread(&Module::loop, this);
+    }
+
+    ~Module()
+    {
+        running = false;
+        thread.join();
+        close(master);
+    }
+
+    void out(const std::string &s)
+    {
+        std::lock_guard<std::mutex> guard(out_lock);
+        size_t done = 0;
+        while (done < s.size())
+        {
+            int n = write(master, s.data() + done, s.size() - done);
+            if (n > 0)
+                done += n;
+            else
+                usleep(100);
+        }
+    }
+
+    // Hand a frame over as if received from addr
+    void receive(int addr, const std::string &data, int snr)
+    {
+        out("+RCV=" + std::to_string(addr) + "," + std::to_string(data.size()) + "," + data
+            + ",-60," + std::to_string(snr) + "\r\n");
+    }
+
+    std::vector<std::string> take(void)
+    {
+        std::lock_guard<std::mutex> guard(sent_lock);
+        std::vector<std::string> frames;
+        frames.swap(sent);
+        return frames;
+    }
+
+    void reply(const std::string &cmd)
+    {
+        if (cmd == "AT")
+            out("+OK\r\n");
+        else if (cmd == "AT+ADDRESS?")
+            out("+ADDRESS=1\r\n");
+        else if (cmd == "AT+PARAMETER?")
+            out("+PARAMETER=9,7,1,12\r\n");
+        else
+            out("+ERR=4\r\n");
+    }
+
+    void loop(void)
+    {
+        std::string line;
+        int want = -1;
+
+        while (running)
+        {
+            char c;
+            if (read(master, &c, 1) <= 0)
+            {
+                struct pollfd pfd = { master, POLLIN, 0 };
+                poll(&pfd, 1, 5);
+                continue;
+            }
+
+            line += c;
+
+            // AT+SEND=<addr>,<len>, then the data may hold any byte
+            if (want < 0 && line.compare(0, 8, "AT+SEND=") == 0)
+            {
+                int a, len, n = 0;
+                if (line.back() == ',' && sscanf(line.c_str(), "AT+SEND=%d,%d,%n", &a, &len, &n) == 2
+                    && (int)line.size() == n)
+                {
+                    want = len;
+                    line.clear();
+                }
+                continue;
+            }
+
+            if (want >= 0)
+            {
+                if ((int)line.size() == want + 2)
+                {
+                    std::string data = line.substr(0, want);
+                    line.clear();
+                    want = -1;
+
+                    if (data.find("reject") != std::string::npos)
+                        out("+ERR=5\r\n");
+                    else
+                    {
+                        std::lock_guard<std::mutex> guard(sent_lock);
+                        sent.push_back(data);
+                        out("+OK\r\n");
+                    }
+                }
+                continue;
+            }
+
+            if (line.size() >= 2 && line.compare(line.size() - 2, 2, "\r\n") == 0)
+            {
+                reply(line.substr(0, line.size() - 2));
+                line.clear();
+            }
+        }
+    }
+};
+
+struct Link {
+    Module tx_module;
+    Module rx_module;
+    RYLR998 tx_rylr;
+    RYLR998 rx_rylr;
+    RYLR998_FEC tx;
+    RYLR998_FEC rx;
+
+    Link(int k, int m)
+        : tx_rylr(tx_module.name.c_str()),
+          rx_rylr(rx_module.name.c_str()),
+          tx(tx_rylr, k, m),
+          rx(rx_rylr, k, m)
+    {
+    }
+
+    // Deliver the frames sent so far, except those drop() picks by their
+    // position in the batch, and collect what comes out
+    template <typename Drop>
+    std::vector<std::string> carry(Drop drop, int snr = 10)
+    {
+        std::vector<std::string> frames = tx_module.take();
+        for (size_t i = 0; i < frames.size(); i++)
+        {
+            if (!drop(i, frames[i]))
+                rx_module.receive(1, frames[i], snr);
+        }
+        return collect();
+    }
+
+    std::vector<std::string> collect(void)
+    {
+        std::vector<std::string> got;
+        char buf[RYLR998_MAX_PAYLOAD + 1];
+        int from, idle = 0;
+
+        while (idle < 20)
+        {
+            int len = rx.recv(from, buf, RYLR998_MAX_PAYLOAD);
+            if (len > 0)
+            {
+                got.push_back(std::string(buf, len));
+                idle = 0;
+            }
+            else
+            {
+                idle++;
+                usleep(2000);
+            }
+        }
+        return got;
+    }
+};
+
+static bool is_repair(const std::string &f)
+{
+    return f.size() >= RYLR998_FEC_HDR_SIZE && ((uint8_t)f[2] & RYLR998_FEC_REPAIR) != 0;
+}
+
+static int data_index(const std::string &f)
+{
+    return (is_repair(f)) ? -1 : (uint8_t)f[2];
+}
+
+static void test_rebuild(void)
+{
+    Link l(4, 2);
+    std::set<std::string> want;
+
+    for (int i = 0; i < 40; i++)
+    {
+        std::string msg = "frame " + std::to_string(i);
+        want.insert(msg);
+        CHECK(l.tx.send(2, msg.data(), msg.size()));
+    }
+
+    // Two of four data frames lost in every block
+    std::vector<std::string> got = l.carry([](size_t, const std::string &f) {
+        return data_index(f) == 1 || data_index(f) == 2;
+    });
+
+    RYLR998_FEC::fec_stats s = l.rx.get_stats();
+    printf("rebuild: %d of 40 delivered, %u rebuilt\n", (int)got.size(), s.recovered);
+    CHECK(got.size() == 40 && std::set<std::string>(got.begin(), got.end()) == want);
+    CHECK(s.recovered == 20 && s.lost == 0);
+    CHECK(l.tx.get_stats().repair_sent == 20);
+}
+
+static void test_short_blocks(void)
+{
+    // A flushed block of two, its first frame lost and rebuilt
+    {
+        Link l(4, 1);
+        CHECK(l.tx.send(2, "one", 3));
+        CHECK(l.tx.send(2, "two", 3));
+        CHECK(l.tx.flush());
+
+        std::vector<std::string> got = l.carry([](size_t, const std::string &f) {
+            return data_index(f) == 0;
+        });
+        CHECK(got.size() == 2 && l.rx.get_stats().recovered == 1);
+    }
+
+    // Flushed blocks without repair frames, or whose repair frames are
+    // lost, are not counted as losses once they are retired
+    for (int m = 0; m <= 1; m++)
+    {
+        Link l(4, m);
+        for (int b = 0; b < 10; b++)
+        {
+            CHECK(l.tx.send(2, "a", 1) && l.tx.send(2, "b", 1));
+            l.tx.flush();
+        }
+
+        std::vector<std::string> got = l.carry([](size_t, const std::string &f) {
+            return is_repair(f);
+        });
+        RYLR998_FEC::fec_stats s = l.rx.get_stats();
+        printf("flushed blocks, m %d: %d of 20 delivered, %u counted lost\n", m, (int)got.size(), s.lost);
+        CHECK(got.size() == 20 && s.lost == 0);
+    }
+
+    // A loss inside a flushed block is still seen
+    {
+        Link l(4, 0);
+        for (int b = 0; b < 4; b++)
+        {
+            CHECK(l.tx.send(2, "a", 1) && l.tx.send(2, "b", 1) && l.tx.send(2, "c", 1));
+            l.tx.flush();
+        }
+
+        std::vector<std::string> got = l.carry([](size_t i, const std::string &) {
+            return i == 1;
+        });
+        CHECK(got.size() == 11 && l.rx.get_stats().lost == 1);
+    }
+}
+
+static void test_refused(void)
+{
+    Link l(4, 1);
+
+    CHECK(l.tx.send(2, "x", 1));
+    CHECK(!l.tx.send(2, "reject", 6));
+    CHECK(l.tx.send(2, "y", 1));
+    CHECK(l.tx.send(2, "z", 1));
+
+    // The refused frame is rebuilt from the repair frame
+    std::vector<std::string> got = l.carry([](size_t, const std::string &) {
+        return false;
+    });
+    CHECK(l.tx.get_stats().refused == 1);
+    CHECK(got.size() == 4 && got.back() == "reject");
+}
+
+static void test_plain(void)
+{
+    Link l(4, 1);
+    std::string delta("\xA8\x28\x01\x02\x03", 5);
+
+    CHECK(l.tx.send_plain(2, delta.data(), delta.size()));
+    CHECK(l.tx.send_plain(2, "plain", 5));
+
+    std::vector<std::string> got = l.carry([](size_t, const std::string &) {
+        return false;
+    });
+    CHECK(got.size() == 2 && got[0] == delta && got[1] == "plain");
+}
+
+static void test_auto_redundancy(void)
+{
+    Link l(4, 0);
+    char buf[16];
+
+    // The receiver answers with redundancy picked from what it saw. The
+    // SNR leaves a wide margin, so only loss can raise it.
+    l.rx.set_auto_redundancy(true);
+
+    auto answer_m = [&]() {
+        l.rx.send(1, "ack", 3);
+        l.rx.flush();
+        l.rx_module.take();
+        return l.rx.get_redundancy();
+    };
+
+    // Lossless, with full and flushed blocks
+    for (int b = 0; b < 30; b++)
+    {
+        for (int i = 0; i < 1 + b % 4; i++)
+        {
+            int len = snprintf(buf, sizeof(buf), "%d", i);
+            l.tx.send(2, buf, len);
+        }
+        l.tx.flush();
+    }
+    l.carry([](size_t, const std::string &) {
+        return false;
+    });
+    int m_clean = answer_m();
+
+    // A quarter of the data frames lost
+    for (int i = 0; i < 120; i++)
+    {
+        int len = snprintf(buf, sizeof(buf), "%d", i);
+        l.tx.send(2, buf, len);
+    }
+    l.carry([](size_t, const std::string &f) {
+        return data_index(f) == 2;
+    });
+    int m_lossy = answer_m();
+
+    printf("auto redundancy: m %d lossless, m %d at 25%% loss\n", m_clean, m_lossy);
+    CHECK(m_clean == 0);
+    CHECK(m_lossy >= 2);
+}
+
+int main(void)
+{
+    setvbuf(stdout, NULL, _IONBF, 0);
+
+    test_rebuild();
+    test_short_blocks();
+    test_refused();
+    test_plain();
+    test_auto_redundancy();
+
+    printf("%s\n", (failures == 0) ? "all passed" : "FAILED");
+    return (failures == 0) ? 0 : 1;
+}
@@ -0,0 +1,260 @@
+/*
+ * Copyright (c) 2023, Nuvoton Technology Corporation
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/* Power save benchmark for Linux.
+ *
+ * A pseudo-terminal plays the module: AT+MODE=1 puts it to sleep, and the
+ * first command after that only wakes its UART up and gets no reply, like
+ * the real module. The driver runs the power save schedule while the
+ * application sends a frame now and then, then a burst larger than the
+ * deferred queue. The module records when each frame reached it.
+ *
+ * Reported: duty cycle, windows, wake-up latency, the delay of deferred
+ * sends, frames lost or reordered, and sends that reached a sleeping
+ * module (there should be none). Then the module is left quiet under
+ * RYLR998_EventLoop, which only polls on input or when the schedule is
+ * due, and must keep opening windows.
+ */
+
+// g++ -std=c++14 -O2 -pthread -IRYLR998 RYLR998/*.cpp RYLR998/posix/*.cpp bench/power_bench.cpp -o power_bench
+// ./power_bench [rx_ms] [sleep_ms] [seconds]
+
+#include <atomic>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include <fcntl.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <termios.h>
+#include <unistd.h>
+
+#include "RYLR998.h"
+#include "posix/RYLR998_EventLoop.h"
+
+struct Module {
+    int master;
+    std::string name;
+    std::atomic<bool> running;
+    std::atomic<bool> asleep;
+    bool uart_awake;
+    std::atomic<int> sends_asleep;
+    std::atomic<int> swallowed;
+    std::mutex lock;
+    std::vector<std::pair<int, uint32_t>> frames;   // sequence, arrival ms
+    std::thread thread;
+
+    Module() : running(true), asleep(false), uart_awake(true), sends_asleep(0), swallowed(0)
+    {
+        master = posix_openpt(O_RDWR | O_NOCTTY);
+        grantpt(master);
+        unlockpt(master);
+        name = ptsname(master);
+
+        struct termios tio;
+        tcgetattr(master, &tio);
+        cfmakeraw(&tio);
+        tcsetattr(master, TCSANOW, &tio);
+        fcntl(master, F_SETFL, O_NONBLOCK);
+
+        thread = std::thread(&Module::loop, this);
+    }
+
+    ~Module()
+    {
+        running = false;
+        thread.join();
+        close(master);
+    }
+
+    void out(const char *s)
+    {
+        write(master, s, strlen(s));
+    }
+
+    void reply(const std::string &cmd)
+    {
+        // The first command to a sleeping module only wakes its UART
+        if (asleep && !uart_awake)
+        {
+            uart_awake = true;
+            swallowed++;
+            return;
+        }
+
+        if (cmd == "AT")
+            out("+OK\r\n");
+        else if (cmd == "AT+MODE=1")
+        {
+            out("+OK\r\n");
+            asleep = true;
+            uart_awake = false;
+        }
+        else if (cmd == "AT+MODE=0")
+        {
+            out("+OK\r\n");
+            asleep = false;
+        }
+        else if (cmd.compare(0, 8, "AT+SEND=") == 0)
+        {
+            if (asleep)
+                sends_asleep++;
+
+            // AT+SEND=<addr>,<len>,<sequence>
+            size_t data = cmd.find(',', cmd.find(',') + 1) + 1;
+            std::lock_guard<std::mutex> guard(lock);
+            frames.push_back(std::make_pair(atoi(cmd.c_str() + data), rylr998_port::now_ms()));
+            out("+OK\r\n");
+        }
+        else
+            out("+ERR=4\r\n");
+    }
+
+    void loop(void)
+    {
+        std::string line;
+
+        while (running)
+        {
+            char c;
+            if (read(master, &c, 1) <= 0)
+            {
+                struct pollfd pfd = { master, POLLIN, 0 };
+                poll(&pfd, 1, 5);
+                continue;
+            }
+
+            line += c;
+            if (line.size() >= 2 && line.compare(line.size() - 2, 2, "\r\n") == 0)
+            {
+                reply(line.substr(0, line.size() - 2));
+                line.clear();
+            }
+        }
+    }
+};
+
+int main(int argc, char **argv)
+{
+    int rx_ms = (argc > 1) ? atoi(argv[1]) : 100;
+    int sleep_ms = (argc > 2) ? atoi(argv[2]) : 400;
+    int seconds = (argc > 3) ? atoi(argv[3]) : 5;
+
+    setvbuf(stdout, NULL, _IONBF, 0);
+
+    Module m;
+    RYLR998 rylr(m.name.c_str());
+    std::vector<uint32_t> sent_at;
+    int accepted = 0;
+
+    auto send = [&]() {
+        char data[16];
+        int len = snprintf(data, sizeof(data), "%d", (int)sent_at.size());
+        sent_at.push_back(rylr998_port::now_ms());
+        accepted += rylr.send(3, data, len);
+    };
+
+    auto run = [&](uint32_t ms) {
+        uint32_t end = rylr998_port::now_ms() + ms;
+        while ((int32_t)(rylr998_port::now_ms() - end) < 0)
+        {
+            char buf[RYLR998_MAX_PAYLOAD + 1];
+            int from;
+            rylr.recv(from, buf, RYLR998_MAX_PAYLOAD);
+            usleep(2000);
+        }
+    };
+
+    rylr.set_power_save(rx_ms, sleep_ms);
+
+    // A frame every 700 ms, mostly while asleep
+    uint32_t end = rylr998_port::now_ms() + seconds * 1000;
+    while ((int32_t)(rylr998_port::now_ms() - end) < 0)
+    {
+        send();
+        run(700);
+    }
+
+    // A burst larger than the deferred queue, once the module sleeps
+    while (!rylr.get_power_stats().asleep)
+        run(5);
+    int burst = RYLR998_POWER_TX_QUEUE + 3;
+    for (int i = 0; i < burst; i++)
+        send();
+    run(sleep_ms + rx_ms);
+
+    RYLR998::power_stats p = rylr.get_power_stats();
+
+    // A quiet module under the event loop
+    RYLR998_EventLoop loop;
+    loop.add(rylr, [](RYLR998 &r) {
+        char buf[RYLR998_MAX_PAYLOAD + 1];
+        int from;
+        while (r.pull(from, buf, RYLR998_MAX_PAYLOAD) > 0) {
+        }
+    });
+    uint32_t loop_ms = 2000;
+    end = rylr998_port::now_ms() + loop_ms;
+    while ((int32_t)(rylr998_port::now_ms() - end) < 0)
+        loop.run_once(1000);
+    loop.remove(rylr);
+    int loop_windows = rylr.get_power_stats().windows - p.windows;
+    int loop_expected = loop_ms / (rx_ms + sleep_ms) - 1;
+
+    rylr.set_power_save(0, 0);
+
+    uint32_t max_delay = 0, total_delay = 0;
+    int lost = 0, reordered = 0, prev = -1;
+    {
+        std::lock_guard<std::mutex> guard(m.lock);
+        std::vector<bool> seen(sent_at.size(), false);
+        for (auto &f : m.frames)
+        {
+            if (f.first < 0 || f.first >= (int)sent_at.size())
+                continue;
+            if (f.first < prev)
+                reordered++;
+            prev = f.first;
+            seen[f.first] = true;
+
+            uint32_t delay = f.second - sent_at[f.first];
+            total_delay += delay;
+            if (delay > max_delay)
+                max_delay = delay;
+        }
+        for (bool s : seen)
+            lost += (s) ? 0 : 1;
+    }
+
+    uint32_t total = p.rx_ms + p.sleep_ms;
+    printf("rx %d ms, sleep %d ms: duty cycle %.1f%% (rx %u ms, asleep %u ms)\n",
+           rx_ms, sleep_ms, (total > 0) ? 100.0 * p.rx_ms / total : 0.0, p.rx_ms, p.sleep_ms);
+    printf("windows %u, missed %u, wake latency last %u ms max %u ms, wake-ups swallowed %d\n",
+           p.windows, p.missed_windows, p.wake_latency_last_ms, p.wake_latency_max_ms, m.swallowed.load());
+    printf("sends %d, accepted %d, deferred %u, early wakes %u\n",
+           (int)sent_at.size(), accepted, p.tx_deferred, p.early_wakes);
+    printf("send delay avg %u ms max %u ms, lost %d, reordered %d, sent to a sleeping module %d\n",
+           (sent_at.empty()) ? 0 : total_delay / (unsigned)sent_at.size(), max_delay, lost, reordered,
+           m.sends_asleep.load());
+
+    printf("event loop: %d windows in %u ms\n", loop_windows, loop_ms);
+
+    return (lost == 0 && reordered == 0 && m.sends_asleep == 0 && loop_windows >= loop_expected) ? 0 : 1;
+}
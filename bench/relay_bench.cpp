@@ -0,0 +1,366 @@
+/*
+ * Copyright (c) 2023, Nuvoton Technology Corporation
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/* Multi-hop relay simulation for Linux.
+ *
+ * Five pseudo-terminal modules share a simulated channel with this
+ * topology, where node 1 can not hear nodes 4 and 5:
+ *
+ *     1 --- 2 --- 4 --- 5
+ *      \    |    /
+ *       `-- 3 --'
+ *
+ * Nodes 2, 3 and 4 relay. Node 1 floods a hello and node 5 answers. Node
+ * 1 is restarted and has to get its new frames through while the peers
+ * still remember the IDs it used before. Then both send unicasts each way,
+ * and a TTL of 1 must stop a frame at the first hop.
+ * Each delivery has a given loss rate in percent. Exits with 1 if the
+ * lossless run loses a frame.
+ */
+
+// g++ -std=c++14 -O2 -pthread -IRYLR998 RYLR998/*.cpp RYLR998/posix/*.cpp bench/relay_bench.cpp -o relay_bench
+// ./relay_bench [loss_pct] [frames]
+
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+#include <fcntl.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <termios.h>
+#include <unistd.h>
+
+#include "RYLR998.h"
+#include "RYLR998_Relay.h"
+
+#define NODES   5
+
+struct Module;
+
+// Who hears whom, at what RSSI (0: out of range)
+struct Channel {
+    std::vector<Module *> nodes;
+    int rssi[NODES + 1][NODES + 1];
+    int loss_pct;
+    std::mutex lock;
+    std::mt19937 rng;
+
+    Channel() : loss_pct(0), rng(1)
+    {
+        memset(rssi, 0, sizeof(rssi));
+    }
+
+    void link(int a, int b, int r)
+    {
+        rssi[a][b] = rssi[b][a] = r;
+    }
+
+    void transmit(Module *from, int dst, const std::string &data);
+};
+
+// A pseudo-terminal that answers like the module; AT+SEND goes on the
+// channel, frames heard come out as +RCV lines
+struct Module {
+    int master;
+    std::string name;
+    int addr;
+    Channel &channel;
+    std::mutex out_lock;
+    std::atomic<bool> running;
+    std::atomic<int> sends;
+    std::thread thread;
+
+    Module(int a, Channel &c) : addr(a), channel(c), running(true), sends(0)
+    {
+        master = posix_openpt(O_RDWR | O_NOCTTY);
+        grantpt(master);
+        unlockpt(master);
+        name = ptsname(master);
+
+        struct termios tio;
+        tcgetattr(master, &tio);
+        cfmakeraw(&tio);
+        tcsetattr(master, TCSANOW, &tio);
+        fcntl(master, F_SETFL, O_NONBLOCK);
+
+        thread = std::thread(&Module::loop, this);
+    }
+
+    ~Module()
+    {
+        running = false;
+        thread.join();
+        close(master);
+    }
+
+    void out(const std::string &s)
+    {
+        std::lock_guard<std::mutex> guard(out_lock);
+        size_t done = 0;
+        while (done < s.size())
+        {
+            int n = write(master, s.data() + done, s.size() - done);
+            if (n > 0)
+                done += n;
+            else
+                usleep(100);
+        }
+    }
+
+    void reply(const std::string &cmd)
+    {
+        char uid[32];
+
+        if (cmd == "AT")
+            out("+OK\r\n");
+        else if (cmd == "AT+ADDRESS?")
+            out("+ADDRESS=" + std::to_string(addr) + "\r\n");
+        else if (cmd == "AT+UID?")
+        {
+            snprintf(uid, sizeof(uid), "+UID=%024d\r\n", addr);
+            out(uid);
+        }
+        else if (cmd == "AT+PARAMETER?")
+            out("+PARAMETER=7,9,1,12\r\n");
+        else
+            out("+ERR=4\r\n");
+    }
+
+    void loop(void)
+    {
+        std::string line;
+        int want = -1, dst = 0;
+
+        while (running)
+        {
+            char c;
+            if (read(master, &c, 1) <= 0)
+            {
+                struct pollfd pfd = { master, POLLIN, 0 };
+                poll(&pfd, 1, 5);
+                continue;
+            }
+
+            line += c;
+
+            // AT+SEND=<addr>,<len>, then the data may hold any byte
+            if (want < 0 && line.compare(0, 8, "AT+SEND=") == 0)
+            {
+                int a, len, n = 0;
+                if (line.back() == ',' && sscanf(line.c_str(), "AT+SEND=%d,%d,%n", &a, &len, &n) == 2
+                    && (int)line.size() == n)
+                {
+                    want = len;
+                    dst = a;
+                    line.clear();
+                }
+                continue;
+            }
+
+            if (want >= 0)
+            {
+                if ((int)line.size() == want + 2)
+                {
+                    std::string data = line.substr(0, want);
+                    line.clear();
+                    want = -1;
+                    sends++;
+
+                    usleep(2000);
+                    channel.transmit(this, dst, data);
+                    out("+OK\r\n");
+                }
+                continue;
+            }
+
+            if (line.size() >= 2 && line.compare(line.size() - 2, 2, "\r\n") == 0)
+            {
+                reply(line.substr(0, line.size() - 2));
+                line.clear();
+            }
+        }
+    }
+};
+
+void Channel::transmit(Module *from, int dst, const std::string &data)
+{
+    for (Module *n : nodes)
+    {
+        int r = rssi[from->addr][n->addr];
+        if (n == from || r == 0 || (dst != 0 && dst != n->addr))
+            continue;
+
+        {
+            std::lock_guard<std::mutex> guard(lock);
+            if (loss_pct > 0 && (int)(rng() % 100) < loss_pct)
+                continue;
+        }
+
+        n->out("+RCV=" + std::to_string(from->addr) + "," + std::to_string(data.size()) + ","
+               + data + "," + std::to_string(r) + ",10\r\n");
+    }
+}
+
+struct Node {
+    std::unique_ptr<RYLR998> rylr;
+    std::unique_ptr<RYLR998_Relay> relay;
+    int got_from[NODES + 1];
+
+    void start(Module &m, bool relay_role)
+    {
+        relay.reset();
+        rylr.reset(new RYLR998(m.name.c_str()));
+        relay.reset(new RYLR998_Relay(*rylr, relay_role));
+        memset(got_from, 0, sizeof(got_from));
+    }
+};
+
+static Node nodes[NODES + 1];
+
+static void run(int ms)
+{
+    uint32_t end = rylr998_port::now_ms() + ms;
+
+    while ((int32_t)(rylr998_port::now_ms() - end) < 0)
+    {
+        for (int i = 1; i <= NODES; i++)
+        {
+            char buf[RYLR998_MAX_PAYLOAD + 1];
+            int from;
+            while (nodes[i].relay->recv(from, buf, RYLR998_MAX_PAYLOAD) > 0)
+            {
+                if (from >= 1 && from <= NODES)
+                    nodes[i].got_from[from]++;
+            }
+        }
+        usleep(1000);
+    }
+}
+
+static void print_route(int from, int to)
+{
+    int hops = 0;
+    int next = nodes[from].relay->get_route(to, &hops);
+    printf("route %d -> %d: next hop %d, %d hops\n", from, to, next, (next < 0) ? 0 : hops);
+}
+
+int main(int argc, char **argv)
+{
+    int loss = (argc > 1) ? atoi(argv[1]) : 0;
+    int frames = (argc > 2) ? atoi(argv[2]) : 50;
+    bool ok = true;
+
+    setvbuf(stdout, NULL, _IONBF, 0);
+
+    Channel channel;
+    channel.loss_pct = loss;
+    channel.link(1, 2, -60);
+    channel.link(1, 3, -80);
+    channel.link(2, 3, -50);
+    channel.link(2, 4, -70);
+    channel.link(3, 4, -65);
+    channel.link(4, 5, -60);
+
+    std::vector<std::unique_ptr<Module>> modules;
+    for (int i = 1; i <= NODES; i++)
+    {
+        modules.emplace_back(new Module(i, channel));
+        channel.nodes.push_back(modules.back().get());
+    }
+    for (int i = 1; i <= NODES; i++)
+        nodes[i].start(*modules[i - 1], i != 1 && i != NODES);
+
+    // Routes are learnt from a flood and its answer
+    nodes[1].relay->send(0, "hello", 5);
+    run(500);
+    nodes[5].relay->send(1, "pong", 4);
+    run(500);
+    print_route(1, 5);
+    print_route(5, 1);
+    print_route(4, 1);
+
+    // A restarted node draws new message IDs, its frames are not taken
+    // for copies of those it sent before, which the peers still remember
+    int count = nodes[5].got_from[1];
+    for (int k = 0; k < 10; k++)
+    {
+        nodes[1].relay->send(5, "before", 6);
+        run(60);
+    }
+    run(500);
+    int before = nodes[5].got_from[1] - count;
+
+    nodes[1].start(*modules[0], false);
+    count = nodes[5].got_from[1];
+    for (int k = 0; k < 10; k++)
+    {
+        nodes[1].relay->send(5, "after", 5);
+        run(60);
+    }
+    run(500);
+    int after = nodes[5].got_from[1] - count;
+    printf("restart: 1 -> 5 %d/10 before, %d/10 after\n", before, after);
+    ok = ok && before == 10 && after == 10;
+
+    int got_5 = nodes[5].got_from[1], got_1 = nodes[1].got_from[5];
+    for (int k = 0; k < frames; k++)
+    {
+        char msg[32];
+        int len = snprintf(msg, sizeof(msg), "frame %d", k);
+        nodes[1].relay->send(5, msg, len);
+        nodes[5].relay->send(1, msg, len);
+        run(60);
+    }
+    run(500);
+    got_5 = nodes[5].got_from[1] - got_5;
+    got_1 = nodes[1].got_from[5] - got_1;
+    printf("loss %d%%: 1 -> 5 %d/%d, 5 -> 1 %d/%d\n", loss, got_5, frames, got_1, frames);
+    ok = ok && got_5 == frames && got_1 == frames;
+
+    for (int i = 1; i <= NODES; i++)
+    {
+        RYLR998_Relay::relay_stats s = nodes[i].relay->get_stats();
+        printf("node %d: originated %u delivered %u forwarded %u flooded %u duplicates %u "
+               "expired %u queue full %u suppressed %u hop latency %u/%u ms routes %d sends %d\n",
+               i, s.originated, s.delivered, s.forwarded, s.flooded, s.duplicates, s.expired,
+               s.queue_full, s.suppressed, s.hop_latency_last_ms, s.hop_latency_max_ms, s.routes,
+               modules[i - 1]->sends.load());
+    }
+
+    // A hop limit of 1 stops at the neighbours
+    nodes[1].relay->set_ttl(1);
+    got_5 = nodes[5].got_from[1];
+    nodes[1].relay->send(5, "ttl", 3);
+    run(500);
+    got_5 = nodes[5].got_from[1] - got_5;
+    printf("ttl 1: reached 5 %d\n", got_5);
+    ok = ok && got_5 == 0;
+
+    for (int i = 1; i <= NODES; i++)
+    {
+        nodes[i].relay.reset();
+        nodes[i].rylr.reset();
+    }
+
+    return (ok || loss > 0) ? 0 : 1;
+}
@@ -0,0 +1,678 @@
+/*
+ * Copyright (c) 2023, Nuvoton Technology Corporation
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/* Spool test for Linux.
+ *
+ * Runs the spool on RYLR998_FileStorage. The log is checked for order,
+ * recovery and overflow, then fuzzed with power loss injected at a random
+ * byte of a program: after every mount the frames must be contiguous,
+ * nothing committed may be lost and nothing acknowledged may come back.
+ * A failed program must not lose a frame either.
+ * A pseudo-terminal module then checks the driver: received packets keep
+ * their order over a reset and over storage errors, and frames sent while
+ * the module is down are spooled and sent in order after a reset. Exits
+ * with 1 if a check fails.
+ */
+
+// g++ -std=c++14 -O2 -pthread -IRYLR998 RYLR998/*.cpp RYLR998/posix/*.cpp bench/spool_test.cpp -o spool_test
+// ./spool_test [rounds]
+
+#include <atomic>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include <fcntl.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <termios.h>
+#include <unistd.h>
+
+#include "RYLR998.h"
+#include "RYLR998_Spool.h"
+#include "posix/RYLR998_FileStorage.h"
+
+#define IMAGE       "/tmp/rylr998_spool_test.img"
+#define TX_IMAGE    "/tmp/rylr998_spool_test_tx.img"
+
+static int failures = 0;
+
+#define CHECK(cond) check((cond), #cond, __LINE__)
+
+static void check(bool ok, const char *what, int line)
+{
+    if (!ok)
+    {
+        printf("FAIL  %s (line %d)\n", what, line);
+        failures++;
+    }
+}
+
+// Storage that loses power after a number of bytes, cutting the program
+// in flight short, or fails its writes while broken. The program over
+// address fail_at writes the bytes before it and fails, once.
+struct Faulty : RYLR998_Storage {
+    RYLR998_Storage &s;
+    long budget;
+    bool dead;
+    bool broken;
+    long fail_at;
+
+    Faulty(RYLR998_Storage &storage) : s(storage), budget(-1), dead(false), broken(false), fail_at(-1)
+    {
+    }
+
+    int read(void *buffer, uint32_t addr, uint32_t size)
+    {
+        return (dead) ? -1 : s.read(buffer, addr, size);
+    }
+
+    int program(const void *buffer, uint32_t addr, uint32_t size)
+    {
+        if (dead || broken)
+            return -1;
+
+        if (fail_at >= (long)addr && fail_at < (long)(addr + size))
+        {
+            uint32_t part = (uint32_t)(fail_at - addr) / s.get_program_size() * s.get_program_size();
+            if (part > 0)
+                s.program(buffer, addr, part);
+            fail_at = -1;
+            return -1;
+        }
+
+        if (budget >= 0 && (long)size > budget)
+        {
+            uint32_t part = (uint32_t)budget / s.get_program_size() * s.get_program_size();
+            if (part > 0)
+                s.program(buffer, addr, part);
+            dead = true;
+            return -1;
+        }
+
+        if (budget >= 0)
+            budget -= size;
+        return s.program(buffer, addr, size);
+    }
+
+    int erase(uint32_t addr, uint32_t size)
+    {
+        return (dead || broken) ? -1 : s.erase(addr, size);
+    }
+
+    int sync(void)
+    {
+        return (dead) ? -1 : s.sync();
+    }
+
+    uint32_t get_program_size(void)
+    {
+        return s.get_program_size();
+    }
+
+    uint32_t get_erase_size(void)
+    {
+        return s.get_erase_size();
+    }
+
+    uint32_t size(void)
+    {
+        return s.size();
+    }
+};
+
+// Frame v carries v in its first bytes, and every field derives from it
+static bool push_seq(RYLR998_Spool &spool, uint32_t v)
+{
+    char data[256];
+    int len = 4 + (v * 37) % 200;
+
+    memcpy(data, &v, 4);
+    for (int i = 4; i < len; i++)
+        data[i] = (char)(v + i);
+
+    return spool.push(v % 65535, data, len, -(int)(v % 120), (int)(v % 20) - 10, v * 3);
+}
+
+static bool check_seq(int len, int addr, const char *data, int rssi, int snr, uint32_t time, uint32_t &v)
+{
+    if (len < 4)
+        return false;
+
+    memcpy(&v, data, 4);
+    bool ok = len == 4 + (int)((v * 37) % 200) && addr == (int)(v % 65535) && rssi == -(int)(v % 120)
+              && snr == (int)(v % 20) - 10 && time == v * 3;
+    for (int i = 4; i < len; i++)
+        ok = ok && (uint8_t)data[i] == (uint8_t)(v + i);
+
+    return ok;
+}
+
+static int pull_seq(RYLR998_Spool &spool, uint32_t &v)
+{
+    char data[256];
+    int addr, rssi, snr;
+    uint32_t time;
+
+    int len = spool.pull(addr, data, sizeof(data), rssi, snr, time);
+    if (len > 0)
+        CHECK(check_seq(len, addr, data, rssi, snr, time, v));
+
+    return len;
+}
+
+static void test_log(uint32_t prog)
+{
+    unlink(IMAGE);
+    RYLR998_FileStorage fs(IMAGE, 16 * 1024, 1024, prog);
+    RYLR998_Spool spool(fs);
+    uint32_t v;
+
+    CHECK(spool.format());
+    for (uint32_t e = 1; e <= 20; e++)
+        CHECK(push_seq(spool, e));
+    CHECK(spool.size() == 20);
+
+    // peek() leaves the frame in place
+    char data[256];
+    int addr, rssi, snr;
+    uint32_t time;
+    int len = spool.peek(addr, data, sizeof(data), rssi, snr, time);
+    CHECK(check_seq(len, addr, data, rssi, snr, time, v) && v == 1);
+    CHECK(spool.size() == 20);
+
+    for (uint32_t e = 1; e <= 5; e++)
+        CHECK(pull_seq(spool, v) > 0 && v == e);
+    CHECK(spool.commit());
+
+    // A mount finds the frames not drained
+    {
+        RYLR998_Spool again(fs);
+        CHECK(again.mount());
+        CHECK(again.size() == 15);
+        for (uint32_t e = 6; e <= 20; e++)
+            CHECK(pull_seq(again, v) > 0 && v == e);
+        CHECK(again.size() == 0 && pull_seq(again, v) == 0);
+        for (uint32_t e = 21; e <= 25; e++)
+            CHECK(push_seq(again, e));
+        CHECK(again.commit());
+    }
+    {
+        RYLR998_Spool again(fs);
+        CHECK(again.mount());
+        CHECK(again.size() == 5);
+        for (uint32_t e = 21; e <= 25; e++)
+            CHECK(pull_seq(again, v) > 0 && v == e);
+    }
+
+    // A full ring drops the oldest frames and keeps the rest in order
+    RYLR998_Spool full(fs);
+    CHECK(full.format());
+    for (uint32_t e = 1; e <= 500; e++)
+        CHECK(push_seq(full, e));
+
+    RYLR998_Spool::spool_stats s = full.get_stats();
+    CHECK(s.dropped + full.size() == 500);
+
+    uint32_t prev = 0;
+    int n = 0;
+    while (pull_seq(full, v) > 0)
+    {
+        CHECK(prev == 0 || v == prev + 1);
+        prev = v;
+        n++;
+    }
+    CHECK(prev == 500 && n == (int)(500 - s.dropped));
+
+    printf("log, program size %u: overflow kept %d of 500, %u erases, %u bytes written\n",
+           prog, n, s.erases, s.bytes_written);
+}
+
+static void test_power_loss(uint32_t prog, int rounds, unsigned seed)
+{
+    unlink(IMAGE);
+    RYLR998_FileStorage fs(IMAGE, 8 * 1024, 1024, prog);
+    {
+        RYLR998_Spool spool(fs);
+        CHECK(spool.format());
+    }
+
+    srand(seed);
+
+    uint32_t next = 1;
+    uint32_t durable_push = 0;      // last frame known committed
+    uint32_t durable_ack = 0;       // last frame drained with its ack committed
+    uint32_t last_pulled = 0;
+    bool dropped = false;
+    int crashes = 0, torn = 0;
+
+    for (int r = 0; r < rounds; r++)
+    {
+        Faulty storage(fs);
+        RYLR998_Spool spool(storage);
+        CHECK(spool.mount());
+        torn += spool.get_stats().torn;
+
+        // The recovered frames are contiguous, start after the last ack
+        // committed and end at or after the last frame committed
+        std::deque<uint32_t> got;
+        uint32_t v;
+        int count = spool.size();
+        for (int i = 0; i < count && pull_seq(spool, v) > 0; i++)
+            got.push_back(v);
+        CHECK((int)got.size() == count);
+
+        if (!got.empty())
+        {
+            for (size_t i = 1; i < got.size(); i++)
+                CHECK(got[i] == got[i - 1] + 1);
+            CHECK(got.front() > durable_ack);
+            CHECK(got.back() >= durable_push);
+
+            durable_push = got.back();
+            last_pulled = got.back();
+            if (next <= got.back())
+                next = got.back() + 1;
+        }
+        else if (!dropped && durable_push > last_pulled)
+        {
+            // Frames drained may be gone, a failed commit can leave its
+            // ack behind; those never drained may not
+            printf("FAIL  frames %u to %u lost in round %d\n", last_pulled + 1, durable_push, r);
+            failures++;
+        }
+
+        CHECK(spool.commit());
+        durable_ack = last_pulled;
+        uint32_t last_pushed = durable_push;
+
+        // Random work until the power goes at a random byte
+        storage.budget = rand() % 6000;
+        std::deque<uint32_t> pending;
+        for (int op = 0; op < 200 && !storage.dead; op++)
+        {
+            int k = rand() % 10;
+            if (k < 5)
+            {
+                if (push_seq(spool, next))
+                {
+                    pending.push_back(next);
+                    last_pushed = next;
+                }
+                next++;
+            }
+            else if (k < 8)
+            {
+                if (pull_seq(spool, v) > 0)
+                {
+                    // Frames dropped by a full ring are skipped
+                    while (!pending.empty() && pending.front() < v)
+                        pending.pop_front();
+                    CHECK(!pending.empty() && pending.front() == v);
+                    if (!pending.empty())
+                        pending.pop_front();
+                    last_pulled = v;
+                }
+            }
+            else
+            {
+                uint32_t pulled = last_pulled, pushed = last_pushed;
+                if (spool.commit() && !storage.dead)
+                {
+                    durable_push = pushed;
+                    durable_ack = pulled;
+                }
+            }
+        }
+
+        if (storage.dead)
+            crashes++;
+        dropped = spool.get_stats().dropped > 0;
+    }
+
+    printf("power loss, program size %u: %d rounds, %d crashes, %d torn records\n", prog, rounds, crashes, torn);
+}
+
+// A failed program keeps its records, they go to the next sector. At a
+// sector start the header is lost with them, mid-sector the records before
+// the failure address are left behind as copies.
+static void test_failed_program(uint32_t prog, long at)
+{
+    unlink(IMAGE);
+    RYLR998_FileStorage fs(IMAGE, 16 * 1024, 1024, prog);
+    Faulty storage(fs);
+    RYLR998_Spool spool(storage);
+    uint32_t v, pulled = 0;
+
+    CHECK(spool.format());
+    storage.fail_at = at;
+    for (uint32_t e = 1; e <= 60; e++)
+    {
+        // A push refused by the failure is made again
+        if (!push_seq(spool, e))
+            CHECK(push_seq(spool, e));
+        if (e % 10 == 0 && !spool.commit())
+            CHECK(spool.commit());
+
+        // Frames are drained while some of them wait in RAM
+        if (e % 4 == 0)
+            CHECK(pull_seq(spool, v) > 0 && v == ++pulled);
+    }
+    CHECK(spool.commit());
+
+    RYLR998_Spool::spool_stats s = spool.get_stats();
+    CHECK(storage.fail_at < 0 && s.errors == 1 && s.dropped == 0);
+
+    RYLR998_Spool again(fs);
+    CHECK(again.mount());
+    int recovered = again.size();
+    CHECK(recovered == (int)(60 - pulled));
+    while (pull_seq(again, v) > 0)
+        CHECK(v == ++pulled);
+    CHECK(pulled == 60);
+
+    printf("failed program at %ld, program size %u: 60 frames in order, %d of them after a mount\n",
+           at, prog, recovered);
+}
+
+// A pseudo-terminal that answers like the module and records the frames
+// sent. A mute module answers nothing.
+struct Module {
+    int master;
+    std::string name;
+    std::atomic<bool> running;
+    std::atomic<bool> mute;
+    std::mutex lock;
+    std::vector<std::string> sent;
+    std::thread thread;
+
+    Module() : running(true), mute(false)
+    {
+        master = posix_openpt(O_RDWR | O_NOCTTY);
+        grantpt(master);
+        unlockpt(master);
+        name = ptsname(master);
+
+        struct termios tio;
+        tcgetattr(master, &tio);
+        cfmakeraw(&tio);
+        tcsetattr(master, TCSANOW, &tio);
+        fcntl(master, F_SETFL, O_NONBLOCK);
+
+        thread = std::thread(&Module::loop, this);
+    }
+
+    ~Module()
+    {
+        running = false;
+        thread.join();
+        close(master);
+    }
+
+    void out(const std::string &s)
+    {
+        size_t done = 0;
+        while (done < s.size())
+        {
+            int n = write(master, s.data() + done, s.size() - done);
+            if (n > 0)
+                done += n;
+            else
+                usleep(100);
+        }
+    }
+
+    void reply(const std::string &cmd)
+    {
+        if (mute)
+            return;
+
+        if (cmd == "AT")
+            out("+OK\r\n");
+        else if (cmd.compare(0, 8, "AT+SEND=") == 0)
+        {
+            // AT+SEND=<addr>,<len>,<data>
+            size_t data = cmd.find(',', cmd.find(',') + 1) + 1;
+            std::lock_guard<std::mutex> guard(lock);
+            sent.push_back(cmd.substr(data));
+            out("+OK\r\n");
+        }
+        else
+            out("+ERR=4\r\n");
+    }
+
+    void loop(void)
+    {
+        std::string line;
+
+        while (running)
+        {
+            char c;
+            if (read(master, &c, 1) <= 0)
+            {
+                struct pollfd pfd = { master, POLLIN, 0 };
+                poll(&pfd, 1, 5);
+                continue;
+            }
+
+            line += c;
+            if (line.size() >= 2 && line.compare(line.size() - 2, 2, "\r\n") == 0)
+            {
+                reply(line.substr(0, line.size() - 2));
+                line.clear();
+            }
+        }
+    }
+};
+
+// Packets from..to arrive and are parsed
+static void deliver(Module &m, RYLR998 &rylr, int from, int to)
+{
+    for (int v = from; v <= to; v++)
+    {
+        char line[64];
+        snprintf(line, sizeof(line), "+RCV=7,6,f%05d,-50,9\r\n", v);
+        m.out(line);
+    }
+    usleep(20000);
+
+    int count = -1;
+    for (int i = 0; i < 100; i++)
+    {
+        int now = rylr.poll();
+        if (now == count)
+            break;
+        count = now;
+        usleep(2000);
+    }
+}
+
+static void drain(RYLR998 &rylr, int max, std::vector<int> &got)
+{
+    char buf[RYLR998_MAX_PAYLOAD + 1];
+    int from;
+
+    while (max-- > 0 && rylr.recv(from, buf, RYLR998_MAX_PAYLOAD) > 0)
+        got.push_back(atoi(buf + 1));
+}
+
+static bool in_order(const std::vector<int> &got)
+{
+    for (size_t i = 1; i < got.size(); i++)
+    {
+        if (got[i] <= got[i - 1])
+            return false;
+    }
+    return true;
+}
+
+static void test_rx_order(void)
+{
+    Module m;
+    std::vector<int> got;
+
+    unlink(IMAGE);
+    RYLR998_FileStorage fs(IMAGE, 64 * 1024, 4096, 1);
+    {
+        RYLR998_Spool spool(fs);
+        CHECK(spool.format());
+        RYLR998 rylr(m.name.c_str());
+        rylr.set_spool(&spool, 8);
+
+        deliver(m, rylr, 1, 40);
+        CHECK(spool.size() == 32);
+        drain(rylr, 10, got);
+        deliver(m, rylr, 41, 60);
+        drain(rylr, 10, got);
+        CHECK(spool.commit());
+    }
+    CHECK(got.size() == 20 && got.front() == 1 && got.back() == 20 && in_order(got));
+
+    // Reset: RAM is lost, the spool comes back and goes before the packets
+    // received since
+    got.clear();
+    {
+        RYLR998_Spool spool(fs);
+        CHECK(spool.mount());
+        int recovered = spool.size();
+        RYLR998 rylr(m.name.c_str());
+
+        deliver(m, rylr, 1001, 1005);
+        rylr.set_spool(&spool, 8);
+        deliver(m, rylr, 1006, 1010);
+        drain(rylr, 1000, got);
+
+        CHECK(got.size() == (size_t)recovered + 10);
+        CHECK(in_order(got));
+        CHECK(!got.empty() && got.back() == 1010);
+        printf("reset: %d packets recovered, then the 10 received since\n", recovered);
+    }
+
+    // A failed spool write keeps the packet in RAM, and those after it
+    // follow. The spooled packets wait for the storage to come back.
+    got.clear();
+    {
+        Faulty storage(fs);
+        RYLR998_Spool spool(storage);
+        CHECK(spool.format());
+        RYLR998 rylr(m.name.c_str());
+        rylr.set_spool(&spool, 4);
+
+        deliver(m, rylr, 1, 10);
+        CHECK(spool.commit());
+        storage.broken = true;
+        deliver(m, rylr, 11, 40);
+        storage.broken = false;
+        deliver(m, rylr, 41, 50);
+        CHECK(spool.commit());
+        drain(rylr, 1000, got);
+
+        RYLR998_Spool::spool_stats s = spool.get_stats();
+        CHECK(s.errors > 0 && s.dropped == 0);
+        CHECK(got.size() == 50);
+        CHECK(in_order(got));
+        CHECK(!got.empty() && got.back() == 50);
+        printf("storage errors: %d of 50 packets in order, %u storage calls failed\n",
+               (int)got.size(), s.errors);
+    }
+
+    unlink(IMAGE);
+}
+
+static void test_tx_spool(void)
+{
+    Module m;
+    char data[16];
+
+    unlink(TX_IMAGE);
+    RYLR998_FileStorage fs(TX_IMAGE, 16 * 1024, 4096, 1);
+
+    // The module goes silent, frames are spooled and the board resets
+    {
+        RYLR998_Spool spool(fs);
+        CHECK(spool.format());
+        RYLR998 rylr(m.name.c_str());
+        rylr.set_tx_spool(&spool);
+        CHECK(rylr.at_available());
+
+        m.mute = true;
+        for (int v = 1; v <= 10; v++)
+        {
+            int len = snprintf(data, sizeof(data), "t%05d", v);
+            CHECK(!rylr.send(5, data, len));
+        }
+
+        RYLR998::health_stats h = rylr.get_health();
+        CHECK(h.down);
+        CHECK(h.tx_spooled == 10 && h.tx_queued == 0 && h.tx_dropped == 0);
+        CHECK(spool.commit());
+    }
+
+    // After the reset the module answers again, recover() sends the spool
+    m.mute = false;
+    {
+        RYLR998_Spool spool(fs);
+        CHECK(spool.mount());
+        CHECK(spool.size() == 10);
+        RYLR998 rylr(m.name.c_str());
+        rylr.set_tx_spool(&spool);
+        CHECK(rylr.recover());
+
+        RYLR998::health_stats h = rylr.get_health();
+        CHECK(h.tx_spooled == 0 && h.tx_replayed == 10);
+    }
+
+    std::lock_guard<std::mutex> guard(m.lock);
+    bool ok = m.sent.size() == 10;
+    for (size_t i = 0; ok && i < m.sent.size(); i++)
+    {
+        snprintf(data, sizeof(data), "t%05d", (int)i + 1);
+        ok = m.sent[i] == data;
+    }
+    CHECK(ok);
+    printf("tx spool: %d of 10 frames sent in order after the reset\n", (int)m.sent.size());
+
+    unlink(TX_IMAGE);
+}
+
+int main(int argc, char **argv)
+{
+    int rounds = (argc > 1) ? atoi(argv[1]) : 300;
+
+    setvbuf(stdout, NULL, _IONBF, 0);
+
+    test_log(1);
+    test_log(256);
+    for (unsigned seed = 1; seed <= 4; seed++)
+    {
+        test_power_loss(1, rounds, seed);
+        test_power_loss(16, rounds, seed + 100);
+        test_power_loss(256, rounds, seed + 200);
+    }
+    test_failed_program(1, 5 * 1024);
+    test_failed_program(1, 2500);
+    test_failed_program(256, 3000);
+    test_rx_order();
+    test_tx_spool();
+
+    unlink(IMAGE);
+    printf("%s\n", (failures == 0) ? "all passed" : "FAILED");
+    return (failures == 0) ? 0 : 1;
+}
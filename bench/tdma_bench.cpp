@@ -0,0 +1,484 @@
+/*
+ * Copyright (c) 2023, Nuvoton Technology Corporation
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/* TDMA benchmark for Linux.
+ *
+ * One pseudo-terminal per node plays the module, all on a shared
+ * simulated channel: a frame is on the air for its LoRa time on air, two
+ * frames that overlap in time are both lost, and a module does not hear
+ * while it transmits. Every node sends a frame to the gateway at random
+ * intervals, first with plain send() and then through RYLR998_TDMA, and
+ * the gateway counts the frames it gets.
+ */
+
+// g++ -std=c++14 -O2 -pthread -IRYLR998 RYLR998/*.cpp RYLR998/posix/*.cpp bench/tdma_bench.cpp -o tdma_bench
+// ./tdma_bench [nodes] [interval_ms] [seconds]
+
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <string>
+#include <thread>
+#include <vector>
+#include <fcntl.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <termios.h>
+#include <unistd.h>
+
+#include "RYLR998.h"
+#include "RYLR998_TDMA.h"
+
+// SF7, 500 kHz, 4/5, 12 symbols preamble
+#define SIM_SF          7
+#define SIM_BW          9
+#define SIM_BW_HZ       500000
+#define SIM_CR          1
+#define SIM_PREAMBLE    12
+
+#define GATEWAY_ADDR    1
+#define FRAME_LEN       20
+
+static uint64_t now_us(void)
+{
+    return std::chrono::duration_cast<std::chrono::microseconds>(
+               std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// Same formula as RYLR998::get_time_on_air_us()
+static int time_on_air_us(int len)
+{
+    int64_t t_sym = ((int64_t)1 << SIM_SF) * 1000000 / SIM_BW_HZ;
+    int de = (t_sym > 16000) ? 1 : 0;
+    int num = 8 * len - 4 * SIM_SF + 28 + 16;
+    int den = 4 * (SIM_SF - 2 * de);
+    int n = (num > 0) ? (num + den - 1) / den : 0;
+    int64_t symbols4 = 4 * SIM_PREAMBLE + 17 + 4 * (8 + n * (SIM_CR + 4));
+
+    return (int)(symbols4 * t_sym / 4);
+}
+
+static void write_all(int fd, const char *data, int len)
+{
+    while (len > 0)
+    {
+        int n = write(fd, data, len);
+        if (n > 0)
+        {
+            data += n;
+            len -= n;
+            continue;
+        }
+        struct pollfd pfd = { fd, POLLOUT, 0 };
+        poll(&pfd, 1, 10);
+    }
+}
+
+struct Module;
+
+struct Transmission {
+    Module *from;
+    int dst;
+    std::string data;
+    uint64_t start;
+    uint64_t end;
+    bool collided;
+    bool done;
+};
+
+// The shared channel, every module hears every other one
+struct Channel {
+    std::mutex lock;
+    std::vector<Module *> modules;
+    std::vector<Transmission> air;
+    int sent = 0;
+    int collided = 0;
+    int deaf = 0;           // copies missed by a module that was transmitting
+
+    uint64_t transmit(Module *from, int dst, const std::string &data);
+    void run(std::atomic<bool> &running);
+};
+
+// A pseudo-terminal that answers like the module
+struct Module {
+    int master;
+    std::string name;
+    int addr;
+    Channel *channel;
+    std::mutex out_lock;
+    std::atomic<bool> running;
+    std::thread thread;
+
+    Module(int addr, Channel *channel);
+    ~Module();
+    void out(const std::string &s);
+    void loop(void);
+};
+
+uint64_t Channel::transmit(Module *from, int dst, const std::string &data)
+{
+    std::lock_guard<std::mutex> guard(lock);
+    uint64_t now = now_us();
+    Transmission t = { from, dst, data, now, now + time_on_air_us(data.size()), false, false };
+
+    for (Transmission &o : air)
+    {
+        if (o.end > t.start && !o.done)
+        {
+            o.collided = true;
+            t.collided = true;
+        }
+    }
+    air.push_back(t);
+    sent++;
+
+    return t.end;
+}
+
+void Channel::run(std::atomic<bool> &running)
+{
+    while (running)
+    {
+        usleep(100);
+
+        std::lock_guard<std::mutex> guard(lock);
+        uint64_t now = now_us();
+
+        for (Transmission &t : air)
+        {
+            if (t.done || t.end > now)
+                continue;
+
+            t.done = true;
+            if (t.collided)
+            {
+                collided++;
+                continue;
+            }
+
+            for (Module *m : modules)
+            {
+                if (m == t.from || (t.dst != 0 && t.dst != m->addr))
+                    continue;
+
+                // Half duplex: a module sending during the frame misses it
+                bool busy = false;
+                for (Transmission &o : air)
+                {
+                    if (o.from == m && o.start < t.end && o.end > t.start)
+                        busy = true;
+                }
+                if (busy)
+                {
+                    deaf++;
+                    continue;
+                }
+
+                m->out("+RCV=" + std::to_string(t.from->addr) + "," + std::to_string(t.data.size()) + ","
+                       + t.data + ",-60,10\r\n");
+            }
+        }
+
+        // Keep a second of history for the overlap checks
+        while (!air.empty() && air.front().done && now - air.front().end > 1000000)
+            air.erase(air.begin());
+    }
+}
+
+Module::Module(int addr, Channel *channel) : addr(addr), channel(channel), running(true)
+{
+    master = posix_openpt(O_RDWR | O_NOCTTY);
+    grantpt(master);
+    unlockpt(master);
+    name = ptsname(master);
+
+    struct termios tio;
+    tcgetattr(master, &tio);
+    cfmakeraw(&tio);
+    tcsetattr(master, TCSANOW, &tio);
+    fcntl(master, F_SETFL, O_NONBLOCK);
+
+    thread = std::thread(&Module::loop, this);
+}
+
+Module::~Module()
+{
+    running = false;
+    thread.join();
+    close(master);
+}
+
+void Module::out(const std::string &s)
+{
+    std::lock_guard<std::mutex> guard(out_lock);
+    write_all(master, s.data(), s.size());
+}
+
+void Module::loop(void)
+{
+    std::string line;
+    int want = -1;
+    int dst = 0;
+    uint64_t busy_until = 0;
+
+    while (running)
+    {
+        char c;
+        if (read(master, &c, 1) <= 0)
+        {
+            struct pollfd pfd = { master, POLLIN, 0 };
+            poll(&pfd, 1, 5);
+            continue;
+        }
+        line += c;
+
+        // AT+SEND=<addr>,<len>, then len bytes of data and CR LF
+        if (want < 0 && line.compare(0, 8, "AT+SEND=") == 0)
+        {
+            int a, l, n = 0;
+            if (line.back() == ',' && sscanf(line.c_str(), "AT+SEND=%d,%d,%n", &a, &l, &n) == 2 && n == (int)line.size())
+            {
+                want = l;
+                dst = a;
+                line.clear();
+            }
+            continue;
+        }
+
+        if (want >= 0)
+        {
+            if ((int)line.size() == want + 2)
+            {
+                std::string data = line.substr(0, want);
+                line.clear();
+                want = -1;
+
+                if (now_us() < busy_until)
+                {
+                    out("+ERR=17\r\n");
+                    continue;
+                }
+                busy_until = channel->transmit(this, dst, data);
+                out("+OK\r\n");
+            }
+            continue;
+        }
+
+        if (line.size() < 2 || line.compare(line.size() - 2, 2, "\r\n") != 0)
+            continue;
+
+        std::string cmd = line.substr(0, line.size() - 2);
+        line.clear();
+
+        char reply[64];
+        if (cmd == "AT")
+            out("+OK\r\n");
+        else if (cmd == "AT+ADDRESS?")
+            out("+ADDRESS=" + std::to_string(addr) + "\r\n");
+        else if (cmd == "AT+UID?")
+        {
+            snprintf(reply, sizeof(reply), "+UID=0000000000000000%08X\r\n", addr * 2654435761u);
+            out(reply);
+        }
+        else if (cmd == "AT+PARAMETER?")
+        {
+            snprintf(reply, sizeof(reply), "+PARAMETER=%d,%d,%d,%d\r\n", SIM_SF, SIM_BW, SIM_CR, SIM_PREAMBLE);
+            out(reply);
+        }
+        else
+            out("+ERR=4\r\n");
+    }
+}
+
+struct Result {
+    int offered;
+    int delivered;
+    int dropped;            // refused by a full TDMA queue
+    int sent;
+    int collided;
+    int deaf;
+};
+
+static Result run(std::vector<std::unique_ptr<Module>> &modules, Channel &channel, bool tdma,
+                  int interval_ms, int seconds)
+{
+    int nodes = modules.size() - 1;
+    std::vector<std::unique_ptr<RYLR998>> radios;
+    std::vector<std::unique_ptr<RYLR998_TDMA>> macs;
+
+    for (size_t i = 0; i < modules.size(); i++)
+    {
+        radios.emplace_back(new RYLR998(modules[i]->name.c_str()));
+        macs.emplace_back(new RYLR998_TDMA(*radios[i], i == 0));
+    }
+
+    if (tdma && !macs[0]->start(nodes, 2, FRAME_LEN))
+    {
+        printf("start failed\n");
+        exit(1);
+    }
+
+    std::atomic<bool> traffic(false);
+    std::atomic<bool> running(true);
+    std::atomic<int> offered(0);
+    std::atomic<int> dropped(0);
+    std::set<std::string> got;
+    std::vector<std::thread> threads;
+
+    // The gateway counts distinct frames
+    threads.emplace_back([&]() {
+        char buf[RYLR998_MAX_PAYLOAD + 1];
+        int from;
+        while (running)
+        {
+            int len = (tdma) ? macs[0]->recv(from, buf, RYLR998_MAX_PAYLOAD)
+                      : radios[0]->recv(from, buf, RYLR998_MAX_PAYLOAD);
+            if (len > 0)
+                got.insert(std::string(buf, len));
+            else
+                usleep(500);
+        }
+    });
+
+    for (int n = 1; n <= nodes; n++)
+    {
+        threads.emplace_back([&, n]() {
+            unsigned int seed = n;
+            char buf[RYLR998_MAX_PAYLOAD + 1];
+            int from, seq = 0;
+            uint64_t next = 0;
+
+            while (running)
+            {
+                uint64_t now = now_us();
+                if (traffic && now >= next)
+                {
+                    // Room for any node and sequence number, the first
+                    // FRAME_LEN bytes go on air
+                    char frame[48];
+                    snprintf(frame, sizeof(frame), "node%3d frame%7d", n, seq++);
+
+                    offered++;
+                    bool done = (tdma) ? macs[n]->send(GATEWAY_ADDR, frame, FRAME_LEN)
+                                : radios[n]->send(GATEWAY_ADDR, frame, FRAME_LEN);
+                    if (!done)
+                        dropped++;
+
+                    // Uniform from half to one and a half intervals
+                    uint64_t gap = (uint64_t)interval_ms * (500 + rand_r(&seed) % 1000);
+                    next = (next == 0) ? now + gap : next + gap;
+                }
+
+                if (tdma)
+                    macs[n]->recv(from, buf, RYLR998_MAX_PAYLOAD);
+                else
+                    radios[n]->recv(from, buf, RYLR998_MAX_PAYLOAD);
+                usleep(500);
+            }
+        });
+    }
+
+    // Let the nodes join first
+    if (tdma)
+    {
+        for (int i = 0; i < 100 && macs[0]->get_stats().joined < nodes; i++)
+            usleep(100000);
+        printf("  %d of %d nodes joined\n", macs[0]->get_stats().joined, nodes);
+    }
+
+    int sent0, collided0, deaf0;
+    {
+        std::lock_guard<std::mutex> guard(channel.lock);
+        sent0 = channel.sent;
+        collided0 = channel.collided;
+        deaf0 = channel.deaf;
+    }
+
+    traffic = true;
+    sleep(seconds);
+    traffic = false;
+    // Drain what is still queued
+    sleep(2);
+    running = false;
+    for (std::thread &t : threads)
+        t.join();
+
+    Result r;
+    r.offered = offered;
+    r.delivered = got.size();
+    r.dropped = dropped;
+    {
+        std::lock_guard<std::mutex> guard(channel.lock);
+        r.sent = channel.sent - sent0;
+        r.collided = channel.collided - collided0;
+        r.deaf = channel.deaf - deaf0;
+    }
+
+    if (tdma)
+    {
+        RYLR998_TDMA::tdma_stats s = macs[0]->get_stats();
+        printf("  superframes %u, slot utilization %d%%\n", s.superframes, macs[0]->get_utilization());
+    }
+
+    return r;
+}
+
+static void report(const char *name, const Result &r)
+{
+    printf("%-6s offered %5d  delivered %5d (%5.1f%%)  refused %4d  on air %5d  collided %4d  missed while sending %4d\n",
+           name, r.offered, r.delivered, (r.offered > 0) ? 100.0 * r.delivered / r.offered : 0.0,
+           r.dropped, r.sent, r.collided, r.deaf);
+}
+
+int main(int argc, char **argv)
+{
+    int nodes = (argc > 1) ? atoi(argv[1]) : 8;
+    int interval_ms = (argc > 2) ? atoi(argv[2]) : 500;
+    int seconds = (argc > 3) ? atoi(argv[3]) : 10;
+
+    setvbuf(stdout, NULL, _IONBF, 0);
+
+    Channel channel;
+    std::vector<std::unique_ptr<Module>> modules;
+    for (int i = 0; i <= nodes; i++)
+        modules.emplace_back(new Module(GATEWAY_ADDR + i, &channel));
+    for (auto &m : modules)
+        channel.modules.push_back(m.get());
+
+    std::atomic<bool> running(true);
+    std::thread channel_thread(&Channel::run, &channel, std::ref(running));
+
+    int toa = time_on_air_us(FRAME_LEN);
+    printf("%d nodes, a %d byte frame every %d ms each, %d us on air, offered load %.2f\n",
+           nodes, FRAME_LEN, interval_ms, toa, (double)nodes * toa / (interval_ms * 1000.0));
+
+    printf("ALOHA:\n");
+    Result aloha = run(modules, channel, false, interval_ms, seconds);
+    printf("TDMA:\n");
+    Result tdma = run(modules, channel, true, interval_ms, seconds);
+
+    report("ALOHA", aloha);
+    report("TDMA", tdma);
+
+    running = false;
+    channel_thread.join();
+
+    return 0;
+}
@@ -18,6 +18,7 @@
 
 #include "mbed.h"
 #include "RYLR998/RYLR998.h"
+#include "RYLR998/RYLR998_Log.h"
 
 /***
  * Build the sample code to Tx or Rx
@@ -26,6 +27,12 @@
  */
 #define BUILD_TX 1
 
+/***
+ * Build the payload codec benchmark instead of the Tx/Rx sample
+ * 1 to build the benchmark
+ */
+#define BUILD_BENCH 0
+
 #define TX_MODULE_ADDRESS   121
 #define RX_MODULE_ADDRESS   120
 #define NETWORK_ID          18
@@ -38,11 +45,58 @@
 
 RYLR998 rylr(D1, D0, D2);
 
+#if defined(BUILD_BENCH) && BUILD_BENCH
+static const char bench_dict[] = "HELLO INFO WARN ERROR node=temp=hum=batt=rssi=snr= uptime=";
+
+static const char *bench_payloads[] = {
+    "HELLO 42",
+    "INFO node=121 temp=23.5 hum=40 batt=3.71",
+    "WARN node=121 batt=3.30 uptime=86400",
+    "ERROR node=121 rssi=-112 snr=-7",
+};
+
+static void bench_compression(bool use_dict)
+{
+    RYLR998_Compressor lz((const uint8_t *)bench_dict, sizeof(bench_dict) - 1);
+    uint8_t out[RYLR998_MAX_PAYLOAD], back[RYLR998_MAX_PAYLOAD];
+    const int rounds = 1000;
+
+    for (const char *p : bench_payloads) {
+        int len = strlen(p);
+        int clen = 0, dlen = 0;
+        Timer t;
+
+        t.start();
+        for (int i = 0; i < rounds; i++)
+            clen = lz.compress((const uint8_t *)p, len, out, sizeof(out), use_dict);
+        auto c_us = t.elapsed_time().count();
+
+        t.reset();
+        for (int i = 0; i < rounds; i++)
+            dlen = lz.decompress(out, clen, back, sizeof(back), use_dict);
+        auto d_us = t.elapsed_time().count();
+
+        printf("dict(%d) %3d -> %3d bytes, compress %d.%02d us, decompress %d.%02d us%s\n",
+               use_dict, len, clen,
+               (int)(c_us / rounds), (int)(c_us % rounds / 10),
+               (int)(d_us / rounds), (int)(d_us % rounds / 10),
+               (dlen == len && memcmp(back, p, len) == 0) ? "" : " MISMATCH");
+    }
+}
+#endif
+
 int main()
 {
     printf("\nRYLR998 example uses ATCmdParser\n");
     printf("Mbed OS version %d\n", MBED_VERSION);
 
+#if defined(BUILD_BENCH) && BUILD_BENCH
+    bench_compression(false);
+    bench_compression(true);
+    printf("\nDone\n");
+    return 0;
+#endif
+
     /* Get module firmware version */
     struct RYLR998::fw_version rylr_v = rylr.get_fw_version();
     printf("RYLR998 version is %d.%d.%d\n", rylr_v.major, rylr_v.minor, rylr_v.patch);
@@ -102,7 +156,12 @@ int main()
     }
 
 #else
-    // Rx side
+    // Rx side. Printing at stdio speed would stall RX draining, so the
+    // lines are formatted later by the log thread.
+    RYLR998_Log rx_log;
+    rx_log.start();
+    rylr.set_log(&rx_log);
+
     char r[32];
     int i, rssi, snr, addr, len;
     while(1) {
@@ -112,7 +171,7 @@ int main()
             len = rylr.recv(addr, r, 31);
             snr = rylr.get_snr();
             rssi = rylr.get_rssi();
-            printf("Recv #%d: Addr(%d) RSSI(%d) SNR(%d) Len(%d) \"%s\"\n", i, addr, rssi, snr, len, r);
+            rx_log.log("Recv #%d: Addr(%d) RSSI(%d) SNR(%d) Len(%d) \"%s\"\n", i, addr, rssi, snr, len, r);
         }
     }
 